@@ -0,0 +1,1023 @@
+//--------------------------------------------------------------------
+//
+//   Visual Binary Diff
+//   Copyright 1997-2017 by Christopher J. Madsen
+//
+//   Support class for ANSI terminals without curses
+//
+//   The windows are drawn into an in-memory screen, which is compared
+//   with a shadow copy of what the terminal is showing.  Only the
+//   cells that changed are sent, using the shortest cursor movement
+//   available.  This keeps the output small over slow connections.
+//
+//   In headless mode there is no terminal.  Keys come from a queue
+//   (or standard input), the output is only counted, and the final
+//   screen is printed on shutdown.  That allows the display code to be
+//   tested and timed in batch.
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//--------------------------------------------------------------------
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ConWin.hpp"
+
+void exitMsg(int status, const char* message); // From vbindiff.cpp
+
+using std::deque;
+using std::string;
+using std::vector;
+
+const unsigned char styleDefault = 0xFF; // The terminal's own colors
+
+static const char *const sgrStyle[] = {
+  "0;37;44",                    // cBackground
+  "0;37;44",                    // cPromptWin
+  "0;1;37;44",                  // cPromptKey
+  "0;1;37;44",                  // cPromptBdr
+  "0;30;47",                    // cCurrentMode
+  "0;30;47",                    // cFileName
+  "0;37;44",                    // cFileWin
+  "0;1;31;44",                  // cFileDiff
+  "0;1;33;44",                  // cFileEdit
+  "0;30;46"                     // cFileMatch
+};
+
+const int  inFd  = 0;
+const int  outFd = 1;
+
+const double  frameInterval = 1.0 / 30; // Minimum seconds between frames
+const int     escapeWait    = 25;       // Milliseconds to wait after ESC
+
+struct ScrollRegion
+{
+  short  top, bottom, lines;
+};
+
+static bool            started  = false;
+static bool            headless = false;
+static struct termios  savedMode;
+
+static int       screenW = 0, screenH = 0;
+static ConCell*  shown  = NULL; // What the terminal is displaying
+static ConCell*  wanted = NULL; // What it should be displaying
+
+static int            outX, outY;       // Terminal cursor, -1 if unknown
+static unsigned char  outStyle;         // Current terminal colors
+static bool           outLine;          // Line drawing charset selected
+static bool           cursorShown;      // Terminal cursor is visible
+static bool           cursorWanted;
+
+static vector<ScrollRegion>  pendingScroll;
+
+static double         lastFrame = 0;
+static unsigned long  frameCount = 0;
+static unsigned long  byteCount  = 0;
+
+static deque<int>     keyQueue;
+static unsigned long  keyCount = 0;
+static unsigned long  beepCount = 0;
+static double         startTime;
+
+static unsigned char  inBuf[256];
+static int            inStart = 0, inEnd = 0;
+
+static volatile sig_atomic_t  resumed = 0;
+
+static const ConCell  blankCell = { ' ', styleDefault, false };
+
+//--------------------------------------------------------------------
+static double timeNow()
+{
+  struct timeval  tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+} // end timeNow
+
+//--------------------------------------------------------------------
+static void writeAll(const char* s, size_t length)
+{
+  while (length) {
+    ssize_t  written = write(outFd, s, length);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    s      += written;
+    length -= written;
+  }
+} // end writeAll
+
+//--------------------------------------------------------------------
+static void appendNum(string& out, int n)
+{
+  char  buf[12];
+  char* p = buf + sizeof(buf);
+
+  do {
+    *--p = '0' + n % 10;
+    n /= 10;
+  } while (n);
+
+  out.append(p, buf + sizeof(buf) - p);
+} // end appendNum
+
+//--------------------------------------------------------------------
+// Move the terminal cursor:
+//
+// Uses a relative move when that is shorter than an absolute one.
+
+static void gotoXY(string& out, int x, int y)
+{
+  if (x == outX && y == outY) return;
+
+  if (y == outY && outX >= 0 && x > outX) {
+    out += "\x1B[";
+    if (x - outX > 1) appendNum(out, x - outX);
+    out += 'C';
+  } else if (y == outY && outX >= 0 && x == 0) {
+    out += '\r';
+  } else {
+    out += "\x1B[";
+    appendNum(out, y + 1);
+    if (x) {
+      out += ';';
+      appendNum(out, x + 1);
+    }
+    out += 'H';
+  }
+
+  outX = x;
+  outY = y;
+} // end gotoXY
+
+//--------------------------------------------------------------------
+static void setStyle(string& out, unsigned char style)
+{
+  if (style == outStyle) return;
+
+  out += "\x1B[";
+  if (style != styleDefault) out += sgrStyle[style];
+  out += 'm';
+
+  outStyle = style;
+} // end setStyle
+
+//--------------------------------------------------------------------
+// Record that the terminal screen is blank:
+
+static void resetShadow()
+{
+  for (int i = screenW * screenH - 1; i >= 0; --i)
+    shown[i] = blankCell;
+
+  outX = outY  = 0;
+  outStyle     = styleDefault;
+  outLine      = false;
+  cursorShown  = true;
+} // end resetShadow
+
+//--------------------------------------------------------------------
+// Put the terminal into the mode we need:
+
+static void enterMode()
+{
+  struct termios  mode = savedMode;
+
+  mode.c_lflag &= ~(ICANON | ECHO);
+  mode.c_iflag &= ~(ICRNL | INLCR);
+  mode.c_cc[VMIN]  = 1;
+  mode.c_cc[VTIME] = 0;
+  tcsetattr(inFd, TCSADRAIN, &mode);
+
+  static const char  init[] = "\x1B[?1049h\x1B(B\x1B[m\x1B[H\x1B[2J";
+  writeAll(init, sizeof(init) - 1);
+
+  resetShadow();
+} // end enterMode
+
+//--------------------------------------------------------------------
+// Restore the terminal to the way we found it:
+//
+// This is called from signal handlers, so it must not allocate.
+
+static void leaveMode()
+{
+  static const char  done[] = "\x1B(B\x1B[m\x1B[?25h\x1B[?1049l";
+  writeAll(done, sizeof(done) - 1);
+
+  tcsetattr(inFd, TCSADRAIN, &savedMode);
+} // end leaveMode
+
+//--------------------------------------------------------------------
+static void signalHandler(int sig)
+{
+  if (sig == SIGCONT) {
+    if (started) {
+      enterMode();
+      resumed = 1;
+    }
+    return;
+  }
+
+  if (started) leaveMode();
+
+  signal(sig, SIG_DFL);
+  raise(sig);
+
+  if (sig == SIGTSTP)           // We get here when we're continued
+    signal(SIGTSTP, signalHandler);
+} // end signalHandler
+
+//--------------------------------------------------------------------
+// Read one byte of input:
+//
+// Input:
+//   timeout:  Milliseconds to wait (-1 for no limit)
+//
+// Returns:
+//   The byte read, or -1 if none arrived in time
+
+static int readByte(int timeout)
+{
+  if (inStart == inEnd) {
+    struct pollfd  pfd;
+    pfd.fd     = inFd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, timeout) <= 0) return -1;
+
+    ssize_t  got = read(inFd, inBuf, sizeof(inBuf));
+    if (got <= 0) return -1;
+
+    inStart = 0;
+    inEnd   = got;
+  } // end if buffer empty
+
+  return inBuf[inStart++];
+} // end readByte
+
+//--------------------------------------------------------------------
+static bool inputPending()
+{
+  if (inStart != inEnd) return true;
+
+  struct pollfd  pfd;
+  pfd.fd     = inFd;
+  pfd.events = POLLIN;
+
+  return (poll(&pfd, 1, 0) > 0);
+} // end inputPending
+
+//--------------------------------------------------------------------
+// Read a key, translating escape sequences:
+//
+// Input:
+//   timeout:  Milliseconds to wait for the first byte (-1 for no limit)
+//
+// Returns:
+//   The key pressed, or -1 if none arrived in time
+
+static int readTermKey(int timeout)
+{
+  for (;;) {
+    int  c = readByte(timeout);
+
+    if (c != KEY_ESCAPE) return c;
+
+    c = readByte(escapeWait);
+    if (c != '[' && c != 'O') {
+      if (c >= 0) --inStart;    // Put it back
+      return KEY_ESCAPE;
+    }
+
+    int   param = 0;
+    bool  first = true;         // Only the first parameter matters
+    while ((c = readByte(escapeWait)) >= 0 && c < 0x40) {
+      if (c == ';')
+        first = false;
+      else if (first && c >= '0' && c <= '9' && param < 100)
+        param = param * 10 + c - '0';
+    }
+
+    switch (c) {
+     case 'A': return KEY_UP;
+     case 'B': return KEY_DOWN;
+     case 'C': return KEY_RIGHT;
+     case 'D': return KEY_LEFT;
+     case 'H': return KEY_HOME;
+     case 'F': return KEY_END;
+     case '~':
+      switch (param) {
+       case 1: case 7: return KEY_HOME;
+       case 2:         return KEY_IC;
+       case 3:         return KEY_DC;
+       case 4: case 8: return KEY_END;
+       case 5:         return KEY_PPAGE;
+       case 6:         return KEY_NPAGE;
+      }
+      break;
+    } // end switch final character
+
+    // Ignore sequences we don't recognize
+    if (c < 0) return -1;
+  } // end forever
+} // end readTermKey
+
+//--------------------------------------------------------------------
+// Sound the bell:
+//
+// In headless mode, the beep is only counted, so it can't end up in
+// the screen printed at shutdown.
+
+void beep()
+{
+  if (headless)
+    ++beepCount;
+  else
+    writeAll("\a", 1);
+} // end beep
+
+//====================================================================
+// Class ConWindow:
+//
+// Member Variables:
+//   bottomWin, topWin:
+//     The ends of the stack of windows.  Windows higher in the stack
+//     cover the ones below them.  Reading a key raises the window to
+//     the top, as a curses panel would.
+//   data:
+//     The contents of the window, row by row
+//--------------------------------------------------------------------
+
+ConWindow*  ConWindow::bottomWin = NULL;
+ConWindow*  ConWindow::topWin    = NULL;
+
+//////////////////////////////////////////////////////////////////////
+// Static Member Functions:
+//--------------------------------------------------------------------
+// Start up the window system:
+//
+// Switches to the alternate screen and sets input mode:
+//
+// Returns:
+//   true:   Everything set up properly
+//   false:  Unable to initialize
+
+bool ConWindow::startup()
+{
+  if (started) return true;
+  if (!isatty(inFd) || !isatty(outFd)) return false;
+  if (tcgetattr(inFd, &savedMode) != 0) return false;
+
+  getScreenSize(screenW, screenH);
+
+  delete [] shown;              // In case we're starting up again
+  delete [] wanted;
+  shown  = new ConCell[screenW * screenH];
+  wanted = new ConCell[screenW * screenH];
+
+  cursorWanted = true;
+  enterMode();
+  started = true;
+
+  atexit(ConWindow::shutdown);  // just in case
+
+  signal(SIGINT,  signalHandler);
+  signal(SIGTERM, signalHandler);
+  signal(SIGHUP,  signalHandler);
+  signal(SIGTSTP, signalHandler);
+  signal(SIGCONT, signalHandler);
+
+  return true;
+} // end ConWindow::startup
+
+//--------------------------------------------------------------------
+// Start up without a terminal:
+//
+// The screen size comes from the COLUMNS and LINES environment
+// variables (default 80x24).  readKey takes keys from the queue
+// filled by pushKey, then from standard input (which may be a file
+// of keystrokes).  Once both are exhausted, the program exits
+// without asking about unsaved changes.  pollKey never returns a
+// key, so a script replays the same way every time.
+//
+// Returns:
+//   true:   Everything set up properly
+
+bool ConWindow::startupHeadless()
+{
+  if (started) return true;
+
+  headless = true;
+  getScreenSize(screenW, screenH);
+
+  shown  = new ConCell[screenW * screenH];
+  wanted = new ConCell[screenW * screenH];
+
+  cursorWanted = true;
+  resetShadow();
+  for (int i = screenW * screenH - 1; i >= 0; --i)
+    wanted[i] = blankCell;
+
+  started   = true;
+  startTime = timeNow();
+
+  atexit(ConWindow::shutdown);  // just in case
+
+  return true;
+} // end ConWindow::startupHeadless
+
+//--------------------------------------------------------------------
+// Shut down the window system:
+//
+// Restore the original screen and input mode.  In headless mode,
+// print the last frame to standard output and the statistics to
+// standard error instead.
+
+void ConWindow::shutdown()
+{
+  if (!started) return;
+
+  if (headless) {
+    for (int y = 0; y < screenH; ++y) {
+      const ConCell*  row = wanted + y * screenW;
+      int  length = screenW;
+      while (length && row[length-1].c == ' ') --length;
+      for (int x = 0; x < length; ++x)
+        putchar(!row[x].line ? row[x].c :
+                row[x].c == 'q' ? '-' : row[x].c == 'x' ? '|' : '+');
+      putchar('\n');
+    }
+    fflush(stdout);
+
+    fprintf(stderr,
+            "%lu keys, %lu beeps, %lu frames, %lu bytes, %.3f seconds\n",
+            keyCount, beepCount, frameCount, byteCount,
+            timeNow() - startTime);
+    started = false;
+    return;
+  } // end if headless
+
+  started = false;
+  leaveMode();
+
+#ifdef DEBUG
+  fprintf(stderr, "%lu frames, %lu bytes (%lu per frame)\n",
+          frameCount, byteCount, frameCount ? byteCount / frameCount : 0);
+#endif
+} // end ConWindow::shutdown
+
+//--------------------------------------------------------------------
+void ConWindow::getScreenSize(int& x, int& y)
+{
+  if (started) {
+    x = screenW;
+    y = screenH;
+    return;
+  }
+
+  struct winsize  ws;
+
+  if (!headless && ioctl(outFd, TIOCGWINSZ, &ws) == 0 &&
+      ws.ws_col && ws.ws_row) {
+    x = ws.ws_col;
+    y = ws.ws_row;
+  } else {
+    const char* s;
+    x = ((s = getenv("COLUMNS")) && atoi(s) > 0) ? atoi(s) : 80;
+    y = ((s = getenv("LINES"))   && atoi(s) > 0) ? atoi(s) : 24;
+  }
+} // end ConWindow::getScreenSize
+
+//--------------------------------------------------------------------
+// Return the screen as it would be displayed now:
+//
+// Returns:
+//   The cells of the screen, row by row (see getScreenSize)
+
+const ConCell* ConWindow::getScreen()
+{
+  compose();
+
+  return wanted;
+} // end ConWindow::getScreen
+
+//--------------------------------------------------------------------
+// Report how much output has been sent to the terminal:
+//
+// Output:
+//   frames:  The number of screen updates that sent anything
+//   bytes:   The total number of bytes sent for them
+
+void ConWindow::getStats(unsigned long& frames, unsigned long& bytes)
+{
+  frames = frameCount;
+  bytes  = byteCount;
+} // end ConWindow::getStats
+
+//--------------------------------------------------------------------
+void ConWindow::hideCursor()
+{
+  cursorWanted = false;
+} // end ConWindow::hideCursor
+
+//--------------------------------------------------------------------
+// Queue a key to be returned by readKey:
+
+void ConWindow::pushKey(int key)
+{
+  keyQueue.push_back(key);
+} // end ConWindow::pushKey
+
+//--------------------------------------------------------------------
+// The terminal has only one cursor shape, so insert is ignored.
+
+void ConWindow::showCursor(bool insert)
+{
+  cursorWanted = true;
+} // end ConWindow::showCursor
+
+//--------------------------------------------------------------------
+// Draw the visible windows into the wanted screen:
+
+void ConWindow::compose()
+{
+  for (int i = screenW * screenH - 1; i >= 0; --i)
+    wanted[i] = blankCell;
+
+  for (ConWindow* w = bottomWin; w; w = w->above) {
+    if (!w->visible) continue;
+
+    for (int y = 0; y < w->height; ++y) {
+      const int  sy = w->top + y;
+      if (sy < 0 || sy >= screenH) continue;
+
+      int  x     = (w->left < 0 ? -w->left : 0);
+      int  stop  = w->width;
+      if (w->left + stop > screenW) stop = screenW - w->left;
+
+      if (x < stop)
+        memcpy(wanted + sy * screenW + w->left + x,
+               w->data + y * w->width + x, (stop - x) * sizeof(ConCell));
+    } // end for each row in window
+  } // end for each window
+} // end ConWindow::compose
+
+//--------------------------------------------------------------------
+// Bring the terminal up to date:
+//
+// When keys are being held down, frames are skipped so that the
+// terminal does not fall behind the keyboard.
+//
+// Input:
+//   force:  Draw now, even if input is waiting
+
+void ConWindow::refresh(bool force)
+{
+  if (!started) return;
+
+  if (resumed) {
+    resumed = 0;
+    pendingScroll.clear();
+  }
+
+  const double  now = timeNow();
+
+  if (!force && !headless && now - lastFrame < frameInterval &&
+      inputPending())
+    return;
+
+  compose();
+
+  string  out;
+
+  // Replay scrolls on the terminal, so moved lines need not be resent:
+  for (vector<ScrollRegion>::const_iterator s = pendingScroll.begin();
+       s != pendingScroll.end(); ++s) {
+    const int  count = (s->lines < 0 ? -s->lines : s->lines);
+    if (s->top < 0 || s->bottom >= screenH ||
+        count > s->bottom - s->top) continue;
+
+    if (outLine) {
+      out += "\x1B(B";
+      outLine = false;
+    }
+    setStyle(out, styleDefault);  // Blank lines use the terminal's colors
+    out += "\x1B[";
+    appendNum(out, s->top + 1);
+    out += ';';
+    appendNum(out, s->bottom + 1);
+    out += "r\x1B[";
+    appendNum(out, count);
+    out += (s->lines > 0 ? "S\x1B[r" : "T\x1B[r");
+    outX = outY = -1;
+
+    const int  rowSize = screenW * sizeof(ConCell);
+    const int  keep    = s->bottom - s->top + 1 - count;
+    int        blank;
+    if (s->lines > 0) {
+      memmove(shown + s->top * screenW, shown + (s->top + count) * screenW,
+              keep * rowSize);
+      blank = s->top + keep;
+    } else {
+      memmove(shown + (s->top + count) * screenW, shown + s->top * screenW,
+              keep * rowSize);
+      blank = s->top;
+    }
+    for (int i = blank * screenW, stop = (blank + count) * screenW;
+         i < stop; ++i)
+      shown[i] = blankCell;
+  } // end for each pending scroll
+  pendingScroll.clear();
+
+  // Send the cells that changed:
+  for (int y = 0; y < screenH; ++y) {
+    const ConCell*  want = wanted + y * screenW;
+    ConCell*        have = shown  + y * screenW;
+
+    for (int x = 0; x < screenW; ++x) {
+      if (want[x] == have[x]) continue;
+
+      // Resending a short unchanged gap is cheaper than moving over it:
+      if (y == outY && x > outX && outX >= 0 && x - outX <= 3) {
+        int  i = outX;
+        while (i < x && have[i].style == outStyle && have[i].line == outLine)
+          ++i;
+        if (i == x) {
+          for (i = outX; i < x; ++i) out += have[i].c;
+          outX = x;
+        }
+      }
+
+      gotoXY(out, x, y);
+
+      if (want[x].line != outLine) {
+        out += (want[x].line ? "\x1B(0" : "\x1B(B");
+        outLine = want[x].line;
+      }
+      setStyle(out, want[x].style);
+      out += want[x].c;
+      have[x] = want[x];
+
+      if (++outX >= screenW) outX = -1; // Wrap behavior varies
+    } // end for each column
+  } // end for each row
+
+  // Position the cursor in the top window:
+  if (cursorWanted) {
+    for (ConWindow* w = topWin; w; w = w->below)
+      if (w->visible) {
+        gotoXY(out, w->left + w->curX, w->top + w->curY);
+        break;
+      }
+  }
+
+  if (cursorWanted != cursorShown) {
+    out += (cursorWanted ? "\x1B[?25h" : "\x1B[?25l");
+    cursorShown = cursorWanted;
+  }
+
+  if (!out.empty()) {
+    if (!headless) writeAll(out.data(), out.size());
+    ++frameCount;
+    byteCount += out.size();
+  }
+
+  lastFrame = now;
+} // end ConWindow::refresh
+
+//////////////////////////////////////////////////////////////////////
+// Member Functions:
+//--------------------------------------------------------------------
+// Constructor:
+
+ConWindow::ConWindow()
+: data(NULL),
+  above(NULL),
+  below(NULL),
+  attribs(cBackground),
+  background(cBackground),
+  curX(0),
+  curY(0),
+  left(0),
+  top(0),
+  width(0),
+  height(0),
+  visible(false)
+{
+} // end ConWindow::ConWindow
+
+//--------------------------------------------------------------------
+// Destructor:
+
+ConWindow::~ConWindow()
+{
+  close();
+} // end ConWindow::~ConWindow
+
+//--------------------------------------------------------------------
+// Initialize the window:
+//
+// Must be called only once, before any other functions are called.
+// Allocates the data structures and clears the window buffer, but
+// does not display anything.
+//
+// Input:
+//   x,y:           The position of the window in the screen buffer
+//   width,height:  The size of the window
+//   attrib:        The default attributes for the window
+
+void ConWindow::init(short x, short y, short width, short height, Style attrib)
+{
+  left = x;
+  top  = y;
+  background = attribs = attrib;
+  visible = true;
+
+  raise();
+  resize(width, height);
+} // end ConWindow::init
+
+//--------------------------------------------------------------------
+void ConWindow::close()
+{
+  unlink();
+
+  delete [] data;
+  data = NULL;
+} // end ConWindow::close
+
+//--------------------------------------------------------------------
+// Draw a box around the edge of the window:
+
+void ConWindow::border()
+{
+  ConCell  edge = { 'q', (unsigned char) background, true };
+  ConCell* last = data + (height - 1) * width;
+
+  for (int x = 1; x < width - 1; ++x)
+    data[x] = last[x] = edge;
+
+  edge.c = 'x';
+  for (int y = 1; y < height - 1; ++y)
+    data[y * width] = data[y * width + width - 1] = edge;
+
+  edge.c = 'l';  data[0] = edge;
+  edge.c = 'k';  data[width - 1] = edge;
+  edge.c = 'm';  last[0] = edge;
+  edge.c = 'j';  last[width - 1] = edge;
+} // end ConWindow::border
+
+//--------------------------------------------------------------------
+void ConWindow::clear()
+{
+  const ConCell  blank = { ' ', (unsigned char) background, false };
+
+  for (int i = width * height - 1; i >= 0; --i)
+    data[i] = blank;
+} // end ConWindow::clear
+
+//--------------------------------------------------------------------
+// Write a string using the current attributes:
+//
+// The string is clipped at the edge of the window.
+//
+// Input:
+//   x,y:  The start of the string in the window
+//   s:    The string to write
+
+void ConWindow::put(short x, short y, const char* s)
+{
+  ConCell* out = data + y * width + x;
+
+  while (*s && x < width) {
+    out->c     = *(s++);
+    out->style = attribs;
+    out->line  = false;
+    ++out;
+    ++x;
+  }
+
+  curX = x;
+  curY = y;
+} // end ConWindow::put
+
+//--------------------------------------------------------------------
+// Change the attributes of characters in the window:
+//
+// Input:
+//   x,y:    The position in the window to start changing attributes
+//   color:  The attribute to set
+//   count:  The number of characters to change
+
+void ConWindow::putAttribs(short x, short y, Style color, short count)
+{
+  ConCell* out = data + y * width + x;
+
+  if (count > width - x) count = width - x;
+
+  while (count-- > 0)
+    (out++)->style = color;
+} // end ConWindow::putAttribs
+
+//--------------------------------------------------------------------
+// Change the attributes of a row of characters:
+//
+// Input:
+//   x,y:     The position in the window to start changing attributes
+//   colors:  The attribute for each character
+//   count:   The number of characters to change
+
+void ConWindow::putAttribs(short x, short y, const Style* colors, short count)
+{
+  ConCell* out = data + y * width + x;
+
+  if (count > width - x) count = width - x;
+
+  while (count-- > 0)
+    (out++)->style = *(colors++);
+} // end ConWindow::putAttribs
+
+//--------------------------------------------------------------------
+// Write a character using the current attributes:
+//
+// Input:
+//   x,y:    The position in the window to start writing
+//   c:      The character to write
+//   count:  The number of characters to write
+
+void ConWindow::putChar(short x, short y, char c, short count)
+{
+  ConCell* out = data + y * width + x;
+
+  if (count > width - x) count = width - x;
+
+  curX = x + count;
+  curY = y;
+
+  while (count-- > 0) {
+    out->c     = c;
+    out->style = attribs;
+    out->line  = false;
+    ++out;
+  }
+} // end ConWindow::putChar
+
+//--------------------------------------------------------------------
+// Read a key without waiting:
+//
+// Updates the screen first, like readKey.
+//
+// Returns:
+//   The key pressed, or -1 if no key is waiting
+
+int ConWindow::pollKey()
+{
+  refresh(false);
+
+  return (headless ? -1 : readTermKey(0));
+} // end ConWindow::pollKey
+
+//--------------------------------------------------------------------
+// Read the next key:
+//
+// Raises the window to the top and updates the screen first.
+//
+// Returns:
+//   The key pressed
+
+int ConWindow::readKey()
+{
+  raise();
+  visible = true;
+  refresh(false);
+
+  int  key;
+
+  if (!keyQueue.empty()) {
+    key = keyQueue.front();
+    keyQueue.pop_front();
+  } else if (headless) {
+    if ((key = readTermKey(-1)) < 0)
+      exit(0);                  // No more input (shutdown prints the screen)
+  } else {
+    while ((key = readTermKey(-1)) < 0)
+      refresh(true);            // Interrupted by a signal
+  }
+
+  ++keyCount;
+  return key;
+} // end ConWindow::readKey
+
+//--------------------------------------------------------------------
+// Move the window to the top of the stack:
+
+void ConWindow::raise()
+{
+  if (topWin == this) return;
+
+  unlink();
+
+  below = topWin;
+  if (topWin) topWin->above = this;
+  else        bottomWin     = this;
+  topWin = this;
+} // end ConWindow::raise
+
+//--------------------------------------------------------------------
+void ConWindow::resize(short width, short height)
+{
+  delete [] data;
+
+  this->width  = width;
+  this->height = height;
+  data = new ConCell[width * height];
+
+  clear();
+} // end ConWindow::resize
+
+//--------------------------------------------------------------------
+// Scroll part of the window:
+//
+// The lines scrolled into view are blank.  If the window is visible,
+// the terminal is asked to scroll the same lines.
+//
+// Input:
+//   top, bottom:  The first and last lines of the region to scroll
+//   lines:        The number of lines to scroll up (negative for down)
+
+void ConWindow::scroll(short top, short bottom, short lines)
+{
+  const int  count = (lines < 0 ? -lines : lines);
+  const int  keep  = bottom - top + 1 - count;
+
+  if (keep <= 0) {
+    const ConCell  blank = { ' ', (unsigned char) background, false };
+    for (int i = top * width, stop = (bottom + 1) * width; i < stop; ++i)
+      data[i] = blank;
+    return;
+  }
+
+  if (lines > 0)
+    memmove(data + top * width, data + (top + count) * width,
+            keep * width * sizeof(ConCell));
+  else
+    memmove(data + (top + count) * width, data + top * width,
+            keep * width * sizeof(ConCell));
+
+  const ConCell  blank = { ' ', (unsigned char) background, false };
+  for (int i = (lines > 0 ? top + keep : top) * width,
+         stop = i + count * width; i < stop; ++i)
+    data[i] = blank;
+
+  if (visible && started) {
+    ScrollRegion  s;
+    s.top    = this->top + top;
+    s.bottom = this->top + bottom;
+    s.lines  = lines;
+    pendingScroll.push_back(s);
+  }
+} // end ConWindow::scroll
+
+//--------------------------------------------------------------------
+// Remove the window from the stack:
+
+void ConWindow::unlink()
+{
+  if (above) above->below = below;
+  else if (topWin == this) topWin = below;
+
+  if (below) below->above = above;
+  else if (bottomWin == this) bottomWin = above;
+
+  above = below = NULL;
+} // end ConWindow::unlink
+
+//--------------------------------------------------------------------
+// Local Variables:
+//     c-file-style: "cjm"
+// End:
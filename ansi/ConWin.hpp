@@ -0,0 +1,136 @@
+//--------------------------------------------------------------------
+//
+//   Visual Binary Diff
+//   Copyright 1997-2017 by Christopher J. Madsen
+//
+//   Support class for ANSI terminals without curses
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//--------------------------------------------------------------------
+
+#ifndef INCLUDED_CONWIN_HPP
+
+#define INCLUDED_CONWIN_HPP
+
+#define CONWIN_HEADLESS         // startupHeadless is available
+
+// Key codes match the ones curses uses:
+#define KEY_DOWN      0402
+#define KEY_UP        0403
+#define KEY_LEFT      0404
+#define KEY_RIGHT     0405
+#define KEY_HOME      0406
+#define KEY_BACKSPACE 0407
+#define KEY_DC        0512
+#define KEY_IC        0513
+#define KEY_NPAGE     0522
+#define KEY_PPAGE     0523
+#define KEY_END       0550
+
+#define KEY_ESCAPE 0x1B
+#define KEY_TAB    0x09
+#define KEY_DELETE 0x7F
+#define KEY_RETURN 0x0D
+
+void beep();
+
+enum Style {
+  cBackground = 0,
+  cPromptWin,
+  cPromptKey,
+  cPromptBdr,
+  cCurrentMode,
+  cFileName,
+  cFileWin,
+  cFileDiff,
+  cFileEdit,
+  cFileMatch
+};
+
+struct ConCell
+{
+  char           c;
+  unsigned char  style;         // Style, or styleDefault
+  bool           line;          // c is a line drawing character
+
+  bool operator==(const ConCell& r) const
+    { return c == r.c && style == r.style && line == r.line; }
+  bool operator!=(const ConCell& r) const { return !(*this == r); }
+}; // end ConCell
+
+class ConWindow
+{
+ protected:
+  ConCell*    data;             // The window contents
+  ConWindow*  above;            // The next window up in the stack
+  ConWindow*  below;            // The next window down in the stack
+  short       attribs;          // The current attributes
+  short       background;       // The default attributes
+  short       curX, curY;       // The cursor position in the window
+  short       left, top;        // The position of the window on screen
+  short       width, height;    // The size of the window
+  bool        visible;
+
+  static ConWindow*  bottomWin; // The bottom of the window stack
+  static ConWindow*  topWin;    // The top of the window stack
+
+ public:
+  ConWindow();
+  ~ConWindow();
+  void init(short x, short y, short width, short height, Style style);
+  void close();
+
+  void border();
+  void clear();
+  void move(short x, short y) { left = x;  top = y; };
+  void put(short x, short y, const char* s);
+  void putAttribs(short x, short y, Style color, short count);
+  void putAttribs(short x, short y, const Style* colors, short count);
+  void putChar(short x, short y, char c, short count);
+  int  pollKey();
+  int  readKey();
+  void resize(short width, short height);
+  void scroll(short top, short bottom, short lines);
+  void setAttribs(Style color) { attribs = color; };
+  void setCursor(short x, short y) { curX = x;  curY = y; };
+  void update(unsigned short margin=0) {};
+
+  void hide() { visible = false; };
+  void show() { visible = true;  };
+
+  static const ConCell* getScreen();
+  static void getScreenSize(int& x, int& y);
+  static void getStats(unsigned long& frames, unsigned long& bytes);
+  static void hideCursor();
+  static void pushKey(int key);
+  static void showCursor(bool insert=true);
+  static void shutdown();
+  static bool startup();
+  static bool startupHeadless();
+
+ protected:
+  void raise();
+  void unlink();
+
+  static void compose();
+  static void refresh(bool force);
+}; // end ConWindow
+
+#endif // INCLUDED_CONWIN_HPP
+
+//--------------------------------------------------------------------
+// Local Variables:
+//            mode: c++
+//    c-file-style: "cjm"
+// End:
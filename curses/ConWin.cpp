@@ -29,7 +29,8 @@ enum ColorPair {
   pairWhiteBlue= 1,
   pairWhiteBlack,
   pairRedBlue,
-  pairYellowBlue
+  pairYellowBlue,
+  pairBlackCyan
 };
 
 static const ColorPair colorStyle[] = {
@@ -41,7 +42,8 @@ static const ColorPair colorStyle[] = {
   pairWhiteBlack,  // cFileName
   pairWhiteBlue,   // cFileWin
   pairRedBlue,     // cFileDiff
-  pairYellowBlue   // cFileEdit
+  pairYellowBlue,  // cFileEdit
+  pairBlackCyan    // cFileMatch
 };
 
 static const attr_t attribStyle[] = {
@@ -53,7 +55,8 @@ static const attr_t attribStyle[] = {
   A_REVERSE | COLOR_PAIR(colorStyle[ cFileName   ]),
               COLOR_PAIR(colorStyle[ cFileWin    ]),
   A_BOLD    | COLOR_PAIR(colorStyle[ cFileDiff   ]),
-  A_BOLD    | COLOR_PAIR(colorStyle[ cFileEdit   ])
+  A_BOLD    | COLOR_PAIR(colorStyle[ cFileEdit   ]),
+              COLOR_PAIR(colorStyle[ cFileMatch  ])
 };
 
 //====================================================================
@@ -64,7 +67,8 @@ static const attr_t attribStyle[] = {
 //--------------------------------------------------------------------
 // Start up the window system:
 //
-// Allocates a screen buffer and sets input mode:
+// Allocates a screen buffer and sets input mode.  After shutdown, it
+// may be called again to restore them.
 //
 // Returns:
 //   true:   Everything set up properly
@@ -72,6 +76,11 @@ static const attr_t attribStyle[] = {
 
 bool ConWindow::startup()
 {
+  if (stdscr) {                 // Starting up again after shutdown
+    refresh();
+    return true;
+  }
+
   if (!initscr()) return false; // initialize the curses library
   atexit(ConWindow::shutdown);  // just in case
 
@@ -87,6 +96,7 @@ bool ConWindow::startup()
     init_pair(pairWhiteBlack, COLOR_WHITE,  COLOR_BLACK);
     init_pair(pairRedBlue,    COLOR_RED,    COLOR_BLUE);
     init_pair(pairYellowBlue, COLOR_YELLOW, COLOR_BLUE);
+    init_pair(pairBlackCyan,  COLOR_BLACK,  COLOR_CYAN);
   } // end if terminal has color
 
   return true;
@@ -198,7 +208,30 @@ void ConWindow::close()
 void ConWindow::putAttribs(short x, short y, Style color, short count)
 {
   mvwchgat(win, y, x, count, attribStyle[color], colorStyle[color], NULL);
-  touchwin(win);
+} // end ConWindow::putAttribs
+
+//--------------------------------------------------------------------
+// Change the attributes of a row of characters:
+//
+// Makes one change for each run of characters with the same
+// attributes.
+//
+// Input:
+//   x,y:     The position in the window to start changing attributes
+//   colors:  The attribute for each character
+//   count:   The number of characters to change
+
+void ConWindow::putAttribs(short x, short y, const Style* colors, short count)
+{
+  short  start = 0;
+
+  for (short i = 1; i <= count; ++i)
+    if (i == count || colors[i] != colors[start]) {
+      const Style  color = colors[start];
+      mvwchgat(win, y, x + start, i - start,
+               attribStyle[color], colorStyle[color], NULL);
+      start = i;
+    }
 } // end ConWindow::putAttribs
 
 //--------------------------------------------------------------------
@@ -218,6 +251,26 @@ void ConWindow::putChar(short x, short y, char c, short count)
   }
 } // end ConWindow::putAttribs
 
+//--------------------------------------------------------------------
+// Read a key without waiting:
+//
+// Updates the screen first, like readKey.
+//
+// Returns:
+//   The key pressed, or -1 if no key is waiting
+
+int ConWindow::pollKey()
+{
+  update_panels();
+  doupdate();
+
+  nodelay(win, TRUE);
+  int key = wgetch(win);
+  nodelay(win, FALSE);
+
+  return (key == ERR ? -1 : key);
+} // end ConWindow::pollKey
+
 //--------------------------------------------------------------------
 // Read the next key down event:
 //
@@ -244,6 +297,24 @@ void ConWindow::resize(short width, short height)
   clear();
 } // end ConWindow::resize
 
+//--------------------------------------------------------------------
+// Scroll part of the window:
+//
+// The lines scrolled into view are blank.
+//
+// Input:
+//   top, bottom:  The first and last lines of the region to scroll
+//   lines:        The number of lines to scroll up (negative for down)
+
+void ConWindow::scroll(short top, short bottom, short lines)
+{
+  wsetscrreg(win, top, bottom);
+  scrollok(win, TRUE);
+  wscrl(win, lines);
+  scrollok(win, FALSE);
+  wsetscrreg(win, 0, getmaxy(win) - 1);
+} // end ConWindow::scroll
+
 //--------------------------------------------------------------------
 void ConWindow::setAttribs(Style color)
 {
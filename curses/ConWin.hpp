@@ -25,6 +25,7 @@
 
 #include <panel.h>
 #undef border                 // It interferes with my member function
+#undef scroll                 // So does this
 
 #define KEY_ESCAPE 0x1B
 #define KEY_TAB    0x09
@@ -40,7 +41,8 @@ enum Style {
   cFileName,
   cFileWin,
   cFileDiff,
-  cFileEdit
+  cFileEdit,
+  cFileMatch
 };
 
 class ConWindow
@@ -61,9 +63,12 @@ class ConWindow
 ///void put(short x, short y, const String& s);
   void put(short x, short y, const char* s) { mvwaddstr(win, y, x, s); };
   void putAttribs(short x, short y, Style color, short count);
+  void putAttribs(short x, short y, const Style* colors, short count);
   void putChar(short x, short y, char c, short count);
+  int  pollKey();
   int  readKey();
   void resize(short width, short height);
+  void scroll(short top, short bottom, short lines);
   void setAttribs(Style color);
   void setCursor(short x, short y);
   void update(unsigned short margin=0) {};
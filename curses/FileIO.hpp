@@ -23,8 +23,12 @@
 
 #define INCLUDED_FILEIO_HPP
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 typedef int      File;
@@ -37,6 +41,13 @@ const int
 
 const File InvalidFile = -1;
 
+struct DirEntry
+{
+  string  name;                 // The name within the directory
+  bool    isDir;                // True if it is a directory
+  FPos    size;                 // The size of a file (0 for a directory)
+}; // end DirEntry
+
 //--------------------------------------------------------------------
 inline const char* ErrorMsg()
 {
@@ -88,6 +99,245 @@ inline FPos SeekFile(File file, FPos position, int whence=SeekPos)
   return lseek(file, position, whence);
 } // end SeekFile
 
+//--------------------------------------------------------------------
+inline bool SyncFile(File file)
+{
+  return (fsync(file) == 0);
+} // end SyncFile
+
+//--------------------------------------------------------------------
+// Copy part of one file to the current position of another:
+//
+// Uses copy_file_range if possible, so the data need not pass through
+// this program (and may not be copied at all on filesystems that
+// share blocks).  Falls back to reading and writing.
+
+bool CopyFileRange(File from, FPos pos, File to, FPos count)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+  while (count > 0) {
+    loff_t  in = pos;
+    const ssize_t  copied = copy_file_range(from, &in, to, NULL, count, 0);
+
+    if (copied > 0) {
+      pos   += copied;
+      count -= copied;
+    } else if (copied == 0 || errno != EINTR)
+      break;                    // Try the old-fashioned way
+  } // end while more to copy
+#endif
+
+  char  buf[64 * 1024];
+
+  while (count > 0) {
+    if (lseek(from, pos, SEEK_SET) != pos) return false;
+
+    const ssize_t  bytesRead = read(from, buf, (count < FPos(sizeof(buf))
+                                                ? count : sizeof(buf)));
+    if (bytesRead < 0 && errno == EINTR) continue;
+    if (bytesRead <= 0) {
+      if (bytesRead == 0) errno = EIO; // The file got shorter
+      return false;
+    }
+
+    if (!WriteFile(to, buf, bytesRead)) return false;
+
+    pos   += bytesRead;
+    count -= bytesRead;
+  } // end while more to copy
+
+  return true;
+} // end CopyFileRange
+
+//--------------------------------------------------------------------
+// Create a new file:
+//
+// Fails if the file already exists.
+//
+// Returns:
+//   The new file (open for writing), or InvalidFile
+
+inline File CreateNewFile(const char* path)
+{
+  return open(path, O_RDWR|O_CREAT|O_EXCL, 0666);
+} // end CreateNewFile
+
+//--------------------------------------------------------------------
+// Create a new file to replace an existing one:
+//
+// The new file is in the same directory, so RenameFile can move it
+// over the original, and gets the same permissions.
+//
+// Input:
+//   path:  The file to be replaced
+//
+// Output:
+//   tempPath:  The name of the new file
+//
+// Returns:
+//   The new file (open for writing), or InvalidFile
+
+File CreateTempFile(const char* path, string& tempPath)
+{
+  tempPath = path;
+  tempPath += ".vbdXXXXXX";
+
+  File  file = mkstemp(&tempPath[0]);
+
+  struct stat  info;
+  if (file != InvalidFile && stat(path, &info) == 0)
+    fchmod(file, info.st_mode & 07777);
+
+  return file;
+} // end CreateTempFile
+
+//--------------------------------------------------------------------
+// Find the file a path refers to, following any symbolic links:
+//
+// Output:
+//   resolved:  The path of the file itself
+//
+// Returns:
+//   true:   Success
+//   false:  The file doesn't exist, or a link is broken
+
+bool ResolvePath(const char* path, string& resolved)
+{
+  char*  real = realpath(path, NULL);
+  if (!real) return false;
+
+  resolved = real;
+  free(real);
+  return true;
+} // end ResolvePath
+
+//--------------------------------------------------------------------
+// Open another handle for a file:
+//
+// The new handle refers to the same file even if the name is later
+// given to a different one.
+
+inline File DupFile(File file)
+{
+  return dup(file);
+} // end DupFile
+
+//--------------------------------------------------------------------
+inline bool RemoveFile(const char* path)
+{
+  return (unlink(path) == 0);
+} // end RemoveFile
+
+//--------------------------------------------------------------------
+// Change the size of a file:
+//
+// Bytes past the new size are discarded, or zero bytes are added.
+
+inline bool ResizeFile(File file, FPos size)
+{
+  return (ftruncate(file, size) == 0);
+} // end ResizeFile
+
+//--------------------------------------------------------------------
+// Replace a file with another one:
+//
+// The replacement is atomic: the file at newPath is always either
+// the old file or the new one.
+
+inline bool RenameFile(const char* oldPath, const char* newPath)
+{
+  return (rename(oldPath, newPath) == 0);
+} // end RenameFile
+
+//--------------------------------------------------------------------
+// Return true if two handles refer to the same file:
+
+bool SameFile(File a, File b)
+{
+  struct stat  infoA, infoB;
+
+  return (fstat(a, &infoA) == 0 && fstat(b, &infoB) == 0 &&
+          infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino);
+} // end SameFile
+
+//--------------------------------------------------------------------
+// Return true if a path names a directory:
+
+inline bool IsDirectory(const char* path)
+{
+  struct stat  info;
+
+  return (stat(path, &info) == 0 && S_ISDIR(info.st_mode));
+} // end IsDirectory
+
+//--------------------------------------------------------------------
+// Return true if standard input and output are a terminal:
+
+inline bool IsInteractive()
+{
+  return (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO));
+} // end IsInteractive
+
+//--------------------------------------------------------------------
+// List the files and subdirectories in a directory:
+//
+// Links to files are followed, but links to directories are not (so
+// walking a tree can't go around in circles).  Other kinds of file
+// are skipped.
+//
+// Input:
+//   path:  The directory to list
+//
+// Output:
+//   entries:  The files and directories in it, in no particular order
+//
+// Returns:
+//   true:   The directory was read
+//   false:  Unable to read it (call ErrorMsg for error message)
+
+bool ListDirectory(const char* path, vector<DirEntry>& entries)
+{
+  DIR*  dir = opendir(path);
+  if (!dir) return false;
+
+  string  prefix(path);
+  if (prefix.empty() || prefix[prefix.size() - 1] != '/') prefix += '/';
+
+  entries.clear();
+
+  for (;;) {
+    errno = 0;
+    const struct dirent*  found = readdir(dir);
+    if (!found) break;
+
+    const char*  name = found->d_name;
+    if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+
+    const string  full = prefix + name;
+    struct stat   info;
+
+    if (lstat(full.c_str(), &info) != 0) continue; // It just went away
+
+    if (S_ISLNK(info.st_mode) &&
+        (stat(full.c_str(), &info) != 0 || S_ISDIR(info.st_mode)))
+      continue;                 // A broken link, or a link to a directory
+
+    if (!S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode)) continue;
+
+    DirEntry  entry;
+    entry.name  = name;
+    entry.isDir = S_ISDIR(info.st_mode);
+    entry.size  = (entry.isDir ? 0 : info.st_size);
+    entries.push_back(entry);
+  } // end forever
+
+  const int  error = errno;
+  closedir(dir);
+  errno = error;
+
+  return (error == 0);
+} // end ListDirectory
+
 #endif // INCLUDED_FILEIO_HPP
 
 // Local Variables:
@@ -0,0 +1,79 @@
+#! /bin/sh
+#---------------------------------------------------------------------
+# tests/dump.sh
+# Copyright 2017 Christopher J. Madsen
+#
+# Check that --dump writes every line that differs
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of
+# the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#---------------------------------------------------------------------
+
+VBINDIFF=${VBINDIFF-./vbindiff}
+case $VBINDIFF in
+  /*) ;;
+  *)  VBINDIFF=`pwd`/$VBINDIFF ;;
+esac
+
+tmp=${TMPDIR-/tmp}/vbindiff-test.$$
+mkdir "$tmp" || exit 99
+trap 'rm -rf "$tmp"' 0
+cd "$tmp" || exit 99
+
+fail()
+{
+  echo "FAIL: $*"
+  exit 1
+}
+
+esc=`printf '\033'`
+
+# Run --dump, leaving the text without colors in dump:
+dump()
+{
+  "$VBINDIFF" --dump "$@" >colored
+  status=$?
+  sed "s/$esc\[[0-9;]*m//g" colored >dump
+  return $status
+}
+
+# A difference in the last (and only) line:
+printf AAAA >a
+printf AABA >b
+
+dump a b
+test $? = 1 || fail "exit status $? for AAAA and AABA"
+grep '^0000 0000: 41 41 42 41 ' dump >/dev/null ||
+  fail "AABA not in dump: `cat dump`"
+
+# Extra bytes at the end of the longer file, after 300000 identical
+# bytes (so the dump starts by leaving lines out):
+dd if=/dev/zero bs=1000 count=300 2>/dev/null | tr '\000' a >long
+cp long longer
+printf ZZ >>longer
+
+dump long longer
+test $? = 1 || fail "exit status $? for extra bytes"
+grep '^0004 93E0: 5A 5A ' dump >/dev/null ||
+  fail "extra bytes not in dump: `cat dump`"
+
+dump longer long
+test $? = 1 || fail "exit status $? for missing bytes"
+grep '^0004 93E0: 5A 5A ' dump >/dev/null ||
+  fail "extra bytes of the first file not in dump: `cat dump`"
+
+# Identical files:
+dump long long || fail "exit status $? for identical files"
+grep '^0000 0000:' dump >/dev/null && fail "identical lines written"
+
+exit 0
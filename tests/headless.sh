@@ -0,0 +1,79 @@
+#! /bin/sh
+#---------------------------------------------------------------------
+# tests/headless.sh
+# Copyright 2017 Christopher J. Madsen
+#
+# Replay a script of keys with --headless and check the final screen
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of
+# the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#---------------------------------------------------------------------
+
+VBINDIFF=${VBINDIFF-./vbindiff}
+case $VBINDIFF in
+  /*) ;;
+  *)  VBINDIFF=`pwd`/$VBINDIFF ;;
+esac
+
+tmp=${TMPDIR-/tmp}/vbindiff-test.$$
+mkdir "$tmp" || exit 99
+trap 'rm -rf "$tmp"' 0
+cd "$tmp" || exit 99
+
+fail()
+{
+  echo "FAIL: $*"
+  exit 1
+}
+
+printf 'Hello, world!\n0123456789abcdef' >a
+printf 'Hello, World!\n0123456789abcdeF' >b
+
+# Go to the next difference, then try to undo in the editor (which
+# beeps, because there is nothing to undo) and quit:
+printf '\rE\025\033Q' |
+  COLUMNS=80 LINES=24 "$VBINDIFF" --headless a b >screen 2>stats ||
+  fail "exit status $?"
+
+cat >expected <<'END'
+a
+0000 0010: 32 33 34 35 36 37 38 39  61 62 63 64 65 66        23456789 abcdef
+0000 0020:
+0000 0030:
+0000 0040:
+0000 0050:
+0000 0060:
+0000 0070:
+0000 0080:
+0000 0090:
+b
+0000 0010: 32 33 34 35 36 37 38 39  61 62 63 64 65 46        23456789 abcdeF
+0000 0020:
+0000 0030:
+0000 0040:
+0000 0050:
+0000 0060:
+0000 0070:
+0000 0080:
+0000 0090:
++------------------------------------------------------------------------------+
+|Arrow keys move  F find      RET next difference  ESC quit  T move top        |
+|C ASCII/EBCDIC   E edit file   G goto position      Q quit  B move bottom     |
++------------------------------------------------------------------------------+
+END
+
+diff expected screen || fail "wrong screen"
+
+grep ' 1 beeps,' stats >/dev/null || fail "beep not counted: `cat stats`"
+
+exit 0
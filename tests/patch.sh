@@ -0,0 +1,70 @@
+#! /bin/sh
+#---------------------------------------------------------------------
+# tests/patch.sh
+# Copyright 2017 Christopher J. Madsen
+#
+# Write a patch with --headless, then apply it with --apply
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of
+# the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#---------------------------------------------------------------------
+
+VBINDIFF=${VBINDIFF-./vbindiff}
+case $VBINDIFF in
+  /*) ;;
+  *)  VBINDIFF=`pwd`/$VBINDIFF ;;
+esac
+
+tmp=${TMPDIR-/tmp}/vbindiff-test.$$
+mkdir "$tmp" || exit 99
+trap 'rm -rf "$tmp"' 0
+cd "$tmp" || exit 99
+
+fail()
+{
+  echo "FAIL: $*"
+  exit 1
+}
+
+# The target changes a byte in the middle and grows the file:
+printf 'Hello, world!\n0123456789abcdef' >a
+printf 'Hello, World!\n0123456789ABCDEF and more' >b
+cp a base || exit 99
+
+# Press P to write a patch that turns the top file into the bottom one:
+printf 'Ppatch\r' |
+  COLUMNS=80 LINES=24 "$VBINDIFF" --headless a b >screen 2>stats ||
+  fail "exit status $?"
+
+test -s patch || fail "no patch written"
+grep 'Wrote 2 hunks, 16 bytes' screen >/dev/null ||
+  fail "wrong status: `sed -n 1p screen`"
+
+# Apply it to a new file, which must leave the original alone:
+"$VBINDIFF" --apply patch a out || fail "apply to OUTPUT: exit status $?"
+cmp out b || fail "OUTPUT does not match the target"
+cmp a base || fail "apply to OUTPUT changed FILE"
+
+# Apply it in place:
+"$VBINDIFF" --apply patch a || fail "apply in place: exit status $?"
+cmp a b || fail "patched file does not match the target"
+
+# The file no longer matches the patch, so applying it again must
+# fail without changing anything:
+"$VBINDIFF" --apply patch a 2>error
+status=$?
+test $status = 1 || fail "reapplying: exit status $status"
+test -s error || fail "reapplying: no error message"
+cmp a b || fail "reapplying changed the file"
+
+exit 0
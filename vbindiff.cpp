@@ -27,7 +27,10 @@
 #include <string.h>
 
 #include <algorithm>
+#include <bitset>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <map>
 #include <string>
@@ -39,6 +42,14 @@ using namespace std;
 #include "ConWin.hpp"
 #include "FileIO.hpp"
 
+#ifndef WIN32_CONSOLE
+#include <sys/time.h>
+#endif
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 const char titleString[] =
   "\nVBinDiff " PACKAGE_VERSION "\nCopyright 1995-2017 Christopher J. Madsen";
 
@@ -53,8 +64,15 @@ typedef unsigned short  Word;
 
 typedef Byte  Command;
 
+typedef unsigned long long  Hash; // A 64 bit FNV-1a hash
+
 enum LockState { lockNeither = 0, lockTop, lockBottom };
 
+enum RunMode { runDisplay, runApply, runDump, runList, runQuiet, runReport,
+               runSeries };
+
+enum ReportFormat { reportText, reportJSON, reportCSV };
+
 //--------------------------------------------------------------------
 // Strings:
 
@@ -112,16 +130,33 @@ const Command  cmEditBottom   = 9;
 const Command  cmUseTop       = 10;
 const Command  cmUseBottom    = 11;
 const Command  cmToggleASCII  = 12;
+const Command  cmReplaceTop   = 13;
+const Command  cmReplaceBottom = 14;
 const Command  cmFind         = 16; // Commands 16-19
+const Command  cmUndoTop      = 20;
+const Command  cmUndoBottom   = 21;
+const Command  cmRedoTop      = 22;
+const Command  cmRedoBottom   = 23;
+const Command  cmSave         = 24;
+const Command  cmSyncTop      = 25;
+const Command  cmSyncBottom   = 26;
+const Command  cmMark         = 28; // Commands 28-31
+const Command  cmExportTop    = 32;
+const Command  cmExportBottom = 33;
+const Command  cmPatchTop     = 34;
+const Command  cmPatchBottom  = 35;
+const Command  cmNextPair     = 36;
+const Command  cmPrevPair     = 37;
 
 const short  leftMar  = 11;     // Starting column of hex display
-const short  leftMar2 = 61;     // Starting column of ASCII display
 
-const int  lineWidth = 16;      // Number of bytes displayed per line
+const int  minLineWidth = 16;   // Bytes per line on an 80 column screen
+const int  maxLineWidth = 64;   // Bytes per line on the widest screens
 
 const int  promptHeight = 4;    // Height of prompt window
 const int  inWidth = 10;        // Width of input window (excluding border)
-const int  screenWidth = 80;
+const int  screenWidth = 80;    // Minimum screen width (and dialog width)
+const int  maxDisplayWidth = 284; // Width needed for maxLineWidth
 
 const int  maxPath = 260;
 
@@ -129,6 +164,8 @@ const VecSize maxHistory = 2000;
 
 const char hexDigits[] = "0123456789ABCDEF";
 
+const FPos maxFPos = numeric_limits<FPos>::max();
+
 #include "tables.h"             // ASCII and EBCDIC tables
 
 //====================================================================
@@ -138,12 +175,239 @@ void showEditPrompt();
 void showPrompt();
 
 class Difference;
+class FileDisplay;
+
+typedef vector<FileDisplay*>  FileVec;
+
+class Progress;
+
+class Task
+{
+ public:
+  virtual ~Task() {};
+  virtual void run(Progress& progress) = 0;
+}; // end Task
+
+class Progress
+{
+ protected:
+  const char*  title;           // Describes the operation
+  FPos         start;           // The position where it started
+  FPos         total;           // The position where it will finish
+  FPos         pos;             // The position it has reached
+  bool         cancelled;       // True if ESC was pressed
+  bool         shown;           // True if the prompt window was changed
+  double       startTime;       // When the operation started
+#ifdef HAVE_PTHREADS
+  Task*            task;        // The task being run by the worker
+  bool             finished;    // True when the worker is done
+  pthread_mutex_t  lock;        // Protects pos, cancelled, and finished
+  pthread_cond_t   done;        // Signalled when the worker is done
+#else
+  FPos             nextShow;    // When to update the display
+#endif
+ public:
+  Progress(const char* aTitle, FPos aStart, FPos aTotal);
+  ~Progress();
+  bool  isCancelled() const { return cancelled; };
+  bool  run(Task& task);
+  bool  update(FPos newPos);
+ protected:
+  bool  show(FPos at);
+#ifdef HAVE_PTHREADS
+  static void*  worker(void* progress);
+#endif
+}; // end Progress
+
+struct Match
+{
+  FPos  pos;                    // The position of the first byte matched
+  int   length;                 // The number of bytes matched
+  int   which;                  // The index of the pattern that matched
+}; // end Match
+
+class MatchHandler
+{
+ public:
+  FPos       stopAfter;         // Matches starting after this are not wanted
+  Progress*  progress;          // Reports the scan's progress (may be NULL)
+  MatchHandler() : stopAfter(maxFPos), progress(NULL) {};
+  virtual ~MatchHandler() {};
+  virtual void found(const Match& match) = 0;
+  void         scanned(FPos pos);
+}; // end MatchHandler
+
+class Document;
+
+class Searcher
+{
+ public:
+  virtual ~Searcher() {};
+  virtual String  describe(int which) const { return String(); };
+  virtual int     lookBehind() const { return 0; };
+  virtual void    scan(const Document& doc, FPos start,
+                       MatchHandler& handler) const = 0;
+}; // end Searcher
+
+class ExactSearch : public Searcher
+{
+ protected:
+  String  pattern;
+  int     moveOver[256];
+ public:
+  ExactSearch(const Byte* searchFor, int searchLen);
+  virtual void  scan(const Document& doc, FPos start,
+                     MatchHandler& handler) const;
+}; // end ExactSearch
 
-union FileBuffer
+class MultiSearch : public Searcher
 {
-  Byte  line[1][lineWidth];
-  Byte  buffer[lineWidth];
-}; // end FileBuffer
+ protected:
+  struct Automaton
+  {
+    vector<int>  delta;         // The transition table (256 entries per state)
+    vector<int>  dictLink;      // The next state with output on the fail chain
+    vector<int>  output;        // The pattern ending at each state (or -1)
+    Byte         fold[256];     // The byte each byte is treated as
+
+    Automaton();
+    void  build();
+  }; // end Automaton
+
+  struct Run                    // An automaton's tables & state during scan
+  {
+    const int*  delta;
+    const int*  dictLink;
+    const int*  output;
+    int         state;
+  }; // end Run
+
+  vector<Automaton>  automata;  // One for each way of folding case
+  StrVec       labels;          // The text describing each pattern
+  vector<int>  lengths;         // The length of each pattern
+  int          maxLength;       // The length of the longest pattern
+ public:
+  MultiSearch();
+  void            add(const String& pattern, const String& label);
+  void            build();
+  void            ignoreCase(const Byte* encode=NULL);
+  virtual String  describe(int which) const { return labels[which]; };
+  virtual int     lookBehind() const { return maxLength; };
+  int             size() const { return lengths.size(); };
+  virtual void    scan(const Document& doc, FPos start,
+                       MatchHandler& handler) const;
+}; // end MultiSearch
+
+class RegexSearch : public Searcher
+{
+ public:
+  struct Dfa
+  {
+    vector<int>   trans;        // The transition table (256 entries per state)
+    vector<char>  accept;       // True for accepting states
+  }; // end Dfa
+
+ protected:
+  Dfa  search;                  // Finds the end of the leftmost match
+  Dfa  reverse;                 // Finds the start of a match, given its end
+ public:
+  bool          compile(const String& regex, String& error);
+  virtual void  scan(const Document& doc, FPos start,
+                     MatchHandler& handler) const;
+ protected:
+  FPos  matchStart(const Document& doc, FPos end, FPos limit,
+                   const Byte* block, FPos blockPos, int blockLen,
+                   Byte* buf) const;
+}; // end RegexSearch
+
+class MatchIndex
+{
+ protected:
+  vector<Byte>     data;        // The varint-encoded matches
+  vector<FPos>     checkPos;    // The position of every checkInterval'th match
+  vector<VecSize>  checkAt;     // Where that match is stored in data
+  VecSize          count;       // The number of matches
+  FPos             lastPos;     // The position of the last match added
+  int              maxLength;   // The length of the longest match
+ public:
+  MatchIndex();
+  void     add(const Match& match);
+  VecSize  find(FPos from, FPos to, vector<Match>& found) const;
+  Match    get(VecSize n) const;
+  int      longest() const { return maxLength; };
+  VecSize  lowerBound(FPos pos) const;
+  VecSize  size() const    { return count; };
+ protected:
+  static void  putNumber(vector<Byte>& out, FPos n);
+  static FPos  getNumber(const Byte*& in);
+}; // end MatchIndex
+
+class Document
+{
+ protected:
+  enum { srcAdded = -1, srcFile = 0 }; // Values for Piece::source
+
+  struct Piece
+  {
+    FPos   start;               // The position of the first byte in source
+    FPos   length;              // The number of bytes
+    short  source;              // srcAdded, or an index into files
+  }; // end Piece
+
+  typedef vector<Piece>  PieceVec;
+
+  struct Change
+  {
+    FPos      pos;              // Where the change was made
+    PieceVec  removed;          // The pieces it removed
+    PieceVec  inserted;         // The pieces it inserted
+    bool      first;            // This is the first change in its step
+  }; // end Change
+
+  typedef vector<Change>  ChangeVec;
+
+  vector<Byte>  added;          // Every byte typed, in order
+  vector<File>  files;          // The file, then files borrowed from
+  FPos          fileLength;     // The size of the file itself
+  FPos          length;         // The size of the document
+  PieceVec      pieces;
+  ChangeVec     undoList;
+  ChangeVec     redoList;
+  bool          inStep;         // A step has been started
+ public:
+  Document();
+  ~Document();
+  bool  borrows() const  { return files.size() > 1; };
+  bool  copy(FPos pos, const Document& from, FPos fromPos, FPos count);
+  void  erase(FPos pos, FPos count);
+  bool  inPlace() const;
+  void  insert(FPos pos, Byte value);
+  void  mark(FPos pos, int size, vector<char>& changed) const;
+  bool  modified() const;
+  void  nextStep()       { inStep = false; };
+  int   read(FPos pos, Byte* buf, int size) const;
+  bool  redo();
+  void  reset(File file);
+  void  set(FPos pos, Byte value);
+  void  setFile(File file) { files[srcFile] = file; };
+  FPos  size() const     { return length; };
+  void  swap(Document& other);
+  bool  undo();
+  void  update();
+  bool  write(File out, FPos pos, FPos count, Progress& progress) const;
+  bool  writeChanges(Progress& progress) const;
+ protected:
+  Piece    add(FPos gap, Byte value);
+  short    borrow(File file);
+  void     change(FPos pos, FPos count, const PieceVec& insert);
+  bool     copyPiece(const Piece& piece, File out, FPos at,
+                     Progress& progress) const;
+  void     join(VecSize i);
+  void     splice(FPos pos, FPos count, const PieceVec& insert,
+                  PieceVec* removed);
+  VecSize  split(FPos pos);
+  static FPos  totalLength(const PieceVec& pieces);
+}; // end Document
 
 class FileDisplay
 {
@@ -151,11 +415,17 @@ class FileDisplay
 
  protected:
   int                bufContents;
-  FileBuffer*        data;
+  Byte*              data;
   const Difference*  diffs;
   File               file;
   char               fileName[maxPath];
+  Document           doc;
+  FPos               mark;
+  MatchIndex*        matches;
   FPos               offset;
+  StrVec             shown;
+  FPos               shownOffset;
+  String             status;
   ConWindow          win;
   bool               writable;
   int                yPos;
@@ -167,15 +437,45 @@ class FileDisplay
   void         resize();
   void         shutDown();
   void         display();
+  bool         copyFrom(const FileDisplay& other, FPos pos, FPos& count);
   bool         edit(const FileDisplay* other);
-  const Byte*  getBuffer() const { return data->buffer; };
-  void         move(int step)    { moveTo(offset + step); };
+  FPos         fileSize();
+  bool         findAll(const Searcher& searcher);
+  const char*  getFileName() const { return fileName; };
+  void         forgetMatches();
+  const Byte*  getBuffer() const { return data; };
+  FPos         getOffset() const { return offset; };
+  bool         getRegion(FPos& start, FPos& count) const;
+  bool         haveMatches() const { return matches != NULL; };
+  VecSize      matchCount() const  { return matches ? matches->size() : 0; };
+  void         move(FPos step)   { moveTo(offset + step); };
   void         moveTo(FPos newOffset);
-  bool         moveTo(const Byte* searchFor, int searchLen);
+  bool         moveTo(const Searcher& searcher, Match& match);
   void         moveToEnd(FileDisplay* other);
+  bool         moveToMatch(int delta);
+  bool         moveToMatchNumber(VecSize n);
+  bool         modified() const { return doc.modified(); };
+  int          read(FPos pos, Byte* buf, int size) const
+                 { return doc.read(pos, buf, size); };
+  bool         redo();
+  bool         replaceMatches(const String& replaceWith, VecSize& replaced);
+  bool         save(const FileDisplay* other, bool& cancelled);
+  void         showMatchCount(const Searcher& searcher);
   bool         setFile(const char* aFileName);
+  void         setMark();
+  void         setStatus(const String& aStatus);
+  void         swapFile(FileDisplay& other);
+  bool         undo();
+  bool         writeRegion(const char* path, FPos& count, bool& cancelled);
  protected:
+  void  eraseByte(short x, short y);
+  void  insertByte(short x, short y, Byte b);
+  void  readBuffer();
+  void  reread();
+  bool  makeWritable();
+  bool  saveCopy(bool& cancelled);
   void  setByte(short x, short y, Byte b);
+  void  showTitle();
 }; // end FileDisplay
 
 class Difference
@@ -183,14 +483,17 @@ class Difference
   friend void FileDisplay::display();
 
  protected:
-  FileBuffer*         data;
+  Byte*               data;
   const FileDisplay*  file1;
   const FileDisplay*  file2;
+  const FileVec*      more;
   int                 numDiffs;
  public:
-  Difference(const FileDisplay* aFile1, const FileDisplay* aFile2);
+  Difference(const FileDisplay* aFile1, const FileDisplay* aFile2,
+             const FileVec* aMore);
   ~Difference();
   int  compute();
+  int  firstDiff() const;
   int  getNumDiffs() const { return numDiffs; };
   void resize();
 }; // end Difference
@@ -225,20 +528,38 @@ class InputManager
 //====================================================================
 // Global Variables:
 
-String       lastSearch;
+Command      pendingCmd = cmNothing; // The next command (see mergeMoves)
+Searcher*    lastSearch = NULL;
 StrVec       hexSearchHistory, textSearchHistory, positionHistory;
+StrVec       patternFileHistory, regexSearchHistory, matchNumberHistory;
+StrVec       exportFileHistory;
 ConWindow    promptWin,inWin;
 FileDisplay  file1, file2;
-Difference   diffs(&file1, &file2);
+FileVec      moreFiles;         // Files 3 and up, in the N-way view
+FileDisplay  spareFile;         // The snapshot last stepped away from
+StrVec       seriesNames;       // The snapshots, in the --series mode
+VecSize      seriesPos = 0;     // The index of the top snapshot
+Difference   diffs(&file1, &file2, &moreFiles);
 const char*  displayTable = asciiDisplayTable;
 const char*  program_name; // Name under which this program was invoked
 LockState    lockState = lockNeither;
 bool         singleFile = false;
+RunMode      runMode = runDisplay;
+ReportFormat reportFormat = reportText;
+bool         reportShowBytes = false; // --bytes was given
+bool         dumpHTML = false;  // --html was given
+#ifdef CONWIN_HEADLESS
+bool         headless = false; // Run without a terminal
+#endif
 
 int  numLines  = 9;       // Number of lines of each file to display
+int  lineWidth = 16;      // Number of bytes displayed per line
 int  bufSize   = numLines * lineWidth;
 int  linesBetween = 1;    // Number of lines of padding between files
 
+short  leftMar2 = 61;     // Starting column of ASCII display
+int    displayWidth = screenWidth; // Width of the file & prompt windows
+
 // The number of bytes to move for each possible step size:
 //   See cmmMoveByte, cmmMoveLine, cmmMovePage
 int  steps[4] = {1, lineWidth, bufSize-lineWidth, 0};
@@ -249,13 +570,54 @@ int  steps[4] = {1, lineWidth, bufSize-lineWidth, 0};
 //--------------------------------------------------------------------
 // Beep the speaker:
 
-#ifdef WIN32_CONSOLE // beep() is defined by ncurses
+#ifdef WIN32_CONSOLE // beep() is defined by ncurses or ansi/ConWin.cpp
 void beep()
 {
   MessageBeep(-1);
 } // end beep
 #endif // WIN32_CONSOLE
 
+//--------------------------------------------------------------------
+// Format a position as "XXXX XXXX":
+//
+// Positions of 4GB or more get extra digits in the first group.
+// (This runs for every line of a dump, so avoid sprintf.)
+//
+// Input:
+//   buf:  Receives the position (not NUL terminated), which takes
+//         at most maxPosWidth characters
+//   pos:  The position (must not be negative)
+//
+// Returns:
+//   A pointer just past the last character written
+
+const int  maxPosWidth = 17;
+
+char* formatPos(char* buf, FPos pos)
+{
+  int  shift = 28;
+
+  while (shift < 60 && (pos >> (shift + 4)))
+    shift += 4;
+
+  for (; shift >= 0; shift -= 4) {
+    *(buf++) = hexDigits[(pos >> shift) & 0x0F];
+    if (shift == 16) *(buf++) = ' ';
+  }
+
+  return buf;
+} // end formatPos
+
+//--------------------------------------------------------------------
+// Format a position as a string:
+
+String formatPos(FPos pos)
+{
+  char  buf[maxPosWidth];
+
+  return String(buf, formatPos(buf, pos));
+} // end formatPos
+
 //--------------------------------------------------------------------
 // Convert a character to uppercase:
 //
@@ -266,1458 +628,8099 @@ int safeUC(int c)
   return (c >= 0 && c <= UCHAR_MAX) ? toupper(c) : c;
 } // end safeUC
 
-//====================================================================
-// Class Difference:
-//
-// Member Variables:
-//   file1, file2:
-//     The FileDisplay objects being compared
-//   numDiffs:
-//     The number of differences between the two FileDisplay buffers
-//   line/table:
-//     An array of bools for each byte in the FileDisplay buffers
-//     True marks differences
-//
 //--------------------------------------------------------------------
-// Constructor:
+// Return the current time in seconds:
 //
-// Input:
-//   aFile1, aFile2:
-//     Pointers to the FileDisplay objects to compare
+// Only differences between times are meaningful.
 
-Difference::Difference(const FileDisplay* aFile1, const FileDisplay* aFile2)
-: data(NULL),
-  file1(aFile1),
-  file2(aFile2)
+double timeNow()
 {
-} // end Difference::Difference
+#ifdef WIN32_CONSOLE
+  return GetTickCount() / 1000.0;
+#else
+  struct timeval  now;
+  gettimeofday(&now, NULL);
 
-//--------------------------------------------------------------------
-Difference::~Difference()
-{
-  delete [] reinterpret_cast<Byte*>(data);
-} // end Difference::~Difference
+  return now.tv_sec + now.tv_usec / 1e6;
+#endif
+} // end timeNow
 
 //--------------------------------------------------------------------
-// Compute differences:
+// Compare one line of two buffers:
 //
-// Input Variables:
-//   file1, file2:  The files to compare
+// The line width is a template parameter so that the loop can be
+// fully unrolled for each of the widths we display.
 //
-// Returns:
-//   The number of differences between the buffers
-//   -1 if both buffers are empty
+// Input:
+//   buf1, buf2:  The lines to compare
 //
-// Output Variables:
-//   numDiffs:  The number of differences between the buffers
+// Output:
+//   diff:  diff[i] is set to true if the bytes differ, false if not
+//
+// Returns:
+//   The number of bytes that differ
 
-int Difference::compute()
+template <int width>
+int compareLine(const Byte* buf1, const Byte* buf2, Byte* diff)
 {
-  if (singleFile)
-    // We return 1 so that cmNextDiff won't keep searching:
-    return (file1->bufContents ? 1 : -1);
-
-  memset(data->buffer, 0, bufSize); // Clear the difference table
-
   int  different = 0;
 
-  const Byte*  buf1 = file1->data->buffer;
-  const Byte*  buf2 = file2->data->buffer;
+  for (int i = 0; i < width; ++i)
+    different += (diff[i] = (buf1[i] != buf2[i]));
 
-  int  size = min(file1->bufContents, file2->bufContents);
+  return different;
+} // end compareLine
 
-  int  i;
-  for (i = 0; i < size; i++)
-    if (*(buf1++) != *(buf2++)) {
-      data->buffer[i] = true;
-      ++different;
-    }
+//--------------------------------------------------------------------
+// Mark the bytes where two buffers differ:
+//
+// Unlike compareLine, this only adds marks, so any number of buffers
+// can be compared with the same one, at one pass apiece.  The loop
+// is simple enough for the compiler to vectorize.
+//
+// Input:
+//   buf1, buf2:  The buffers to compare
+//   size:        The number of bytes to compare
+//   diff:        The marks so far
+//
+// Output:
+//   diff:  diff[i] is set to true if the bytes differ (and left
+//          alone if not)
 
-  size = max(file1->bufContents, file2->bufContents);
+void markDifferences(const Byte* buf1, const Byte* buf2, int size,
+                     Byte* diff)
+{
+  for (int i = 0; i < size; ++i)
+    diff[i] |= (buf1[i] != buf2[i]);
+} // end markDifferences
 
-  if (i < size) {
-    // One buffer has more data than the other:
-    different += size - i;
-    for (; i < size; i++)
-      data->buffer[i] = true;   // These bytes are only in 1 buffer
-  } else if (!size)
-    return -1;                  // Both buffers are empty
+//--------------------------------------------------------------------
+// Format one line of the file display:
+//
+// Fills in the hex and character columns of a display row, and the
+// style of each byte shown.  Unsaved changes take precedence over
+// differences, and differences over matches.  The space between two
+// bytes with the same style shares it, so each run needs only one
+// attribute change.
+//
+// The line width is a template parameter, like compareLine.
+//
+// Input:
+//   line:     The bytes to display
+//   length:   The number of bytes in line (the rest are left blank)
+//   diff:     Non-zero for each byte that differs (may be NULL)
+//   matched:  Non-zero for each byte in a match (may be NULL)
+//   edited:   Non-zero for each byte not yet saved (may be NULL)
+//
+// Output:
+//   row:    Receives the hex display at leftMar and the characters
+//           after it
+//   style:  Receives the style of each byte shown (other columns
+//           are not changed)
+
+template <int width>
+void formatLine(const Byte* line, int length, const Byte* diff,
+                const char* matched, const char* edited,
+                char* row, Style* style)
+{
+  char*  hex  = row + leftMar - 1;
+  char*  text = row + leftMar + 3*width + width/8;
 
-  numDiffs = different;
+  for (int j = 0; j < width; ++j) {
+    if (j % 8 == 0) {
+      *(hex++) = ' ';
+      if (j) *(text++) = ' ';
+    }
 
-  return different;
-} // end Difference::compute
+    if (j < length) {
+      memcpy(hex, hexPairTable[line[j]], 3);
+      *text = displayTable[line[j]];
+    } else {
+      memset(hex, ' ', 3);
+      *text = ' ';
+    }
 
-//--------------------------------------------------------------------
-void Difference::resize()
-{
-  if (singleFile) return;
+    const Style  s = ((edited && edited[j]) ? cFileEdit :
+                      (diff && diff[j]) ? cFileDiff :
+                      (matched && matched[j]) ? cFileMatch : cFileWin);
+    if (s != cFileWin) {
+      const int  x = hex - row;
+      style[x] = style[x+1] = style[text - row] = s;
+      if (j % 8 && style[x-2] == s) style[x-1] = s;
+    }
 
-  if (data)
-    delete [] reinterpret_cast<Byte*>(data);
+    hex += 3;
+    ++text;
+  } // end for each byte in line
 
-  data = reinterpret_cast<FileBuffer*>(new Byte[bufSize]);
-} // end Difference::resize
+  *hex = ' ';                   // Between the hex and the characters
+} // end formatLine
 
 //====================================================================
-// Class FileDisplay:
+// Class Progress:
+//
+// Runs a long operation (a Task), showing its progress in the prompt
+// window and letting the user cancel it by pressing ESC.  The task
+// calls update as it goes, and stops when update returns false.
+//
+// When threads are available, the task runs on a worker thread while
+// the main thread keeps the display up to date and watches the
+// keyboard.  The task must not touch the screen, and nothing else
+// may use the files it works on until it finishes.  Without threads,
+// update itself shows the progress every so often.
 //
 // Member Variables:
-//   bufContents:
-//     The number of bytes in the file buffer
-//   diffs:
-//     A pointer to the Difference object related to this file
-//   file:
-//     The file being displayed
-//   fileName:
-//     The relative pathname of the file being displayed
-//   offset:
-//     The position in the file of the first byte in the buffer
-//   win:
-//     The handle of the window used for display
-//   yPos:
-//     The vertical position of the display window
-//   buffer/line:
-//     The currently displayed portion of the file
+//   title:
+//     Describes the operation
+//   start, total:
+//     The positions where the operation started and will finish
+//   pos:
+//     How far the operation has gotten
+//   cancelled:
+//     True if the user pressed ESC
+//   shown:
+//     True if the progress has been displayed (so the prompt window
+//     must be restored)
+//   startTime:
+//     When the operation started (for computing its throughput)
+//   task, finished, lock, done:
+//     Used to run the task on a worker thread
+//   nextShow:
+//     Without threads, the display is updated (and the keyboard
+//     checked) only when the position reaches this, so update can be
+//     called often
 //
+//--------------------------------------------------------------------
+
+#ifdef HAVE_PTHREADS
+const long  progressInterval = 100; // Milliseconds between updates
+#else
+const FPos  progressInterval = 1024 * 1024; // Bytes between updates
+#endif
+
 //--------------------------------------------------------------------
 // Constructor:
+//
+// Input:
+//   aTitle:  Describes the operation (must remain valid)
+//   aStart:  The position where the operation starts
+//   aTotal:  The position where the operation will finish
+
+Progress::Progress(const char* aTitle, FPos aStart, FPos aTotal)
+: title(aTitle),
+  start(aStart),
+  total(aTotal),
+  pos(aStart),
+  cancelled(false),
+  shown(false),
+  startTime(0)
+{
+#ifdef HAVE_PTHREADS
+  task = NULL;
+  finished = false;
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&done, NULL);
+#else
+  nextShow = aStart + progressInterval;
+#endif
+} // end Progress::Progress
 
-FileDisplay::FileDisplay()
-: bufContents(0),
-  data(NULL),
-  diffs(NULL),
-  offset(0),
-  writable(false),
-  yPos(0)
+//--------------------------------------------------------------------
+// Destructor:
+
+Progress::~Progress()
 {
-  fileName[0] = '\0';
-} // end FileDisplay::FileDisplay
+#ifdef HAVE_PTHREADS
+  pthread_cond_destroy(&done);
+  pthread_mutex_destroy(&lock);
+#endif
+} // end Progress::~Progress
 
 //--------------------------------------------------------------------
-// Initialize:
+// Run a task:
 //
-// Creates the display window and opens the file.
+// Returns when the task is finished, restoring the prompt window if
+// the progress was displayed.
 //
 // Input:
-//   y:          The vertical position of the display window
-//   aDiff:      The Difference object related to this buffer
-//   aFileName:  The name of the file to display
+//   task:  The operation to perform
+//
+// Returns:
+//   true:   The task ran to completion
+//   false:  The user cancelled it
 
-void FileDisplay::init(int y, const Difference* aDiff,
-                       const char* aFileName)
+bool Progress::run(Task& task)
 {
-  diffs = aDiff;
-  yPos  = y;
+  startTime = timeNow();
 
-  win.init(0,y, screenWidth, (numLines + 1 + ((y==0) ? linesBetween : 0)),
-           cFileWin);
+#ifdef HAVE_PTHREADS
+  pthread_t  thread;
 
-  resize();
+  this->task = &task;
+  finished = false;
 
-  if (aFileName)
-    setFile(aFileName);
-} // end FileDisplay::init
+  if (pthread_create(&thread, NULL, worker, this) != 0)
+    task.run(*this);            // Run it here, without showing progress
+  else {
+    pthread_mutex_lock(&lock);
+
+    while (!finished) {
+      struct timeval   now;
+      struct timespec  deadline;
+
+      gettimeofday(&now, NULL);
+      deadline.tv_sec  = now.tv_sec;
+      deadline.tv_nsec = (now.tv_usec + progressInterval * 1000) * 1000;
+      if (deadline.tv_nsec >= 1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000;
+      }
 
-//--------------------------------------------------------------------
-// Destructor:
+      pthread_cond_timedwait(&done, &lock, &deadline);
+      if (finished) break;
 
-FileDisplay::~FileDisplay()
-{
-  shutDown();
-  CloseFile(file);
-  delete [] reinterpret_cast<Byte*>(data);
-} // end FileDisplay::~FileDisplay
+      const FPos  at = pos;
+      pthread_mutex_unlock(&lock);
 
-//--------------------------------------------------------------------
-void FileDisplay::resize()
-{
-  if (data)
-    delete [] reinterpret_cast<Byte*>(data);
+      const bool  cancel = !show(at);
 
-  data = reinterpret_cast<FileBuffer*>(new Byte[bufSize]);
+      pthread_mutex_lock(&lock);
+      if (cancel) cancelled = true;
+    } // end while worker running
 
-  // FIXME resize window
-} // end FileDisplay::resize
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+  } // end else started worker
+#else
+  task.run(*this);
+#endif
 
-//--------------------------------------------------------------------
-// Shut down the file display:
-//
-// Deletes the display window.
+  if (shown) showPrompt();
 
-void FileDisplay::shutDown()
-{
-  win.close();
-} // end FileDisplay::shutDown
+  return !cancelled;
+} // end Progress::run
 
 //--------------------------------------------------------------------
-// Display the file contents:
+// Display the progress:
+//
+// Input:
+//   at:  How far the operation has gotten
+//
+// Returns:
+//   true:   Continue the operation
+//   false:  The user pressed ESC
 
-void FileDisplay::display()
+bool Progress::show(FPos at)
 {
-  if (!fileName[0]) return;
+  if (!shown) {
+    promptWin.clear();
+    promptWin.border();
+    promptWin.put(3,2, "ESC cancel");
+    promptWin.putAttribs(3,2, cPromptKey, 3);
+    shown = true;
+  }
 
-  FPos  lineOffset = offset;
+  const double  elapsed = timeNow() - startTime;
 
-  short i,j,index,lineLength;
-  char  buf[lineWidth + lineWidth/8 + 1];
-  buf[sizeof(buf)-1] = '\0';
+  char  buf[screenWidth];
+  sprintf(buf, "%s: %s of %s (%d%%)  %.1f MB/s", title,
+          formatPos(at).c_str(), formatPos(total).c_str(),
+          int(total > start ? (min(at, total) - start) * 100 / (total - start)
+              : 100),
+          (elapsed > 0 ? (at - start) / elapsed / (1024 * 1024) : 0.0));
+  promptWin.putChar(3,1, ' ', displayWidth - 6);
+  promptWin.put(3,1, buf);
+  promptWin.update();
 
-  char  buf2[screenWidth+1];
-  buf2[screenWidth] = '\0';
+  bool  cancel = false;
+  int   key;
+  while ((key = promptWin.pollKey()) >= 0)
+    if (key == KEY_ESCAPE) cancel = true;
 
-  memset(buf, ' ', sizeof(buf)-1);
-
-  for (i = 0; i < numLines; i++) {
-//    cerr << i << '\n';
-    char*  str = buf2;
-    str +=
-      sprintf(str, "%04X %04X:",Word(lineOffset>>16),Word(lineOffset&0xFFFF));
-
-    lineLength  = min(lineWidth, bufContents - i*lineWidth);
-
-    for (j = 0, index = -1; j < lineLength; j++) {
-      if (j % 8 == 0) {
-        *(str++) = ' ';
-        ++index;
-      }
-      str += sprintf(str, "%02X ", data->line[i][j]);
-
-      buf[index++] = displayTable[data->line[i][j]];
-    }
-    if (index < 0) index = 0; // in case nothing was printed in this line
-    memset(buf + index, ' ', sizeof(buf) - index - 1);
-    memset(str, ' ', screenWidth - (str - buf2));
-
-    win.put(0,i+1, buf2);
-    win.put(leftMar2,i+1, buf);
-
-    if (diffs)
-      for (j = 0; j < lineWidth; j++)
-        if (diffs->data->line[i][j]) {
-          win.putAttribs(j*3 + leftMar  + (j>7),i+1, cFileDiff,2);
-          win.putAttribs(j   + leftMar2 + (j>7),i+1, cFileDiff,1);
-        }
-    lineOffset += lineWidth;
-  } // end for i up to numLines
-
-  win.update();
-} // end FileDisplay::display
+  return !cancel;
+} // end Progress::show
 
 //--------------------------------------------------------------------
-// Edit the file:
+// Report the current position:
+//
+// Called by the task (on the worker thread, if there is one).
+//
+// Input:
+//   newPos:  How far the operation has gotten
 //
 // Returns:
-//   true:  File changed
-//   false:  File did not change
+//   true:   Continue the operation
+//   false:  The user cancelled it
 
-bool FileDisplay::edit(const FileDisplay* other)
+bool Progress::update(FPos newPos)
 {
-  if (!bufContents && offset)
-    return false;               // You must not be completely past EOF
-
-  if (!writable) {
-    File w = OpenFile(fileName, true);
-    if (w == InvalidFile) return false;
-    CloseFile(file);
-    file = w;
-    writable = true;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock);
+  pos = newPos;
+  const bool  stop = cancelled;
+  pthread_mutex_unlock(&lock);
+
+  return !stop;
+#else
+  pos = newPos;
+
+  if (pos >= nextShow && !cancelled) {
+    nextShow = pos + progressInterval;
+    if (!show(pos)) cancelled = true;
   }
 
-  if (bufContents < bufSize)
-    memset(data->buffer + bufContents, 0, bufSize - bufContents);
-
-  short x = 0;
-  short y = 0;
-  bool  hiNib = true;
-  bool  ascii = false;
-  bool  changed = false;
-  int   key;
-
-  const Byte *const inputTable = ((displayTable == ebcdicDisplayTable)
-                                  ? ascii2ebcdicTable
-                                  : NULL); // No translation
-
-  showEditPrompt();
-  win.setCursor(leftMar,1);
-  ConWindow::showCursor();
+  return !cancelled;
+#endif
+} // end Progress::update
 
-  for (;;) {
-    win.setCursor((ascii ? leftMar2 + x : leftMar + 3*x + !hiNib) + (x / 8),
-                  y+1);
-    key = win.readKey();
+#ifdef HAVE_PTHREADS
+//--------------------------------------------------------------------
+// The worker thread:
+//
+// Input:
+//   progress:  The Progress object whose task should be run
 
-    switch (key) {
-     case KEY_ESCAPE: goto done;
-     case KEY_TAB:
-      hiNib = true;
-      ascii = !ascii;
-      break;
+void* Progress::worker(void* progress)
+{
+  Progress&  p = *static_cast<Progress*>(progress);
 
-     case KEY_DELETE:
-     case KEY_BACKSPACE:
-     case KEY_LEFT:
-      if (!hiNib)
-        hiNib = true;
-      else {
-        if (!ascii) hiNib = false;
-        if (--x < 0) x = lineWidth-1;
-      }
-      if (hiNib || (x < lineWidth-1))
-        break;
-      // else fall thru
-     case KEY_UP:   if (--y < 0) y = numLines-1; break;
+  p.task->run(p);
 
-     default: {
-       short newByte = -1;
-       if ((key == KEY_RETURN) && other &&
-           (other->bufContents > x + y*lineWidth)) {
-         newByte = other->data->line[y][x]; // Copy from other file
-         hiNib = ascii; // Always advance cursor to next byte
-       } else if (ascii) {
-         if (isprint(key)) newByte = (inputTable ? inputTable[key] : key);
-       } else { // hex
-         if (isdigit(key))
-           newByte = key - '0';
-         else if (isxdigit(key))
-           newByte = safeUC(key) - 'A' + 10;
-         if (newByte >= 0) {
-           if (hiNib)
-             newByte = (newByte * 0x10) | (0x0F & data->line[y][x]);
-           else
-             newByte |= 0xF0 & data->line[y][x];
-         } // end if valid digit entered
-       } // end else hex
-       if (newByte >= 0) {
-         changed = true;
-         setByte(x,y,newByte);
-       } else
-         break;
-     } // end default and fall thru
-     case KEY_RIGHT:
-      if (hiNib && !ascii)
-        hiNib = false;
-      else {
-        hiNib = true;
-        if (++x >= lineWidth) x = 0;
-      }
-      if (x || !hiNib)
-        break;
-      // else fall thru
-     case KEY_DOWN: if (++y >= numLines) y = 0;  break;
+  pthread_mutex_lock(&p.lock);
+  p.finished = true;
+  pthread_cond_signal(&p.done);
+  pthread_mutex_unlock(&p.lock);
 
-    } // end switch
+  return NULL;
+} // end Progress::worker
+#endif // HAVE_PTHREADS
 
-  } // end forever
+//====================================================================
+// Class Searcher:
+//
+// A Searcher scans a file for one or more patterns, and reports each
+// match to a MatchHandler.  Matches are reported in the order their
+// last byte is found, which is not necessarily the order in which
+// they start.  The handler can set stopAfter to end the scan early.
+//--------------------------------------------------------------------
+// Report how far a scan has gotten:
+//
+// Searchers call this after each block they read.  If the user
+// cancels the scan, stopAfter is set so that it ends.
+//
+// Input:
+//   pos:  The position the scan has reached
 
- done:
-  if (changed) {
-    promptWin.clear();
-    promptWin.border();
-    promptWin.put(30,1,"Save changes (Y/N):");
-    promptWin.update();
-    promptWin.setCursor(50,1);
-    key = promptWin.readKey();
-    if (safeUC(key) != 'Y') {
-      changed = false;
-      moveTo(offset);           // Re-read buffer contents
-    } else {
-      SeekFile(file, offset);
-      WriteFile(file, data->buffer, bufContents);
-    }
-  }
-  showPrompt();
-  ConWindow::hideCursor();
-  return changed;
-} // end FileDisplay::edit
+void MatchHandler::scanned(FPos pos)
+{
+  if (progress && !progress->update(pos))
+    stopAfter = -1;
+} // end MatchHandler::scanned
 
 //--------------------------------------------------------------------
-void FileDisplay::setByte(short x, short y, Byte b)
+// Find the first match:
+//
+// After the scan, best is the match starting closest to the start of
+// the scan (best.pos is -1 if there was no match).
+
+class FirstMatch : public MatchHandler
 {
-  if (x + y*lineWidth >= bufContents) {
-    if (x + y*lineWidth > bufContents) {
-      short y1 = bufContents / lineWidth;
-      short x1 = bufContents % lineWidth;
-      while (y1 <= numLines) {
-        while (x1 < lineWidth) {
-          if ((x1 == x) && (y1 == y)) goto done;
-          setByte(x1,y1,0);
-          ++x1;
-        }
-        x1 = 0;
-        ++y1;
-      } // end while y1
-    } // end if more than 1 byte past the end
-   done:
-    ++bufContents;
-    data->line[y][x] = b ^ 1;         // Make sure it's different
-  } // end if past the end
+ public:
+  Match  best;
+  FirstMatch() { best.pos = -1; };
+  virtual void found(const Match& match);
+}; // end FirstMatch
 
-  if (data->line[y][x] != b) {
-    data->line[y][x] = b;
-    char str[3];
-    sprintf(str, "%02X", b);
-    win.setAttribs(cFileEdit);
-    win.put(leftMar + 3*x + (x / 8), y+1, str);
-    str[0] = displayTable[b];
-    str[1] = '\0';
-    win.put(leftMar2 + x + (x / 8), y+1, str);
-    win.setAttribs(cFileWin);
-    win.update();
-  }
-} // end FileDisplay::setByte
+void FirstMatch::found(const Match& match)
+{
+  // Prefer the earliest match, and the longest one that starts there:
+  if (best.pos < 0 || match.pos < best.pos ||
+      (match.pos == best.pos && match.length > best.length))
+    best = match;
 
-//--------------------------------------------------------------------
-// Change the file position:
-//
-// Changes the file offset and updates the buffer.
-// Does not update the display.
-//
-// Input:
-//   step:
-//     The number of bytes to move
-//     A negative value means to move backward
-//
-// void FileDisplay::move(int step) /* Inline function */
+  stopAfter = best.pos;         // Nothing starting later can beat this
+} // end FirstMatch::found
 
 //--------------------------------------------------------------------
-// Change the file position:
-//
-// Changes the file offset and updates the buffer.
-// Does not update the display.
+// Scan a file as a Task, so it can run in the background:
 //
 // Input:
-//   newOffset:
-//     The new position of the file
+//   searcher:  The pattern(s) to search for
+//   doc:       The document to search (including unsaved changes)
+//   start:     The position where the search should begin
+//   handler:   Receives the matches
 
-void FileDisplay::moveTo(FPos newOffset)
+class ScanTask : public Task
 {
-  if (!fileName[0]) return;     // No file
-
-  offset = newOffset;
+ public:
+  ScanTask(const Searcher& aSearcher, const Document& aDoc, FPos aStart,
+           MatchHandler& aHandler)
+    : searcher(aSearcher), doc(aDoc), start(aStart), handler(aHandler) {};
+  virtual void run(Progress& progress);
 
-  if (offset < 0)
-    offset = 0;
+ protected:
+  const Searcher&  searcher;
+  const Document&  doc;
+  FPos             start;
+  MatchHandler&    handler;
+}; // end ScanTask
 
-  SeekFile(file, offset);
-  bufContents = ReadFile(file, data->buffer, bufSize);
-} // end FileDisplay::moveTo
+void ScanTask::run(Progress& progress)
+{
+  handler.progress = &progress;
+  searcher.scan(doc, start, handler);
+} // end ScanTask::run
 
-//--------------------------------------------------------------------
-// Change the file position by searching:
+//====================================================================
+// Class ExactSearch:
 //
-// Changes the file offset and updates the buffer.
-// Does not update the display.
+// Searches for a single byte sequence.
+//
+// Member Variables:
+//   pattern:
+//     The bytes to search for
+//   moveOver:
+//     The QuickSearch shift table
+//
+//--------------------------------------------------------------------
+// Constructor:
 //
 // Input:
 //   searchFor:  The bytes to search for
 //   searchLen:  The number of bytes in searchFor
-//
-// Returns:
-//   true:   The search was successful
-//   false:  Search unsuccessful, file not moved
 
-bool FileDisplay::moveTo(const Byte* searchFor, int searchLen)
+ExactSearch::ExactSearch(const Byte* searchFor, int searchLen)
+: pattern(reinterpret_cast<const char*>(searchFor), searchLen)
 {
-  if (!fileName[0]) return true; // No file, pretend success
-
   // Using algorithm based on QuickSearch:
   //   http://www-igm.univ-mlv.fr/~lecroq/string/node19.htm
 
   // Compute offset table:
   int i;
-  int moveOver[256];
 
   for (i = 0; i < 256; ++i)
     moveOver[i] = searchLen + 1;
   for (i = 0; i < searchLen; ++i)
     moveOver[searchFor[i]] = searchLen - i;
+} // end ExactSearch::ExactSearch
+
+//--------------------------------------------------------------------
+// Report every occurrence of the pattern:
+//
+// Each block is read at the position where the previous one stopped
+// searching, so a match may straddle the boundary between blocks.
+//
+// Input:
+//   doc:      The document to search
+//   start:    The position where the search should begin
+//   handler:  Receives the matches
 
-  // Prepare the search buffer:
+void ExactSearch::scan(const Document& doc, FPos start,
+                       MatchHandler& handler) const
+{
+  const int  searchLen = pattern.length();
+  const int  blockSize = 64 * 1024;
+  const Byte *const  searchFor = reinterpret_cast<const Byte*>(pattern.data());
 
-  const int
-    blockSize  = 8 * 1024,
-    moveLength = searchLen,
-    restartAt  = blockSize - moveLength,
-    fullStop   = blockSize * 2 - moveLength;
+  Byte *const  searchBuf = new Byte[blockSize];
 
-  Byte *const  searchBuf = new Byte[2 * blockSize];
+  Match  match;
+  match.length = searchLen;
+  match.which  = 0;
 
-  Byte *const  copyTo         = searchBuf + restartAt;
-  const Byte *const copyFrom  = searchBuf + fullStop;
+  FPos  pos = start;
 
-  char *const  readAt = reinterpret_cast<char*>(searchBuf) + blockSize;
+  for (;;) {
+    const int  bytesRead = doc.read(pos, searchBuf, blockSize);
+    if (bytesRead < searchLen) break;
 
-  FPos  newPos = offset + 1;
+    const int  last = bytesRead - searchLen;
+    int  i = 0;
 
-  SeekFile(file, newPos);
-  Size bytesRead = ReadFile(file, searchBuf, blockSize * 2);
-  int stopAt = bytesRead - moveLength;
+    while (i <= last) {
+      if (pos + i > handler.stopAfter) goto done;
 
-  // Start the search:
-  i = 0;
-  for (;;) {
-    if (stopAt < fullStop) ++stopAt;
+      if (memcmp(searchFor, searchBuf + i, searchLen) == 0) {
+        match.pos = pos + i;
+        handler.found(match);
+      }
 
-    while (i < stopAt) {
-      if (memcmp(searchFor, searchBuf + i, searchLen) == 0)
-        goto done;
+      if (i == last) { ++i; break; } // Can't look past the buffer
 
       i += moveOver[searchBuf[i + searchLen]]; // shift
     } // end while more buffer to search
 
-    if (stopAt != fullStop) {
-      i = -1;
-      goto done;
-    } // Nothing more to read
+    if (bytesRead < blockSize) break; // Nothing more to read
 
-    newPos += blockSize;
-    i -= blockSize;
-    memcpy(copyTo, copyFrom, moveLength);
-    bytesRead = ReadFile(file, readAt, blockSize);
-    stopAt = bytesRead + blockSize - moveLength;
+    pos += i;
+    handler.scanned(pos);
   } // end forever
 
  done:
   delete [] searchBuf;
+} // end ExactSearch::scan
 
-  if (i < 0) return false;      // No match
+//====================================================================
+// Class MultiSearch:
+//
+// Searches for any number of patterns in a single pass using an
+// Aho-Corasick automaton.  The failure links are folded into the
+// transition table, so each input byte costs one table lookup.
+//
+// Patterns that ignore case in different encodings can't share an
+// automaton, because a byte that is a letter in one encoding may be
+// punctuation in another.  Each encoding then gets its own automaton,
+// and they all run in the same pass over the file.
+//
+// Member Variables:
+//   automata:
+//     The automata (usually just one)
+//   labels, lengths:
+//     The description and length of each pattern
+//   maxLength:
+//     The length of the longest pattern
+//
+// Automaton Member Variables:
+//   delta:
+//     The transition table (state * 256 + byte)
+//   dictLink:
+//     For each state, the nearest state along its failure chain
+//     where a pattern ends (0 if none)
+//   output:
+//     For each state, the longest pattern ending there (-1 if none)
+//   fold:
+//     Maps each byte to the byte it should match as (normally
+//     itself).  Both the patterns and the transition table are
+//     folded, so ignoring case costs nothing while searching.
+//
+//--------------------------------------------------------------------
+// Constructors:
 
-  moveTo(newPos + i);
+MultiSearch::MultiSearch()
+: automata(1),
+  maxLength(0)
+{
+} // end MultiSearch::MultiSearch
 
-  return true;
-} // end FileDisplay::moveTo
+MultiSearch::Automaton::Automaton()
+: delta(256, 0),
+  dictLink(1, 0),
+  output(1, -1)
+{
+  for (int i = 0; i < 256; ++i)
+    fold[i] = i;
+} // end MultiSearch::Automaton::Automaton
 
 //--------------------------------------------------------------------
-// Move to the end of the file:
+// Make the patterns added after this ignore the case of letters:
+//
+// Starts a new automaton if patterns have already been added.
 //
 // Input:
-//   other:  If non NULL, move both files to the end of the shorter file
+//   encode:  Translates ASCII to the encoding the patterns use
+//            (NULL for ASCII itself)
 
-void FileDisplay::moveToEnd(FileDisplay* other)
+void MultiSearch::ignoreCase(const Byte* encode)
 {
-  if (!fileName[0]) return;     // No file
-
-  FPos  end = SeekFile(file, 0, SeekEnd);
-  FPos  diff = 0;
-
-  if (other) {
-    // If the files aren't currently at the same position,
-    // we want to keep them offset by the same amount:
-    diff = other->offset - offset;
-
-    end = min(end, SeekFile(other->file, 0, SeekEnd) - diff);
-  } // end if moving other file too
+  if (automata.back().output.size() > 1)
+    automata.push_back(Automaton());
+  else
+    automata.back() = Automaton();
 
-  end -= steps[cmmMovePage];
-  end -= end % 0x10;
+  Byte *const  fold = automata.back().fold;
 
-  moveTo(end);
-  if (other) other->moveTo(end + diff);
-} // end FileDisplay::moveToEnd
+  for (int c = 'A'; c <= 'Z'; ++c) {
+    if (encode)
+      fold[encode[c]] = encode[tolower(c)];
+    else
+      fold[c] = tolower(c);
+  }
+} // end MultiSearch::ignoreCase
 
 //--------------------------------------------------------------------
-// Open a file for display:
+// Add a pattern to the trie:
 //
-// Opens the file, updates the filename display, and reads the start
-// of the file into the buffer.
+// Must not be called after build().
 //
 // Input:
-//   aFileName:  The name of the file to open
-//
-// Returns:
-//   True:   Operation successful
-//   False:  Unable to open file (call ErrorMsg for error message)
+//   pattern:  The bytes to search for
+//   label:    The description returned by describe()
 
-bool FileDisplay::setFile(const char* aFileName)
+void MultiSearch::add(const String& pattern, const String& label)
 {
-  strncpy(fileName, aFileName, maxPath);
-  fileName[maxPath-1] = '\0';
+  if (pattern.empty()) return;
+
+  Automaton&  a = automata.back();
+  int  state = 0;
+
+  for (StrConstItr c = pattern.begin(); c != pattern.end(); ++c) {
+    const Byte  b = a.fold[Byte(*c)];
+    int&  next = a.delta[state * 256 + b];
+    if (!next) {
+      next = a.output.size();
+      a.delta.resize(a.delta.size() + 256, 0);
+      a.dictLink.push_back(0);
+      a.output.push_back(-1);
+    }
+    state = a.delta[state * 256 + b]; // delta may have moved
+  } // end for each byte in pattern
+
+  if (a.output[state] < 0) {    // Ignore duplicate patterns
+    a.output[state] = lengths.size();
+    labels.push_back(label);
+    lengths.push_back(pattern.length());
+    maxLength = max(maxLength, int(pattern.length()));
+  }
+} // end MultiSearch::add
 
-  win.put(0,0, fileName);
-  win.putAttribs(0,0, cFileName, screenWidth);
-  win.update();                 // FIXME
+//--------------------------------------------------------------------
+// Compute the failure transitions:
+//
+// Must be called after all patterns have been added.
 
-  bufContents = 0;
-  file = OpenFile(fileName);
-  writable = false;
+void MultiSearch::build()
+{
+  for (VecSize a = 0; a < automata.size(); ++a)
+    automata[a].build();
+} // end MultiSearch::build
 
-  if (file == InvalidFile)
-    return false;
+void MultiSearch::Automaton::build()
+{
+  const int  numStates = output.size();
+  vector<int>  fail(numStates, 0);
+  vector<int>  queue;
+  queue.reserve(numStates);
+
+  for (int b = 0; b < 256; ++b)
+    if (delta[b]) queue.push_back(delta[b]);
+
+  // Visit states in breadth-first order, so each state's failure
+  // state has been completed before the state itself:
+  for (VecSize q = 0; q < queue.size(); ++q) {
+    const int  state = queue[q];
+
+    dictLink[state] = (output[fail[state]] >= 0
+                       ? fail[state] : dictLink[fail[state]]);
+
+    for (int b = 0; b < 256; ++b) {
+      int&  next = delta[state * 256 + b];
+      if (next) {
+        fail[next] = delta[fail[state] * 256 + b];
+        queue.push_back(next);
+      } else
+        next = delta[fail[state] * 256 + b];
+    } // end for each possible byte
+  } // end for each state
+
+  // Make each byte behave like the byte it folds to:
+  for (int state = 0; state < numStates; ++state)
+    for (int b = 0; b < 256; ++b)
+      if (fold[b] != b)
+        delta[state * 256 + b] = delta[state * 256 + fold[b]];
+} // end MultiSearch::Automaton::build
 
-  offset = 0;
-  bufContents = ReadFile(file, data->buffer, bufSize);
+//--------------------------------------------------------------------
+// Report every occurrence of every pattern:
+//
+// Every automaton advances over each byte before the next one is
+// read, so matches are still reported in order of where they end.
+//
+// Input:
+//   doc:      The document to search
+//   start:    The position where the search should begin
+//   handler:  Receives the matches
 
-  return true;
-} // end FileDisplay::setFile
+void MultiSearch::scan(const Document& doc, FPos start,
+                       MatchHandler& handler) const
+{
+  if (!maxLength) return;
+
+  const int  blockSize = 64 * 1024;
+  Byte *const  searchBuf = new Byte[blockSize];
+
+  // Keep each automaton's tables and state where the loop can reach
+  // them quickly:
+  const VecSize  numAutomata = automata.size();
+  vector<Run>  runs(numAutomata);
+
+  for (VecSize a = 0; a < numAutomata; ++a) {
+    runs[a].delta    = &automata[a].delta[0];
+    runs[a].dictLink = &automata[a].dictLink[0];
+    runs[a].output   = &automata[a].output[0];
+    runs[a].state    = 0;
+  }
+
+  Run *const  firstRun = &runs[0];
+  Run *const  endRun   = firstRun + numAutomata;
+
+  Match  match;
+  FPos  pos = start;            // The position of searchBuf[0]
+
+  int  bytesRead;
+  while ((bytesRead = doc.read(pos, searchBuf, blockSize)) > 0) {
+    for (int i = 0; i < bytesRead; ++i) {
+      for (Run* r = firstRun; r != endRun; ++r) {
+        const int  state = r->state = r->delta[r->state * 256 + searchBuf[i]];
+
+        for (int s = (r->output[state] >= 0 ? state : r->dictLink[state]);
+             s; s = r->dictLink[s]) {
+          match.which  = r->output[s];
+          match.length = lengths[match.which];
+          match.pos    = pos + i + 1 - match.length;
+          handler.found(match);
+        } // end for each pattern ending here
+      } // end for each automaton
+    } // end for each byte in buffer
+
+    pos += bytesRead;
+    handler.scanned(pos);
+
+    // Every match still to come starts after pos - maxLength:
+    if (pos - maxLength >= handler.stopAfter) break;
+  } // end while more to read
+
+  delete [] searchBuf;
+} // end MultiSearch::scan
 
 //====================================================================
-// Main Program:
+// Class RegexSearch:
+//
+// Searches for a regular expression.  The expression is compiled to
+// two DFAs, so the search never backtracks:
+//
+//   search:   Finds the end of the longest match that starts leftmost
+//   reverse:  Scans backwards from that end to the start of the match
+//
+// The search then resumes after the match, so matches never overlap.
+//
+// The syntax is byte-oriented:
+//   .          Any byte
+//   \xHH       The byte with hex value HH
+//   \n \r \t   Newline, return, tab
+//   \d \s \w   Digit, whitespace, or word character (\D \S \W negated)
+//   [...]      Any byte in the set ([^...] for any byte not in it)
+//   (...)      Grouping
+//   a|b        Alternation
+//   * + ?      Repeat 0 or more, 1 or more, 0 or 1 times
+//   {n} {n,} {n,m}  Repeat n times, n or more, or n to m times
+// Any other character preceded by \ matches itself.
+//
+// In EBCDIC mode, literal characters (but not \x escapes) are
+// translated to EBCDIC.
 //--------------------------------------------------------------------
-void calcScreenLayout(bool resize = true)
+
+typedef bitset<256>  ByteSet;
+
+const int  maxRepeat    = 1000;   // The largest allowed repeat count
+const int  maxNfaStates = 20000;  // The largest allowed NFA
+const int  maxDfaStates = 4096;   // The largest allowed DFA
+
+struct RegexNode
 {
-  int  screenX, screenY;
+  enum Type { rxBytes, rxConcat, rxAlt, rxRepeat };
 
-  ConWindow::getScreenSize(screenX, screenY);
+  Type         type;
+  ByteSet      bytes;           // rxBytes: The bytes matched
+  vector<int>  kids;            // The subexpressions
+  int          min, max;        // rxRepeat: The repeat count (-1 means any)
+}; // end RegexNode
 
-  if (screenX < screenWidth) {
-    ostringstream  err;
-    err << "The screen must be at least "
-        << screenWidth << " characters wide.";
-    exitMsg(2, err.str().c_str());
-  }
+//--------------------------------------------------------------------
+// Parse a regular expression into a tree of RegexNodes:
+//
+// Member Variables:
+//   nodes:      All the nodes of the tree (children are indexes)
+//   error:      The error message (empty if successful)
+//   regex:      The expression being parsed
+//   pos:        The current position in regex
+//   translate:  The table for translating literal characters (or NULL)
 
-  if (screenY < promptHeight + 4) {
-    ostringstream  err;
-    err << "The screen must be at least "
-        << (promptHeight + 4) << " lines high.";
-    exitMsg(2, err.str().c_str());
-  }
+class RegexParser
+{
+ public:
+  vector<RegexNode>  nodes;
+  String             error;
 
-  numLines = screenY - promptHeight - (singleFile ? 1 : 2);
+  RegexParser(const String& aRegex, const Byte* aTranslate)
+    : regex(aRegex), pos(0), translate(aTranslate) {};
+  int  parse();
 
-  if (singleFile)
-    linesBetween = 0;
-  else {
-    linesBetween = numLines % 2;
-    numLines = (numLines - linesBetween) / 2;
+ protected:
+  const String&  regex;
+  StrIdx         pos;
+  const Byte*    translate;
+
+  void  addChar(ByteSet& set, int c, bool literal);
+  int   fail(const char* message);
+  int   newNode(RegexNode::Type type);
+  int   parseAlt();
+  int   parseAtom();
+  int   parseClass();
+  int   parseConcat();
+  int   parseEscape(ByteSet& set, bool& literal);
+  bool  parseNumber(int& n);
+  int   parseRepeat();
+}; // end RegexParser
+
+//--------------------------------------------------------------------
+// Parse the expression:
+//
+// Returns:
+//   The index of the root node, or -1 if there was an error
+
+int RegexParser::parse()
+{
+  int  root = parseAlt();
+
+  if (error.empty() && pos < regex.length())
+    fail("Unmatched )");
+
+  return (error.empty() ? root : -1);
+} // end RegexParser::parse
+
+//--------------------------------------------------------------------
+void RegexParser::addChar(ByteSet& set, int c, bool literal)
+{
+  set.set((literal && translate) ? translate[c] : c);
+} // end RegexParser::addChar
+
+//--------------------------------------------------------------------
+int RegexParser::fail(const char* message)
+{
+  if (error.empty()) error = message;
+
+  return -1;
+} // end RegexParser::fail
+
+//--------------------------------------------------------------------
+int RegexParser::newNode(RegexNode::Type type)
+{
+  nodes.push_back(RegexNode());
+  nodes.back().type = type;
+
+  return nodes.size() - 1;
+} // end RegexParser::newNode
+
+//--------------------------------------------------------------------
+// Parse alternatives:  a|b|c
+
+int RegexParser::parseAlt()
+{
+  int  first = parseConcat();
+
+  if (pos >= regex.length() || regex[pos] != '|')
+    return first;
+
+  int  alt = newNode(RegexNode::rxAlt);
+  nodes[alt].kids.push_back(first);
+
+  while (error.empty() && pos < regex.length() && regex[pos] == '|') {
+    ++pos;
+    int  next = parseConcat();
+    nodes[alt].kids.push_back(next);
   }
 
-  bufSize = numLines * lineWidth;
+  return alt;
+} // end RegexParser::parseAlt
 
-  steps[cmmMovePage] = bufSize-lineWidth;
+//--------------------------------------------------------------------
+// Parse a sequence of (possibly repeated) atoms:
 
-  // FIXME resize existing windows
-} // end calcScreenLayout
+int RegexParser::parseConcat()
+{
+  int  concat = newNode(RegexNode::rxConcat);
+
+  while (error.empty() && pos < regex.length() &&
+         regex[pos] != '|' && regex[pos] != ')') {
+    int  next = parseRepeat();
+    nodes[concat].kids.push_back(next);
+  }
+
+  return concat;
+} // end RegexParser::parseConcat
 
 //--------------------------------------------------------------------
-void displayCharacterSet()
+// Parse an atom followed by any number of repeat operators:
+
+int RegexParser::parseRepeat()
 {
-  const bool isASCII = (displayTable == asciiDisplayTable);
+  int  atom = parseAtom();
+
+  while (error.empty() && pos < regex.length()) {
+    int  min, max;
+
+    switch (regex[pos++]) {
+     case '*':  min = 0;  max = -1;  break;
+     case '+':  min = 1;  max = -1;  break;
+     case '?':  min = 0;  max = 1;   break;
+     case '{':
+      if (!parseNumber(min)) return -1;
+      max = min;
+      if (pos < regex.length() && regex[pos] == ',') {
+        ++pos;
+        if (pos < regex.length() && regex[pos] == '}')
+          max = -1;
+        else if (!parseNumber(max))
+          return -1;
+      }
+      if (pos >= regex.length() || regex[pos++] != '}')
+        return fail("Missing }");
+      if (max >= 0 && max < min)
+        return fail("Invalid repeat count");
+      break;
 
-  promptWin.putAttribs(3,2, (isASCII ? cCurrentMode : cBackground), 5);
-  promptWin.putAttribs(9,2, (isASCII ? cBackground : cCurrentMode), 6);
+     default:
+      --pos;
+      return atom;
+    } // end switch
 
-  promptWin.update();
-} // end displayCharacterSet
+    int  repeat = newNode(RegexNode::rxRepeat);
+    nodes[repeat].kids.push_back(atom);
+    nodes[repeat].min = min;
+    nodes[repeat].max = max;
+    atom = repeat;
+  } // end while more repeat operators
+
+  return atom;
+} // end RegexParser::parseRepeat
 
 //--------------------------------------------------------------------
-void displayLockState()
+bool RegexParser::parseNumber(int& n)
 {
-#ifndef WIN32_CONSOLE     // The Win32 version uses Ctrl & Alt instead
-  if (singleFile) return;
+  if (pos >= regex.length() || !isdigit(regex[pos])) {
+    fail("Invalid repeat count");
+    return false;
+  }
 
-  promptWin.putAttribs(63,1,
-                       ((lockState == lockBottom) ? cCurrentMode : cBackground),
-                       8);
-  promptWin.putAttribs(63,2,
-                       ((lockState == lockTop)    ? cCurrentMode : cBackground),
-                       11);
-#endif
-} // end displayLockState
+  n = 0;
+  while (pos < regex.length() && isdigit(regex[pos])) {
+    n = n * 10 + regex[pos++] - '0';
+    if (n > maxRepeat) {
+      fail("Repeat count too large");
+      return false;
+    }
+  }
+
+  return true;
+} // end RegexParser::parseNumber
 
 //--------------------------------------------------------------------
-// Print a message to stderr and exit:
-//
-// Input:
-//   status:   The exit status to use
-//   message:  The message to print
+// Parse a single character, set, or parenthesized expression:
 
-void exitMsg(int status, const char* message)
+int RegexParser::parseAtom()
 {
-  ConWindow::shutdown();
+  const char  c = regex[pos++];
+
+  switch (c) {
+   case '(': {
+     int  group = parseAlt();
+     if (pos >= regex.length() || regex[pos] != ')')
+       return fail("Missing )");
+     ++pos;
+     return group;
+   }
+
+   case '*': case '+': case '?': case '{':
+    return fail("Nothing to repeat");
+
+   case '[':
+    return parseClass();
+  } // end switch
+
+  int  atom = newNode(RegexNode::rxBytes);
+  ByteSet&  set = nodes[atom].bytes;
+
+  if (c == '.')
+    set.set();
+  else if (c == '\\') {
+    bool  literal;
+    int   code = parseEscape(set, literal);
+    if (code == -2) return -1;
+    if (code >= 0) addChar(set, code, literal);
+  } else
+    addChar(set, Byte(c), true);
+
+  return atom;
+} // end RegexParser::parseAtom
 
-  cerr << endl << message << endl;
-  exit(status);
-} // end exitMsg
+//--------------------------------------------------------------------
+// Parse a bracketed set of bytes:  [...] or [^...]
+
+int RegexParser::parseClass()
+{
+  int  atom = newNode(RegexNode::rxBytes);
+  ByteSet  set;
+
+  const bool  negate = (pos < regex.length() && regex[pos] == '^');
+  if (negate) ++pos;
+
+  bool  first = true;
+
+  for (;;) {
+    if (pos >= regex.length()) return fail("Missing ]");
+
+    char  c = regex[pos++];
+    if (c == ']' && !first) break;
+    first = false;
+
+    bool  literal = true;
+    int   lo = Byte(c);
+
+    if (c == '\\') {
+      lo = parseEscape(set, literal);
+      if (lo == -2) return -1;
+      if (lo == -1) continue;   // It was a set like \d
+    }
+
+    int  hi = lo;
+
+    if (pos + 1 < regex.length() && regex[pos] == '-' && regex[pos+1] != ']') {
+      ++pos;
+      hi = Byte(regex[pos++]);
+      if (hi == '\\') {
+        bool  hiLiteral;
+        hi = parseEscape(set, hiLiteral);
+        if (hi == -2) return -1;
+        if (hi == -1) return fail("Invalid range");
+        literal = literal && hiLiteral;
+      }
+      if (hi < lo) return fail("Invalid range");
+    } // end if range
+
+    for (int i = lo; i <= hi; ++i)
+      addChar(set, i, literal);
+  } // end forever
+
+  if (negate) set.flip();
+
+  nodes[atom].bytes = set;
+
+  return atom;
+} // end RegexParser::parseClass
 
 //--------------------------------------------------------------------
-// Normalize the string in the input window:
-//
-// Does nothing unless splitHex mode is active.
+// Parse an escape sequence (after the backslash):
 //
-// Input:
-//   pos:  The position of the cursor in buf
+// Output:
+//   set:      Escapes like \d add their bytes here
+//   literal:  True if the character should be translated
 //
 // Returns:
-//   true:   The input buffer was changed
-//   false:  No changes were necessary
+//   The character code, or -1 if the bytes were added to set,
+//   or -2 if there was an error
 
-bool InputManager::normalize(int pos)
+int RegexParser::parseEscape(ByteSet& set, bool& literal)
 {
-  if (!splitHex) return false;
-
-  // Change D_ to 0D:
-  if (pos && buf[pos] == ' ' && buf[pos-1] != ' ') {
-    buf[pos] = buf[pos-1];
-    buf[pos-1] = '0';
-    if (pos == len) len += 2;
-    return true;
+  if (pos >= regex.length()) {
+    fail("Trailing \\");
+    return -2;
   }
 
-  // Change _D to 0D:
-  if (pos < len && buf[pos] == ' ' && buf[pos+1] != ' ') {
-    buf[pos] = '0';
-    return true;
-  }
+  literal = true;
+  const char  c = regex[pos++];
 
-  return false;                 // No changes necessary
-} // end InputManager::normalize
+  ByteSet  named;
+  int  i;
+
+  switch (c) {
+   case 'n':  return '\n';
+   case 'r':  return '\r';
+   case 't':  return '\t';
+
+   case 'x':
+    if (pos + 2 > regex.length() ||
+        !isxdigit(regex[pos]) || !isxdigit(regex[pos+1])) {
+      fail("\\x must be followed by 2 hex digits");
+      return -2;
+    }
+    literal = false;
+    pos += 2;
+    return strtoul(regex.substr(pos - 2, 2).c_str(), NULL, 16);
+
+   case 'd': case 'D':
+    for (i = '0'; i <= '9'; ++i) addChar(named, i, true);
+    break;
+
+   case 's': case 'S':
+    for (i = 0; i < 256; ++i)
+      if (isspace(i)) addChar(named, i, true);
+    break;
+
+   case 'w': case 'W':
+    for (i = 0; i < 256; ++i)
+      if (isalnum(i) || i == '_') addChar(named, i, true);
+    break;
+
+   default:
+    if (isalnum(c)) {
+      fail("Unknown escape sequence");
+      return -2;
+    }
+    return Byte(c);
+  } // end switch
+
+  if (isupper(c)) named.flip();
+  set |= named;
+
+  return -1;
+} // end RegexParser::parseEscape
 
 //--------------------------------------------------------------------
-// Get a string using inWin:
+// Build a Thompson NFA from a tree of RegexNodes:
 //
-// Input:
-//   buf:       The buffer where the string will be stored
-//   maxLen:    The maximum number of chars to accept (not including NUL byte)
-//   history:   The history vector to use
-//   restrict:  If not NULL, accept only chars in this string
-//   upcase:    If true, convert all chars with safeUC
+// Each state matches one set of bytes (leading to out), or has only
+// epsilon transitions, or is the match state.  The NFA is built from
+// the end of the expression backwards, so each subexpression knows
+// where it leads.  A reversed NFA (for finding the start of a match)
+// simply builds concatenations in the opposite order.
 
-void getString(char* buf, int maxLen, StrVec& history,
-               const char* restrict=NULL,
-               bool upcase=false, bool splitHex=false)
+struct NfaState
 {
-  InputManager  manager(buf, maxLen, history);
+  ByteSet      bytes;           // The bytes that lead to out
+  int          out;             // The state after a byte (-1 if none)
+  vector<int>  eps;             // The states reachable without input
+  bool         match;           // True for the match state
+}; // end NfaState
 
-  manager.setCharacters(restrict);
-  manager.setSplitHex(splitHex);
-  manager.setUpcase(upcase);
+class NfaBuilder
+{
+ public:
+  vector<NfaState>  states;
 
-  manager.run();
-} // end getString
+  NfaBuilder(const vector<RegexNode>& aNodes, bool aReversed)
+    : nodes(aNodes), reversed(aReversed) {};
+  int  build(int node, int next);
+  int  newState(int out=-1);
+
+ protected:
+  const vector<RegexNode>&  nodes;
+  bool                      reversed;
+}; // end NfaBuilder
+
+int NfaBuilder::newState(int out)
+{
+  if (int(states.size()) >= maxNfaStates) return -1;
+
+  states.push_back(NfaState());
+  states.back().out   = out;
+  states.back().match = false;
+
+  return states.size() - 1;
+} // end NfaBuilder::newState
 
 //--------------------------------------------------------------------
-// Construct the InputManager object:
+// Build the states for a subexpression:
 //
 // Input:
-//   aBuf:      The buffer where the string will be stored
-//   aMaxLen:   The maximum number of chars to accept (not including NUL byte)
-//   aHistory:  The history vector to use
+//   node:  The subexpression
+//   next:  The state to go to after matching it
+//
+// Returns:
+//   The start state for the subexpression (-1 if the NFA is too big)
 
-InputManager::InputManager(char* aBuf, int aMaxLen, StrVec& aHistory)
-: buf(aBuf),
-  restrict(NULL),
-  history(aHistory),
-  historyPos(aHistory.size()),
-  maxLen(aMaxLen),
-  len(0),
-  i(0),
-  upcase(false),
-  splitHex(false),
-  insert(true)
+int NfaBuilder::build(int node, int next)
 {
-} // end InputManager
+  if (next < 0) return -1;
+
+  const RegexNode&  n = nodes[node];
+  int  state, i;
+
+  switch (n.type) {
+   case RegexNode::rxBytes:
+    state = newState(next);
+    if (state >= 0) states[state].bytes = n.bytes;
+    return state;
+
+   case RegexNode::rxConcat:
+    if (reversed)
+      for (i = 0; i < int(n.kids.size()); ++i)
+        next = build(n.kids[i], next);
+    else
+      for (i = n.kids.size() - 1; i >= 0; --i)
+        next = build(n.kids[i], next);
+    return next;
+
+   case RegexNode::rxAlt:
+    if ((state = newState()) < 0) return -1;
+    for (i = 0; i < int(n.kids.size()); ++i) {
+      int  kid = build(n.kids[i], next);
+      if (kid < 0) return -1;
+      states[state].eps.push_back(kid);
+    }
+    return state;
+
+   case RegexNode::rxRepeat:
+    if (n.max < 0) {
+      // The loop state either matches again or moves on:
+      if ((state = newState()) < 0) return -1;
+      int  kid = build(n.kids[0], state);
+      if (kid < 0) return -1;
+      states[state].eps.push_back(kid);
+      states[state].eps.push_back(next);
+    } else {
+      // Each optional copy either matches or skips to the end:
+      state = next;
+      for (i = n.min; i < n.max; ++i) {
+        int  kid = build(n.kids[0], state);
+        int  skip = newState();
+        if (kid < 0 || skip < 0) return -1;
+        states[skip].eps.push_back(kid);
+        states[skip].eps.push_back(next);
+        state = skip;
+      }
+    } // end else limited repeat count
+
+    for (i = 0; i < n.min; ++i)
+      state = build(n.kids[0], state);
+    return state;
+  } // end switch
+
+  return -1;                    // Never happens
+} // end NfaBuilder::build
 
 //--------------------------------------------------------------------
-// Run the main loop to get an input string:
+// Compute the epsilon closure of a set of NFA states:
 //
-// Returns:
-//   true:   Enter was pressed
-//   false:  Escape was pressed
+// Only states that consume a byte or match are kept, because the
+// others don't affect how the DFA state behaves.
+//
+// Input:
+//   nfa:  The NFA
+//   set:  The states to start from
+//
+// Output:
+//   set:  The closure (sorted)
 
-bool InputManager::run()
+void nfaClosure(const vector<NfaState>& nfa, vector<int>& set)
 {
-  inWin.setCursor(2,1);
+  vector<char>  seen(nfa.size(), false);
+  vector<int>   stack(set);
 
-  bool  inWinShown = false;
-  bool  done   = false;
-  bool  aborted = true;
+  set.clear();
 
-  ConWindow::showCursor(insert);
+  while (!stack.empty()) {
+    int  s = stack.back();
+    stack.pop_back();
+    if (seen[s]) continue;
+    seen[s] = true;
 
-  memset(buf, ' ', maxLen);
-  buf[maxLen] = '\0';
+    if (nfa[s].out >= 0 || nfa[s].match) set.push_back(s);
 
-  // We need to be able to display complete bytes:
-  if (splitHex && (maxLen % 3 == 1)) --maxLen;
+    stack.insert(stack.end(), nfa[s].eps.begin(), nfa[s].eps.end());
+  } // end while more states to visit
 
-  // Main input loop:
-  while (!done) {
-    inWin.put(2,1,buf);
-    if (inWinShown) inWin.update(1); // Only update inside the box
-    else { inWin.update();   inWinShown = true; } // Show the input window
-    inWin.setCursor(2+i,1);
-    int key = inWin.readKey();
-    if (upcase) key = safeUC(key);
+  sort(set.begin(), set.end());
+} // end nfaClosure
 
-    switch (key) {
-     case KEY_ESCAPE:  buf[0] = '\0';  done = true;  break; // ESC
+//--------------------------------------------------------------------
+// Divide the bytes into classes that no NFA state distinguishes:
+//
+// Input:
+//   nfa:  The NFA
+//
+// Output:
+//   byteClass:  The class of each byte
+//   classByte:  One byte from each class
+//
+// Returns:
+//   The number of classes
 
-     case KEY_RETURN:           // Enter
-      normalize(i);
-      buf[len] = '\0';
-      done = true;
-      aborted = false;
-      break;
+int nfaByteClasses(const vector<NfaState>& nfa,
+                   vector<int>& byteClass, vector<int>& classByte)
+{
+  int  b;
+  int  numClasses = 1;
+
+  byteClass.assign(256, 0);
+
+  for (VecSize s = 0; s < nfa.size(); ++s) {
+    if (nfa[s].out < 0) continue;
+    map<pair<int,bool>, int>  split;
+    for (b = 0; b < 256; ++b) {
+      pair<int,bool>  key(byteClass[b], nfa[s].bytes[b]);
+      map<pair<int,bool>, int>::iterator  c = split.find(key);
+      if (c == split.end())
+        c = split.insert(make_pair(key, int(split.size()))).first;
+      byteClass[b] = c->second;
+    }
+    numClasses = split.size();
+  } // end for each NFA state
 
-     case KEY_BACKSPACE:
-     case KEY_DELETE:           // Backspace on most Unix terminals
-     case 0x08:                 // Backspace (Ctrl-H)
-      if (!i) continue; // Can't back up if we're at the beginning already
-      if (splitHex) {
-        if ((i % 3) == 0) {
-          // At the beginning of a byte; erase last digit of previous byte:
-          if (i == len) len -= 2;
-          i -= 2;
-          buf[i] = ' ';
-        } else if (i < len && buf[i] != ' ') {
-          // On the second digit; erase the first digit:
-          buf[--i] = ' ';
-        } else {
-          // On a blank second digit; delete the entire byte:
-          buf[--i] = ' ';
-          memmove(buf + i, buf + i + 3, maxLen - i - 3);
-          len -= 3;
-          if (len < i) len = i;
-        }
-      } else { // not splitHex mode
-        memmove(buf + i - 1, buf + i, maxLen - i);
-        buf[maxLen-1] = ' ';
-        --len;  --i;
-      } // end else not splitHex mode
-      break;
+  classByte.assign(numClasses, 0);
+  for (b = 255; b >= 0; --b)
+    classByte[byteClass[b]] = b;
 
-     case 0x04:                 // Ctrl-D
-     case KEY_DC:
-      if (i >= len) continue;
-      if (splitHex) {
-        i -= i%3;
-        memmove(buf + i, buf + i + 3, maxLen - i - 3);
-        len -= 3;
-        if (len < i) len = i;
-      } else {
-        memmove(buf + i, buf + i + 1, maxLen - i - 1);
-        buf[maxLen-1] = ' ';
-        --len;
-      } // end else not splitHex mode
-      break;
+  return numClasses;
+} // end nfaByteClasses
 
-     case KEY_IC:
-      insert = !insert;
-      ConWindow::showCursor(insert);
-      break;
+//--------------------------------------------------------------------
+// Convert an NFA to a DFA by subset construction:
+//
+// DFA state 0 is the dead state, and state 1 is the start state.
+// The DFA is anchored; a match must begin where it starts.
+//
+// Input:
+//   nfa:    The NFA
+//   start:  The NFA start state
+//
+// Output:
+//   dfa:  The DFA
+//
+// Returns:
+//   true:   Success
+//   false:  The DFA would be too large
 
-     case 0x02:                 // Ctrl-B
-     case KEY_LEFT:
-      if (i) {
-        --i;
-        if (splitHex) {
-          normalize(i+1);
-          if (i % 3 == 2) --i;
-        }
+bool buildDfa(const vector<NfaState>& nfa, int start, RegexSearch::Dfa& dfa)
+{
+  // Bytes that no NFA state distinguishes can share one computation:
+  int  i;
+  vector<int>  byteClass, classByte;
+  const int  numClasses = nfaByteClasses(nfa, byteClass, classByte);
+
+  // Construct the DFA states:
+  map<vector<int>, int>  ids;
+  vector< vector<int> >  sets(2);
+
+  sets[1].push_back(start);
+  nfaClosure(nfa, sets[1]);
+  ids[sets[0]] = 0;
+  ids[sets[1]] = 1;
+
+  dfa.trans.assign(2 * 256, 0);
+  dfa.accept.assign(2, false);
+
+  for (VecSize q = 1; q < sets.size(); ++q) {
+    for (VecSize s = 0; s < sets[q].size(); ++s)
+      if (nfa[sets[q][s]].match) dfa.accept[q] = true;
+
+    for (int c = 0; c < numClasses; ++c) {
+      const Byte  rep = classByte[c];
+      vector<int>  next;
+
+      for (VecSize s = 0; s < sets[q].size(); ++s) {
+        const NfaState&  state = nfa[sets[q][s]];
+        if (state.out >= 0 && state.bytes[rep])
+          next.push_back(state.out);
+      }
+      nfaClosure(nfa, next);
+
+      map<vector<int>, int>::iterator  id = ids.find(next);
+      if (id == ids.end()) {
+        if (int(sets.size()) >= maxDfaStates) return false;
+        id = ids.insert(make_pair(next, int(sets.size()))).first;
+        sets.push_back(next);
+        dfa.trans.resize(sets.size() * 256, 0);
+        dfa.accept.push_back(false);
       }
-      break;
 
-     case 0x06:                 // Ctrl-F
-     case KEY_RIGHT:
-      if (i < len) {
-        ++i;
-        if (splitHex) {
-          normalize(i-1);
-          if ((i < maxLen) && (i % 3 == 2)) ++i;
+      for (i = 0; i < 256; ++i)
+        if (byteClass[i] == c) dfa.trans[q * 256 + i] = id->second;
+    } // end for each byte class
+  } // end for each DFA state
+
+  return true;
+} // end buildDfa
+
+//--------------------------------------------------------------------
+// Build the DFA that finds the end of the leftmost match:
+//
+// Each DFA state is a list of groups of NFA states, one group for
+// each start position that is still alive, earliest first.  An NFA
+// state is kept only in the earliest group that reached it, because
+// a later start could only find the same matches further right.  A
+// new group starts at every byte until some group matches; then the
+// groups after it are dropped and no more are started.  The last
+// accepting position before the DFA dies is therefore the end of the
+// longest match that starts leftmost.
+//
+// In the key for a DFA state, element 0 is 1 once a match has been
+// seen, and -1 separates the groups.  DFA state 0 is the dead state
+// (a match was seen and no group is left), and state 1 is the start
+// state.
+//
+// Input:
+//   nfa:    The NFA
+//   start:  The NFA start state
+//
+// Output:
+//   dfa:  The DFA
+//
+// Returns:
+//   true:   Success
+//   false:  The DFA would be too large
+
+bool buildLeftmostDfa(const vector<NfaState>& nfa, int start,
+                      RegexSearch::Dfa& dfa)
+{
+  int  i;
+  vector<int>  byteClass, classByte;
+  const int  numClasses = nfaByteClasses(nfa, byteClass, classByte);
+
+  map<vector<int>, int>  ids;
+  vector< vector<int> >  keys(2);
+
+  vector<int>  first(1, start);
+  nfaClosure(nfa, first);
+
+  keys[0].push_back(1);
+  keys[1].push_back(0);
+  keys[1].insert(keys[1].end(), first.begin(), first.end());
+  ids[keys[0]] = 0;
+  ids[keys[1]] = 1;
+
+  dfa.trans.assign(2 * 256, 0);
+  dfa.accept.assign(2, false);
+
+  for (VecSize q = 1; q < keys.size(); ++q) {
+    for (VecSize k = 1; k < keys[q].size(); ++k)
+      if (keys[q][k] >= 0 && nfa[keys[q][k]].match) dfa.accept[q] = true;
+
+    for (int c = 0; c < numClasses; ++c) {
+      const Byte  rep = classByte[c];
+      const vector<int>  key(keys[q]); // keys may grow below
+
+      // Advance each group, and start a new one if no match was seen:
+      vector< vector<int> >  groups(1);
+      for (VecSize k = 1; k < key.size(); ++k) {
+        if (key[k] < 0)
+          groups.push_back(vector<int>());
+        else {
+          const NfaState&  state = nfa[key[k]];
+          if (state.out >= 0 && state.bytes[rep])
+            groups.back().push_back(state.out);
+        }
+      } // end for each NFA state in key
+
+      if (!key[0]) groups.push_back(vector<int>(1, start));
+
+      // Keep each NFA state in the earliest group, and drop the groups
+      // after the first one that matches:
+      vector<int>   next(1, key[0]);
+      vector<char>  seen(nfa.size(), false);
+
+      for (VecSize g = 0; g < groups.size(); ++g) {
+        nfaClosure(nfa, groups[g]);
+        bool  empty   = true;
+        bool  matched = false;
+        for (VecSize k = 0; k < groups[g].size(); ++k) {
+          const int  s = groups[g][k];
+          if (seen[s]) continue;
+          seen[s] = true;
+          if (empty && next.size() > 1) next.push_back(-1);
+          empty = false;
+          next.push_back(s);
+          if (nfa[s].match) matched = true;
         }
+        if (matched) {
+          next[0] = 1;
+          break;
+        }
+      } // end for each group
+
+      map<vector<int>, int>::iterator  id = ids.find(next);
+      if (id == ids.end()) {
+        if (int(keys.size()) >= maxDfaStates) return false;
+        id = ids.insert(make_pair(next, int(keys.size()))).first;
+        keys.push_back(next);
+        dfa.trans.resize(keys.size() * 256, 0);
+        dfa.accept.push_back(false);
       }
-      break;
 
-     case 0x0B:                 // Ctrl-K
-      if (len > i) {
-        memset(buf + i, ' ', len - i);
-        len = i;
+      for (i = 0; i < 256; ++i)
+        if (byteClass[i] == c) dfa.trans[q * 256 + i] = id->second;
+    } // end for each byte class
+  } // end for each DFA state
+
+  return true;
+} // end buildLeftmostDfa
+
+//--------------------------------------------------------------------
+// Compile a regular expression:
+//
+// Input:
+//   regex:  The regular expression
+//
+// Output:
+//   error:  The error message (if unsuccessful)
+//
+// Returns:
+//   true:   The expression compiled successfully
+//   false:  The expression is invalid or too complex
+
+bool RegexSearch::compile(const String& regex, String& error)
+{
+  RegexParser  parser(regex, ((displayTable == ebcdicDisplayTable)
+                              ? ascii2ebcdicTable : NULL));
+
+  int  root = parser.parse();
+  if (root < 0) {
+    error = parser.error;
+    return false;
+  }
+
+  for (int pass = 0; pass < 2; ++pass) {
+    const bool  reversed = (pass == 1);
+    NfaBuilder  nfa(parser.nodes, reversed);
+
+    int  match = nfa.newState();
+    nfa.states[match].match = true;
+
+    int  start = nfa.build(root, match);
+    if (start < 0) {
+      error = "Expression is too complex";
+      return false;
+    }
+
+    if (!reversed) {
+      vector<int>  empty(1, start);
+      nfaClosure(nfa.states, empty);
+      if (binary_search(empty.begin(), empty.end(), match)) {
+        error = "Expression matches an empty string";
+        return false;
       }
-      break;
+    } // end if forward pass
 
-     case 0x01:                 // Ctrl-A
-     case KEY_HOME:
-      normalize(i);
-      i = 0;
-      break;
+    if (!(reversed
+          ? buildDfa(nfa.states, start, reverse)
+          : buildLeftmostDfa(nfa.states, start, search))) {
+      error = "Expression is too complex";
+      return false;
+    }
+  } // end for forward & reverse passes
 
-     case 0x05:                 // Ctrl-E
-     case KEY_END:
-      if (splitHex && (i < len))
-        normalize(i);
-      i = len;
-      break;
+  return true;
+} // end RegexSearch::compile
 
-     case 0x10:                 // Ctrl-P
-     case KEY_UP:
-      if (historyPos == 0) beep();
-      else                 useHistory(-1);
-      break;
+//--------------------------------------------------------------------
+// Report every (non-overlapping) match:
+//
+// Each pass runs the leftmost DFA from the end of the previous match
+// until it dies, so it can tell whether a longer match is coming.
+// That lookahead can run a long way past the match (to the end of the
+// file for a.*c when there is no c).  But once a pass is in the same
+// state at the same position as an earlier pass was after its last
+// match, it can't match again either, so it stops there.  Those
+// states are kept for every position near the last match (trail) and
+// for every markGap'th position beyond it (marks), so a pass never
+// rescans more than markGap bytes of an earlier pass's lookahead.
+// The block buffer is kept between passes, so dense matches don't
+// re-read the file either.
+//
+// Input:
+//   doc:      The document to search
+//   start:    The position where the search should begin
+//   handler:  Receives the matches
 
-     case 0x0E:                 // Ctrl-N
-     case KEY_DOWN:
-      if (historyPos == history.size()) beep();
-      else                              useHistory(+1);
-      break;
+void RegexSearch::scan(const Document& doc, FPos start,
+                       MatchHandler& handler) const
+{
+  const int  blockSize = 64 * 1024;
+  const int  maxTrail  = 64 * 1024;
+  const int  markGap   = 64 * 1024; // Must be a power of 2
+  Byte *const  searchBuf = new Byte[blockSize];
+  Byte *const  matchBuf  = new Byte[blockSize];
+
+  const int *const   table  = &search.trans[0];
+  const char *const  accept = &search.accept[0];
+
+  FPos  bufPos = start;         // The position of searchBuf[0]
+  int   bufLen = 0;             // The number of bytes in searchBuf
+
+  // trail[i] is a state at trailPos + i, and marks[i] is a state at
+  // (markBase + i) * markGap (or -1 if unknown).  The first of each
+  // may be the accepting state where a lookahead began.  newTrail and
+  // newMarks are what the current pass has seen since its last match:
+  vector<int>  trail, marks, newTrail, newMarks;
+  FPos  trailPos = 0, markBase = 0, newTrailPos = 0, newMarkBase = 0;
+
+  Match  match;
+  match.which = 0;
+
+  FPos  pos = start;
+
+  while (pos <= handler.stopAfter) {
+    // Find the end of the leftmost match:
+    FPos  end = -1;
+    FPos  here = pos;
+    int   state = 1;
+    bool  converged = false;
+
+    while (state && !converged && pos <= handler.stopAfter) {
+      if (here < bufPos || here >= bufPos + bufLen) {
+        bufPos = here;
+        bufLen = max(doc.read(here, searchBuf, blockSize), 0);
+        if (!bufLen) break;     // End of file
+        handler.scanned(bufPos + bufLen);
+      }
 
-     default:
-      if (isprint(key) && (!restrict || strchr(restrict, key))) {
-        if (insert) {
-          if (splitHex) {
-            if (buf[i] == ' ') {
-              if (i >= maxLen) continue;
-            } else {
-              if (len >= maxLen) continue;
-              i -= i % 3;
-              memmove(buf + i + 3, buf + i, maxLen - i - 3);
-              buf[i+1] = ' ';
-              len += 3;
-            }
-          } // end if splitHex mode
-          else {
-            if (len >= maxLen) continue;
-            memmove(buf + i + 1, buf + i, maxLen - i - 1);
-            ++len;
-          } // end else not splitHex mode
-        } else { // overstrike mode
-          if (i >= maxLen) continue;
-        } // end else overstrike mode
-        buf[i++] = key;
-        if (splitHex && (i < maxLen) && (i % 3 == 2))
-          ++i;
-        if (i > len) len = i;
-      } // end if is acceptable character to insert
-    } // end switch key
-  } // end while not done
+      // Where trail[0] and the next mark are (relative to searchBuf):
+      const FPos  trailAt  = trailPos - bufPos;
+      const FPos  trailEnd = trailAt + FPos(trail.size());
+      FPos        nextMark = (bufPos / markGap + 1) * markGap - bufPos;
+
+      int  i;
+      for (i = int(here - bufPos); i < bufLen; ++i) {
+        state = table[state * 256 + searchBuf[i]];
+        if (accept[state]) {
+          end = bufPos + i + 1;
+          newTrail.clear();
+          newTrailPos = end;
+          newMarks.clear();
+          newMarkBase = (end - 1) / markGap + 1;
+        } else if (!state)
+          break;                // No earlier or longer match possible
+        else if (i + 1 > trailAt && i + 1 < trailEnd) {
+          if (trail[i + 1 - trailAt] == state) {
+            converged = true;   // No more matches ahead
+            break;
+          }
+        } else if (i + 1 == nextMark) {
+          const FPos  m = (bufPos + i + 1) / markGap - markBase;
+          if (m >= 0 && m < FPos(marks.size()) && marks[m] == state) {
+            converged = true;   // No more matches ahead
+            break;
+          }
+        }
 
-  // Hide the input window & cursor:
-  ConWindow::hideCursor();
-  inWin.hide();
+        if (i + 1 == nextMark) {
+          nextMark += markGap;
+          if (end >= 0) newMarks.push_back(state);
+        }
+        if (end >= 0 && newTrail.size() < VecSize(maxTrail))
+          newTrail.push_back(state);
+      } // end for each byte in buffer
 
-  // Record the result in the history:
-  if (!aborted && len) {
-    String  newValue(buf);
+      here = bufPos + (i < bufLen ? i + 1 : i); // Just past the last byte
+    } // end while DFA still running
 
-    SVItr  exists = find(history.begin(), history.end(), newValue);
-    if (exists != history.end())
-      // Already in history.  Move it to the end:
-      rotate(exists, exists + 1, history.end());
-    else if (history.size() >= maxHistory) {
-      // History is full.  Replace the first entry & move it to the end:
-      history.front().swap(newValue);
-      rotate(history.begin(), history.begin() + 1, history.end());
-    } else
-      // Just append to history:
-      history.push_back(newValue);
-  } // end if we have a value to store in the history
+    if (end < 0) break;         // No more matches
 
-  return !aborted;
-} // end run
+    // Add what this pass saw to what earlier passes saw:
+    FPos  at = newTrailPos - trailPos;
+    if (at < 0 || at > FPos(trail.size())) {
+      trail.swap(newTrail);
+      trailPos = newTrailPos;
+    } else {
+      if (FPos(trail.size()) < at + FPos(newTrail.size()))
+        trail.resize(at + newTrail.size());
+      copy(newTrail.begin(), newTrail.end(), trail.begin() + at);
+      if (at >= maxTrail) {
+        trail.erase(trail.begin(), trail.begin() + at);
+        trailPos = newTrailPos;
+      }
+    } // end else this pass's trail joins the old one
+
+    at = newMarkBase - markBase;
+    if (at < 0 || at > FPos(marks.size())) {
+      marks.swap(newMarks);
+      markBase = newMarkBase;
+    } else {
+      if (FPos(marks.size()) < at + FPos(newMarks.size()))
+        marks.resize(at + newMarks.size(), -1);
+      copy(newMarks.begin(), newMarks.end(), marks.begin() + at);
+    } // end else this pass's marks join the old ones
+
+    // Find where it starts:
+    match.pos = matchStart(doc, end, pos, searchBuf, bufPos, bufLen,
+                           matchBuf);
+    if (match.pos > handler.stopAfter) break;
+
+    match.length = int(min(end - match.pos, FPos(INT_MAX)));
+
+    handler.found(match);
+
+    pos = end;
+  } // end while matches might be wanted
+
+  delete [] matchBuf;
+  delete [] searchBuf;
+} // end RegexSearch::scan
 
 //--------------------------------------------------------------------
-// Switch the current input line with one from the history:
+// Find the leftmost start of a match that ends at a position:
 //
 // Input:
-//   delta:  The number to add to historyPos (-1 previous, +1 next)
+//   doc:       The document to search
+//   end:       The position just past the end of the match
+//   limit:     The match may not start before this position
+//   block:     Bytes already read from doc (used instead of reading
+//              when they cover the part being examined)
+//   blockPos:  The position of block[0]
+//   blockLen:  The number of bytes in block
+//   buf:       A buffer of 64K bytes
+//
+// Returns:
+//   The position of the first byte of the match (or -1 if none)
 
-void InputManager::useHistory(int delta)
+FPos RegexSearch::matchStart(const Document& doc, FPos end, FPos limit,
+                             const Byte* block, FPos blockPos, int blockLen,
+                             Byte* buf) const
 {
-  // Clean up the current string if necessary:
-  normalize(i);
+  const int  blockSize = 64 * 1024;
 
-  // Update the history overlay if necessary:
-  //   We always store the initial value, because it doesn't
-  //   correspond to a valid entry in history.
-  if (len || historyPos == history.size())
-    historyOverlay[historyPos].assign(buf, len);
+  FPos  best = -1;
+  FPos  pos  = end;
+  int   state = 1;
 
-  // Look for an entry in the overlay:
-  SMItr itr = historyOverlay.find(historyPos += delta);
+  while (pos > limit) {
+    const int  count = int(min(pos - limit, FPos(blockSize)));
+    const Byte*  bytes = buf;
+
+    pos -= count;
+    if (pos >= blockPos && pos + count <= blockPos + blockLen)
+      bytes = block + (pos - blockPos);
+    else if (doc.read(pos, buf, count) != count)
+      break;
+
+    for (int i = count - 1; i >= 0; --i) {
+      state = reverse.trans[state * 256 + bytes[i]];
+      if (!state) return best;  // No earlier start possible
+      if (reverse.accept[state]) best = pos + i;
+    }
+  } // end while more to read
+
+  return best;
+} // end RegexSearch::matchStart
+
+//====================================================================
+// Class MatchIndex:
+//
+// Records the position of every match in a file.  Each match is
+// stored as the distance from the previous match, followed by its
+// length and pattern number, all as variable-length numbers (7 bits
+// per byte).  Most matches therefore need only 3 or 4 bytes.  The
+// position of every checkInterval'th match is kept separately, so
+// any match can be found without decoding the whole index.
+//
+// Member Variables:
+//   data:
+//     The encoded matches
+//   checkPos, checkAt:
+//     The position of every checkInterval'th match, and the offset
+//     in data where it is stored
+//   count:
+//     The number of matches
+//   lastPos:
+//     The position of the most recently added match
+//   maxLength:
+//     The length of the longest match
+//
+//--------------------------------------------------------------------
+
+const VecSize  checkInterval = 128;
+
+//--------------------------------------------------------------------
+// Constructor:
+
+MatchIndex::MatchIndex()
+: count(0),
+  lastPos(0),
+  maxLength(0)
+{
+} // end MatchIndex::MatchIndex
+
+//--------------------------------------------------------------------
+// Add a match to the index:
+//
+// Matches must be added in order of position.
+
+void MatchIndex::add(const Match& match)
+{
+  if (count % checkInterval == 0) {
+    checkPos.push_back(match.pos);
+    checkAt.push_back(data.size());
+    lastPos = match.pos;
+  }
+
+  putNumber(data, match.pos - lastPos);
+  putNumber(data, match.length);
+  putNumber(data, match.which);
+
+  lastPos = match.pos;
+  maxLength = max(maxLength, match.length);
+  ++count;
+} // end MatchIndex::add
+
+//--------------------------------------------------------------------
+// Find the matches that start in a range of positions:
+//
+// Input:
+//   from:  The first position of interest
+//   to:    The position just past the range
+//
+// Output:
+//   found:  The matches starting between from and to
+//
+// Returns:
+//   The index of the first match in found (or of the first match
+//   after from, if found is empty)
+
+VecSize MatchIndex::find(FPos from, FPos to, vector<Match>& found) const
+{
+  found.clear();
+
+  VecSize  first = lowerBound(from);
+  if (first >= count) return first;
+
+  VecSize  n = first - first % checkInterval;
+  const Byte*  in = &data[checkAt[n / checkInterval]];
+  FPos  pos = checkPos[n / checkInterval];
+
+  for (; n < count; ++n) {
+    if (n % checkInterval == 0) {
+      pos = checkPos[n / checkInterval];
+      in  = &data[checkAt[n / checkInterval]];
+    }
+
+    Match  match;
+    match.pos    = (pos += getNumber(in));
+    match.length = int(getNumber(in));
+    match.which  = int(getNumber(in));
+
+    if (match.pos >= to) break;
+    if (n >= first) found.push_back(match);
+  } // end for matches in range
+
+  return first;
+} // end MatchIndex::find
+
+//--------------------------------------------------------------------
+// Return a match by number:
+//
+// Input:
+//   n:  The match number (0 is the first match)
+
+Match MatchIndex::get(VecSize n) const
+{
+  const Byte*  in  = &data[checkAt[n / checkInterval]];
+  FPos         pos = checkPos[n / checkInterval];
+  Match        match;
+
+  for (VecSize i = n % checkInterval + 1; i > 0; --i) {
+    match.pos    = (pos += getNumber(in));
+    match.length = int(getNumber(in));
+    match.which  = int(getNumber(in));
+  }
+
+  return match;
+} // end MatchIndex::get
+
+//--------------------------------------------------------------------
+// Find the first match at or after a position:
+//
+// Returns:
+//   The number of matches that start before pos
+
+VecSize MatchIndex::lowerBound(FPos pos) const
+{
+  VecSize  c = lower_bound(checkPos.begin(), checkPos.end(), pos)
+               - checkPos.begin();
+
+  if (!c) return 0;             // Every match starts at or after pos
+
+  // The answer is within checkpoint c-1's block (or is the start of
+  // block c):
+  --c;
+  VecSize  n = c * checkInterval;
+  const Byte*  in = &data[checkAt[c]];
+  FPos  p = checkPos[c];
+
+  for (; n < count && n < (c + 1) * checkInterval; ++n) {
+    p += getNumber(in);
+    if (p >= pos) break;
+    getNumber(in);              // Skip length
+    getNumber(in);              // Skip pattern number
+  }
+
+  return n;
+} // end MatchIndex::lowerBound
+
+//--------------------------------------------------------------------
+// Encode a number (7 bits per byte, high bit means more follow):
+
+void MatchIndex::putNumber(vector<Byte>& out, FPos n)
+{
+  while (n >= 0x80) {
+    out.push_back(Byte(n & 0x7F) | 0x80);
+    n >>= 7;
+  }
+
+  out.push_back(Byte(n));
+} // end MatchIndex::putNumber
+
+//--------------------------------------------------------------------
+// Decode a number encoded by putNumber:
+
+FPos MatchIndex::getNumber(const Byte*& in)
+{
+  FPos  n = 0;
+  int   shift = 0;
+
+  while (*in & 0x80) {
+    n |= FPos(*(in++) & 0x7F) << shift;
+    shift += 7;
+  }
+
+  return n | (FPos(*(in++)) << shift);
+} // end MatchIndex::getNumber
+
+//--------------------------------------------------------------------
+// Build a MatchIndex from the matches reported by a Searcher:
+//
+// A Searcher may report a match that starts before one it already
+// reported (by up to its lookBehind distance), so matches are held
+// until no earlier match can arrive.
+
+class IndexBuilder : public MatchHandler
+{
+ public:
+  IndexBuilder(MatchIndex& aIndex, int aLookBehind)
+    : index(aIndex), lookBehind(aLookBehind) {};
+  virtual void found(const Match& match);
+  void         finish();
+
+ protected:
+  MatchIndex&             index;
+  int                     lookBehind;
+  multimap<FPos, Match>  pending;
+}; // end IndexBuilder
+
+void IndexBuilder::found(const Match& match)
+{
+  pending.insert(make_pair(match.pos, match));
+
+  // Later matches can't start before this:
+  const FPos  safe = match.pos + match.length - lookBehind;
+
+  while (!pending.empty() && pending.begin()->first < safe) {
+    index.add(pending.begin()->second);
+    pending.erase(pending.begin());
+  }
+} // end IndexBuilder::found
+
+void IndexBuilder::finish()
+{
+  for (multimap<FPos, Match>::const_iterator m = pending.begin();
+       m != pending.end(); ++m)
+    index.add(m->second);
+
+  pending.clear();
+} // end IndexBuilder::finish
+
+//====================================================================
+// Class Document:
+//
+// A piece table: the file as edited is a list of pieces, each of
+// which is a span of the original file, of the bytes typed by the
+// user, or of a file that bytes were copied from.  Inserting,
+// deleting, or copying bytes only splits and rearranges pieces, so it
+// is instant no matter how large the files are, and no file is
+// touched until the changes are saved.  The cost of every operation
+// depends on the number of pieces, not the size of the file.
+//
+// Member Variables:
+//   added:
+//     Every byte typed by the user (or added to fill a gap past the
+//     end of the file).  Bytes are only appended, never changed, so
+//     the undo history can refer to them.
+//   files:
+//     files[srcFile] is the file being edited (which the Document
+//     does not own).  The rest are duplicate handles for files that
+//     bytes were copied from, which stay open until reset.  Because
+//     they refer to the file that was open at the time, they still
+//     see the same bytes if that file is replaced by a new one.
+//   fileLength:
+//     The size of the file itself
+//   length:
+//     The size of the document (the sum of the piece lengths)
+//   pieces:
+//     The document in order.  Adjacent pieces that are contiguous in
+//     the same source are always joined, so an unmodified document
+//     is a single piece covering the file (or no pieces if empty).
+//   undoList:
+//     Every change made, oldest first.  The changes made by one
+//     command form a step, which is undone as a unit.
+//   redoList:
+//     The changes undone, most recently undone last.  It is cleared
+//     whenever a new change is made.
+//   inStep:
+//     True if the next change belongs to the current step
+//
+//--------------------------------------------------------------------
+
+const FPos  copyChunk = 16 * 1024 * 1024; // Copied between progress updates
+
+//--------------------------------------------------------------------
+// Constructor:
+
+Document::Document()
+: files(1, InvalidFile),
+  fileLength(0),
+  length(0),
+  inStep(false)
+{
+} // end Document::Document
+
+//--------------------------------------------------------------------
+// Destructor:
+
+Document::~Document()
+{
+  for (VecSize i = srcFile + 1; i < files.size(); ++i)
+    CloseFile(files[i]);
+} // end Document::~Document
+
+//--------------------------------------------------------------------
+// Add bytes to the added buffer:
+//
+// Input:
+//   gap:    The number of zero bytes to add first
+//   value:  The byte to add after them
+//
+// Returns:
+//   A piece containing the new bytes
+
+Document::Piece Document::add(FPos gap, Byte value)
+{
+  Piece  p;
+  p.start  = added.size();
+  p.length = gap + 1;
+  p.source = srcAdded;
+
+  added.insert(added.end(), VecSize(gap), Byte(0));
+  added.push_back(value);
+
+  return p;
+} // end Document::add
+
+//--------------------------------------------------------------------
+// Find or open a file to copy bytes from:
+//
+// Input:
+//   file:  A file belonging to another Document
+//
+// Returns:
+//   The index of the same file in files (-1 if it could not be opened)
+
+short Document::borrow(File file)
+{
+  for (VecSize i = 0; i < files.size(); ++i)
+    if (SameFile(files[i], file)) return i;
+
+  const File  dup = DupFile(file);
+  if (dup == InvalidFile) return -1;
+
+  files.push_back(dup);
+  return files.size() - 1;
+} // end Document::borrow
+
+//--------------------------------------------------------------------
+// Replace bytes and record the change for undo:
+//
+// The change becomes part of the current step.  Call nextStep to
+// start a new one.
+//
+// Input:
+//   pos:     The position of the first byte to replace
+//   count:   The number of bytes to remove
+//   insert:  The pieces to insert in their place
+
+void Document::change(FPos pos, FPos count, const PieceVec& insert)
+{
+  Change  c;
+  c.pos      = pos;
+  c.inserted = insert;
+  c.first    = !inStep;
+
+  splice(pos, count, insert, &c.removed);
+
+  undoList.push_back(c);
+  redoList.clear();
+  inStep = true;
+} // end Document::change
+
+//--------------------------------------------------------------------
+// Copy bytes from another document over this one:
+//
+// No bytes are read: the pieces of the other document are shared, so
+// this takes the same time no matter how many bytes are copied.
+// Bytes copied past the end extend the document (if pos is past the
+// end, the gap is filled with zeros).
+//
+// Input:
+//   pos:      Where to put the bytes
+//   from:     The document to copy from
+//   fromPos:  The position of the first byte to copy
+//   count:    The number of bytes to copy
+//
+// Returns:
+//   true:   The bytes were copied
+//   false:  Nothing to copy, or unable to open the other file
+
+bool Document::copy(FPos pos, const Document& from, FPos fromPos, FPos count)
+{
+  PieceVec  insert;
+  FPos      at = 0;
+
+  for (PieceVec::const_iterator p = from.pieces.begin();
+       p != from.pieces.end() && at < fromPos + count; at += (p++)->length) {
+    const FPos  lo = max(at, fromPos);
+    const FPos  hi = min(at + p->length, fromPos + count);
+    if (lo >= hi) continue;
+
+    Piece  q = *p;
+    q.start += lo - at;
+    q.length = hi - lo;
+
+    if (q.source == srcAdded) {
+      const vector<Byte>::const_iterator  b = from.added.begin() + q.start;
+      q.start = added.size();
+      added.insert(added.end(), b, b + q.length);
+    } else if ((q.source = borrow(from.files[p->source])) < 0)
+      return false;
+
+    insert.push_back(q);
+  } // end for each piece of from
+
+  if (insert.empty()) return false;
+
+  if (pos > length) {
+    // Fill the gap with zeros:
+    const Piece  gap = add(pos - length - 1, 0);
+    insert.insert(insert.begin(), gap);
+    pos = length;
+  }
+
+  change(pos, min(totalLength(insert), length - pos), insert);
+
+  return true;
+} // end Document::copy
+
+//--------------------------------------------------------------------
+// Copy a piece to a file:
+//
+// Bytes from a file are copied with CopyFileRange, so on most systems
+// they never pass through this program.
+//
+// Input:
+//   piece:     The piece to copy
+//   out:       The file to write to (at its current position)
+//   at:        The position of the piece in the document
+//   progress:  Reports how far the copy has gotten
+//
+// Returns:
+//   true:   The piece was written
+//   false:  An error occurred, or the user cancelled
+
+bool Document::copyPiece(const Piece& piece, File out, FPos at,
+                         Progress& progress) const
+{
+  if (piece.source == srcAdded)
+    return WriteFile(out, &added[piece.start], Size(piece.length));
+
+  for (FPos done = 0; done < piece.length; ) {
+    if (!progress.update(at + done)) return false;
+
+    const FPos  count = min(piece.length - done, copyChunk);
+    if (!CopyFileRange(files[piece.source], piece.start + done, out, count))
+      return false;
+    done += count;
+  }
+
+  return true;
+} // end Document::copyPiece
+
+//--------------------------------------------------------------------
+// Delete bytes:
+//
+// Input:
+//   pos:    The position of the first byte to delete
+//   count:  The number of bytes to delete
+
+void Document::erase(FPos pos, FPos count)
+{
+  count = min(count, length - pos);
+
+  if (pos >= 0 && count > 0)
+    change(pos, count, PieceVec());
+} // end Document::erase
+
+//--------------------------------------------------------------------
+// Return true if the changes can be written over the file:
+//
+// That's possible when no bytes of the file have moved, so the
+// document is the file with some bytes replaced or appended.
+
+bool Document::inPlace() const
+{
+  if (length < fileLength) return false;
+
+  FPos  at = 0;
+  for (PieceVec::const_iterator p = pieces.begin(); p != pieces.end(); ++p) {
+    if (p->source == srcFile && p->start != at) return false;
+    at += p->length;
+  }
+
+  return true;
+} // end Document::inPlace
+
+//--------------------------------------------------------------------
+// Insert a byte:
+//
+// Input:
+//   pos:    The position for the new byte (if past the end, the gap
+//           is filled with zeros)
+//   value:  The byte to insert
+
+void Document::insert(FPos pos, Byte value)
+{
+  const FPos  gap = max(pos - length, FPos(0));
+
+  change(pos - gap, 0, PieceVec(1, add(gap, value)));
+} // end Document::insert
+
+//--------------------------------------------------------------------
+// Join a piece to the one before it, if they are contiguous:
+//
+// Input:
+//   i:  The index of the second piece
+
+void Document::join(VecSize i)
+{
+  if (i == 0 || i >= pieces.size()) return;
+
+  Piece&        a = pieces[i-1];
+  const Piece&  b = pieces[i];
+
+  if (a.source == b.source && a.start + a.length == b.start) {
+    a.length += b.length;
+    pieces.erase(pieces.begin() + i);
+  }
+} // end Document::join
+
+//--------------------------------------------------------------------
+// Find the changed bytes in part of the document:
+//
+// Input:
+//   pos:   The position to start at
+//   size:  The number of bytes to check
+//
+// Output:
+//   changed:  changed[i] is true if the byte at pos + i did not come
+//             from the file (empty if none did)
+
+void Document::mark(FPos pos, int size, vector<char>& changed) const
+{
+  changed.clear();
+
+  FPos  at = 0;
+  for (PieceVec::const_iterator p = pieces.begin();
+       p != pieces.end() && at < pos + size; at += (p++)->length) {
+    if (p->source == srcFile || at + p->length <= pos) continue;
+
+    if (changed.empty()) changed.assign(size, false);
+
+    const FPos  from = max(at, pos);
+    const FPos  to   = min(at + p->length, pos + size);
+    fill(changed.begin() + (from - pos), changed.begin() + (to - pos), true);
+  }
+} // end Document::mark
+
+//--------------------------------------------------------------------
+// Return true if the document is different from the file:
+
+bool Document::modified() const
+{
+  if (pieces.empty()) return (fileLength != 0);
+
+  return !(pieces.size() == 1 && pieces[0].source == srcFile &&
+           pieces[0].start == 0 && pieces[0].length == fileLength);
+} // end Document::modified
+
+//--------------------------------------------------------------------
+// Read bytes from the document:
+//
+// Input:
+//   pos:   The position of the first byte to read
+//   buf:   Where to store the bytes
+//   size:  The number of bytes to read
+//
+// Returns:
+//   The number of bytes read (less than size at the end)
+
+int Document::read(FPos pos, Byte* buf, int size) const
+{
+  int   got = 0;
+  FPos  at  = 0;
+
+  for (PieceVec::const_iterator p = pieces.begin();
+       p != pieces.end() && got < size; at += (p++)->length) {
+    if (pos + got >= at + p->length) continue;
+
+    const FPos  skip  = pos + got - at;
+    const int   count = int(min(p->length - skip, FPos(size - got)));
+
+    if (p->source == srcAdded)
+      memcpy(buf + got, &added[p->start + skip], count);
+    else {
+      SeekFile(files[p->source], p->start + skip);
+      const Size  bytesRead = ReadFile(files[p->source], buf + got, count);
+      if (bytesRead != count) {
+        if (bytesRead > 0) got += bytesRead;
+        break;                  // The file must have been truncated
+      }
+    } // end else read from file
+
+    got += count;
+  } // end for each piece
+
+  return got;
+} // end Document::read
+
+//--------------------------------------------------------------------
+// Redo the most recently undone step:
+//
+// Returns:
+//   true:   The step was redone
+//   false:  There was nothing to redo
+
+bool Document::redo()
+{
+  if (redoList.empty()) return false;
+
+  do {
+    const Change  c = redoList.back();
+    redoList.pop_back();
+    splice(c.pos, totalLength(c.removed), c.inserted, NULL);
+    undoList.push_back(c);
+  } while (!redoList.empty() && !redoList.back().first);
+
+  inStep = false;
+  return true;
+} // end Document::redo
+
+//--------------------------------------------------------------------
+// Start over with an unmodified file:
+//
+// Forgets all changes, and the undo history.
+//
+// Input:
+//   file:  The file to edit
+
+void Document::reset(File file)
+{
+  for (VecSize i = srcFile + 1; i < files.size(); ++i)
+    CloseFile(files[i]);
+
+  files.assign(1, file);
+  added.clear();
+  pieces.clear();
+  undoList.clear();
+  redoList.clear();
+  inStep = false;
+
+  fileLength = length = 0;
+  update();
+} // end Document::reset
+
+//--------------------------------------------------------------------
+// Change a byte:
+//
+// Input:
+//   pos:    The position of the byte (if past the end, the gap is
+//           filled with zeros)
+//   value:  Its new value
+
+void Document::set(FPos pos, Byte value)
+{
+  if (pos >= length)
+    insert(pos, value);
+  else
+    change(pos, 1, PieceVec(1, add(0, value)));
+} // end Document::set
+
+//--------------------------------------------------------------------
+// Replace bytes:
+//
+// Input:
+//   pos:      The position of the first byte to replace
+//   count:    The number of bytes to remove
+//   insert:   The pieces to insert in their place
+//
+// Output:
+//   removed:  The pieces removed (if not NULL)
+
+void Document::splice(FPos pos, FPos count, const PieceVec& insert,
+                      PieceVec* removed)
+{
+  const VecSize  first = split(pos);
+  const VecSize  last  = split(pos + count);
+
+  if (removed)
+    removed->assign(pieces.begin() + first, pieces.begin() + last);
+
+  pieces.erase(pieces.begin() + first, pieces.begin() + last);
+  pieces.insert(pieces.begin() + first, insert.begin(), insert.end());
+
+  length += totalLength(insert) - count;
+
+  for (VecSize i = first + insert.size() + 1; i-- > first; )
+    join(i);
+} // end Document::splice
+
+//--------------------------------------------------------------------
+// Make sure a piece starts at a position:
+//
+// Input:
+//   pos:  The position (must not be past the end)
+//
+// Returns:
+//   The index of the piece starting at pos (or the number of pieces,
+//   if pos is the end of the document)
+
+VecSize Document::split(FPos pos)
+{
+  FPos  at = 0;
+
+  for (VecSize i = 0; i < pieces.size(); at += pieces[i++].length) {
+    if (at == pos) return i;
+
+    if (pos < at + pieces[i].length) {
+      Piece  tail = pieces[i];
+      tail.start  += pos - at;
+      tail.length -= pos - at;
+      pieces[i].length = pos - at;
+      pieces.insert(pieces.begin() + i + 1, tail);
+      return i + 1;
+    }
+  } // end for each piece
+
+  return pieces.size();
+} // end Document::split
+
+//--------------------------------------------------------------------
+// Exchange contents with another document:
+//
+// Each takes the other's file, edits, and undo history.
+//
+// Input:
+//   other:  The document to exchange with
+
+void Document::swap(Document& other)
+{
+  added.swap(other.added);
+  files.swap(other.files);
+  pieces.swap(other.pieces);
+  undoList.swap(other.undoList);
+  redoList.swap(other.redoList);
+  std::swap(fileLength, other.fileLength);
+  std::swap(length, other.length);
+  std::swap(inStep, other.inStep);
+} // end Document::swap
+
+//--------------------------------------------------------------------
+// Return the total length of some pieces:
+
+FPos Document::totalLength(const PieceVec& pieces)
+{
+  FPos  total = 0;
+
+  for (PieceVec::const_iterator p = pieces.begin(); p != pieces.end(); ++p)
+    total += p->length;
+
+  return total;
+} // end Document::totalLength
+
+//--------------------------------------------------------------------
+// Undo the most recent step:
+//
+// Returns:
+//   true:   The step was undone
+//   false:  There was nothing to undo
+
+bool Document::undo()
+{
+  if (undoList.empty()) return false;
+
+  bool  first;
+  do {
+    const Change  c = undoList.back();
+    undoList.pop_back();
+    splice(c.pos, totalLength(c.inserted), c.removed, NULL);
+    redoList.push_back(c);
+    first = c.first;
+  } while (!first);
+
+  inStep = false;
+  return true;
+} // end Document::undo
+
+//--------------------------------------------------------------------
+// Notice that the size of an unmodified file has changed:
+//
+// Does nothing if there are unsaved changes.
+
+void Document::update()
+{
+  if (modified()) return;
+
+  const FPos  newLength = SeekFile(files[srcFile], 0, SeekEnd);
+  if (newLength < 0 || (newLength == fileLength && length == fileLength))
+    return;
+
+  fileLength = length = newLength;
+  pieces.clear();
+
+  if (length) {
+    Piece  p;
+    p.start  = 0;
+    p.length = length;
+    p.source = srcFile;
+    pieces.push_back(p);
+  }
+} // end Document::update
+
+//--------------------------------------------------------------------
+// Write part of the document to a new file:
+//
+// Input:
+//   out:       The file to write to (at its current position)
+//   pos:       The position of the first byte to write
+//   count:     The number of bytes to write
+//   progress:  Reports how far the copy has gotten
+//
+// Returns:
+//   true:   The bytes were written
+//   false:  An error occurred, or the user cancelled
+
+bool Document::write(File out, FPos pos, FPos count, Progress& progress) const
+{
+  const FPos  end = min(pos + count, length);
+  FPos        at  = 0;
+
+  for (PieceVec::const_iterator p = pieces.begin();
+       p != pieces.end() && at < end; at += (p++)->length) {
+    if (at + p->length <= pos) continue;
+
+    const FPos  skip  = max(pos - at, FPos(0));
+    Piece       piece = *p;     // The part of *p that is in the range
+
+    piece.start += skip;
+    piece.length = min(at + p->length, end) - at - skip;
+
+    if (!copyPiece(piece, out, at + skip, progress)) return false;
+  } // end for each piece up to the end of the range
+
+  return progress.update(end);
+} // end Document::write
+
+//--------------------------------------------------------------------
+// Write the changes over the file:
+//
+// Only the bytes that did not come from the file are written.  Call
+// inPlace first to make sure this is possible.
+//
+// Input:
+//   progress:  Reports how far the copy has gotten
+//
+// Returns:
+//   true:   The changes were written
+//   false:  An error occurred, or the user cancelled
+
+bool Document::writeChanges(Progress& progress) const
+{
+  const File  file = files[srcFile];
+  FPos        at   = 0;
+
+  for (PieceVec::const_iterator p = pieces.begin(); p != pieces.end();
+       at += (p++)->length)
+    if (p->source != srcFile &&
+        (SeekFile(file, at) != at || !copyPiece(*p, file, at, progress)))
+      return false;
+
+  return progress.update(at);
+} // end Document::writeChanges
+
+//====================================================================
+// Class Difference:
+//
+// Member Variables:
+//   file1, file2:
+//     The FileDisplay objects being compared
+//   more:
+//     The other files in the N-way view (each is compared with file1,
+//     so a byte is marked if any file disagrees with the others)
+//   numDiffs:
+//     The number of differences between the two FileDisplay buffers
+//   line/table:
+//     An array of bools for each byte in the FileDisplay buffers
+//     True marks differences
+//
+//--------------------------------------------------------------------
+// Constructor:
+//
+// Input:
+//   aFile1, aFile2:
+//     Pointers to the FileDisplay objects to compare
+//   aMore:
+//     The other files to compare (must remain valid)
+
+Difference::Difference(const FileDisplay* aFile1, const FileDisplay* aFile2,
+                       const FileVec* aMore)
+: data(NULL),
+  file1(aFile1),
+  file2(aFile2),
+  more(aMore)
+{
+} // end Difference::Difference
+
+//--------------------------------------------------------------------
+Difference::~Difference()
+{
+  delete [] reinterpret_cast<Byte*>(data);
+} // end Difference::~Difference
+
+//--------------------------------------------------------------------
+// Compute differences:
+//
+// Input Variables:
+//   file1, file2:  The files to compare
+//
+// Returns:
+//   The number of differences between the buffers
+//   -1 if both buffers are empty
+//
+// Output Variables:
+//   numDiffs:  The number of differences between the buffers
+
+int Difference::compute()
+{
+  if (singleFile)
+    // We return 1 so that cmNextDiff won't keep searching:
+    return (file1->bufContents ? 1 : -1);
+
+  memset(data, 0, bufSize);     // Clear the difference table
+
+  int  different = 0;
+
+  const Byte*  buf1 = file1->data;
+  const Byte*  buf2 = file2->data;
+
+  int  size = min(file1->bufContents, file2->bufContents);
+
+  int  i;
+  for (i = 0; i + lineWidth <= size; i += lineWidth)
+    switch (lineWidth) {
+     case 16: different += compareLine<16>(buf1 + i, buf2 + i, data + i); break;
+     case 32: different += compareLine<32>(buf1 + i, buf2 + i, data + i); break;
+     default: different += compareLine<64>(buf1 + i, buf2 + i, data + i); break;
+    }
+
+  for (; i < size; i++)
+    if (buf1[i] != buf2[i]) {
+      data[i] = true;
+      ++different;
+    }
+
+  size = max(file1->bufContents, file2->bufContents);
+
+  if (i < size) {
+    // One buffer has more data than the other:
+    different += size - i;
+    for (; i < size; i++)
+      data[i] = true;           // These bytes are only in 1 buffer
+  }
+
+  if (!more->empty()) {
+    for (FileVec::const_iterator f = more->begin(); f != more->end(); ++f) {
+      const int  common = min(file1->bufContents, (*f)->bufContents);
+      const int  longer = max(file1->bufContents, (*f)->bufContents);
+
+      markDifferences(buf1, (*f)->data, common, data);
+      memset(data + common, true, longer - common);
+      size = max(size, longer);
+    } // end for each other file
+
+    different = count(data, data + size, Byte(true));
+  } // end if N-way view
+
+  if (!size)
+    return -1;                  // All the buffers are empty
+
+  numDiffs = different;
+
+  return different;
+} // end Difference::compute
+
+//--------------------------------------------------------------------
+// Find the first difference in the buffers:
+//
+// Returns:
+//   The index of the first byte that differs (-1 if none do)
+
+int Difference::firstDiff() const
+{
+  if (singleFile) return -1;
+
+  const Byte*  diff = static_cast<const Byte*>(memchr(data, true, bufSize));
+
+  return (diff ? diff - data : -1);
+} // end Difference::firstDiff
+
+//--------------------------------------------------------------------
+void Difference::resize()
+{
+  if (singleFile) return;
+
+  delete [] data;
+
+  data = new Byte[bufSize];
+} // end Difference::resize
+
+//====================================================================
+// Class FileDisplay:
+//
+// Member Variables:
+//   bufContents:
+//     The number of bytes in the file buffer
+//   diffs:
+//     A pointer to the Difference object related to this file
+//   doc:
+//     The file as edited, including changes not saved yet
+//   file:
+//     The file being displayed
+//   fileName:
+//     The relative pathname of the file being displayed
+//   mark:
+//     The position set by setMark (-1 if none).  The bytes between
+//     the mark and the offset form the marked region.
+//   matches:
+//     The index built by findAll (NULL if none)
+//   offset:
+//     The position in the file of the first byte in the buffer
+//   shown:
+//     The text of each line as last displayed, followed by the
+//     Style of each character (empty if the line must be redrawn)
+//   shownOffset:
+//     The offset when the lines were last displayed
+//   status:
+//     A message displayed at the right end of the title line
+//   win:
+//     The handle of the window used for display
+//   yPos:
+//     The vertical position of the display window
+//   buffer/line:
+//     The currently displayed portion of the file
+//
+//--------------------------------------------------------------------
+// Constructor:
+
+FileDisplay::FileDisplay()
+: bufContents(0),
+  data(NULL),
+  diffs(NULL),
+  file(InvalidFile),
+  mark(-1),
+  matches(NULL),
+  offset(0),
+  shownOffset(0),
+  writable(false),
+  yPos(0)
+{
+  fileName[0] = '\0';
+} // end FileDisplay::FileDisplay
+
+//--------------------------------------------------------------------
+// Initialize:
+//
+// Creates the display window and opens the file.
+//
+// Input:
+//   y:          The vertical position of the display window
+//   aDiff:      The Difference object related to this buffer
+//   aFileName:  The name of the file to display
+
+void FileDisplay::init(int y, const Difference* aDiff,
+                       const char* aFileName)
+{
+  diffs = aDiff;
+  yPos  = y;
+
+  win.init(0,y, displayWidth, (numLines + 1 + ((y==0) ? linesBetween : 0)),
+           cFileWin);
+
+  resize();
+
+  if (aFileName)
+    setFile(aFileName);
+} // end FileDisplay::init
+
+//--------------------------------------------------------------------
+// Destructor:
+
+FileDisplay::~FileDisplay()
+{
+  shutDown();
+  CloseFile(file);
+  delete [] data;
+  delete matches;
+} // end FileDisplay::~FileDisplay
+
+//--------------------------------------------------------------------
+void FileDisplay::resize()
+{
+  delete [] data;
+
+  data = new Byte[bufSize];
+  shown.clear();
+
+  // FIXME resize window
+} // end FileDisplay::resize
+
+//--------------------------------------------------------------------
+// Shut down the file display:
+//
+// Deletes the display window.
+
+void FileDisplay::shutDown()
+{
+  win.close();
+} // end FileDisplay::shutDown
+
+//--------------------------------------------------------------------
+// Display the file contents:
+//
+// Only the lines that differ from what is already on the screen are
+// redrawn.  If the file has moved by a whole number of lines, the
+// window is scrolled first, so the lines already displayed can be
+// reused.
+
+void FileDisplay::display()
+{
+  if (!fileName[0]) return;
+
+  if (shown.size() != VecSize(numLines))
+    shown.assign(numLines, String());
+  else if (offset != shownOffset && (offset - shownOffset) % lineWidth == 0) {
+    const FPos  lines = (offset - shownOffset) / lineWidth;
+
+    if (lines > -numLines && lines < numLines) {
+      win.scroll(1, numLines, lines);
+      if (lines > 0) {
+        shown.erase(shown.begin(), shown.begin() + lines);
+        shown.insert(shown.end(), lines, String());
+      } else {
+        shown.erase(shown.end() + lines, shown.end());
+        shown.insert(shown.begin(), -lines, String());
+      }
+    } // end if some lines are still visible
+  } // end else if moved by whole lines
+
+  shownOffset = offset;
+
+  FPos  lineOffset = offset;
+
+  char  buf2[maxDisplayWidth+1];
+  buf2[displayWidth] = '\0';
+
+  // Find the bytes that are part of a match:
+  vector<char>  matched;
+
+  if (matches) {
+    vector<Match>  found;
+    const FPos     end = offset + bufContents;
+
+    matches->find(offset - matches->longest() + 1, end, found);
+    matched.assign(bufSize, false);
+
+    for (vector<Match>::const_iterator m = found.begin(); m != found.end(); ++m)
+      for (FPos p = max(m->pos, offset); p < min(m->pos + m->length, end); ++p)
+        matched[p - offset] = true;
+  } // end if highlighting matches
+
+  // Find the bytes that have not been saved:
+  vector<char>  edited;
+
+  doc.mark(offset, bufSize, edited);
+
+  for (int i = 0; i < numLines; i++) {
+    char*  str = buf2;
+
+    // Format the offset as "XXXX XXXX:" (this runs for every line of
+    // every redraw, so avoid sprintf):
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      *(str++) = hexDigits[(lineOffset >> shift) & 0x0F];
+      if (shift == 16) *(str++) = ' ';
+    }
+    *(str++) = ':';
+    memset(str, ' ', displayWidth - (str - buf2));
+
+    const int    start   = i * lineWidth;
+    const int    length  = bufContents - start;
+    const Byte*  diff    = (diffs ? diffs->data + start : NULL);
+    const char*  match   = (matched.empty() ? NULL : &matched[start]);
+    const char*  edit    = (edited.empty()  ? NULL : &edited[start]);
+
+    Style  style[maxDisplayWidth];
+    fill(style, style + displayWidth, cFileWin);
+
+    switch (lineWidth) {
+     case 16: formatLine<16>(data + start, length, diff, match, edit,
+                            buf2, style);
+      break;
+     case 32: formatLine<32>(data + start, length, diff, match, edit,
+                            buf2, style);
+      break;
+     default: formatLine<64>(data + start, length, diff, match, edit,
+                            buf2, style);
+      break;
+    }
+
+    lineOffset += lineWidth;
+
+    // Skip the line if it's already on the screen:
+    String  row(buf2, displayWidth);
+    row.append(style, style + displayWidth);
+
+    if (row == shown[i]) continue;
+    shown[i].swap(row);
+
+    win.put(0,i+1, buf2);
+    win.putAttribs(0,i+1, style, displayWidth);
+  } // end for i up to numLines
+
+  win.update();
+} // end FileDisplay::display
+
+//--------------------------------------------------------------------
+// Edit the file:
+//
+// Returns:
+//   true:  File changed
+//   false:  File did not change
+
+bool FileDisplay::edit(const FileDisplay* other)
+{
+  if (!bufContents && offset)
+    return false;               // You must not be completely past EOF
+
+  if (!makeWritable()) return false;
+
+  if (bufContents < bufSize)
+    memset(data + bufContents, 0, bufSize - bufContents);
+
+  short x = 0;
+  short y = 0;
+  bool  hiNib = true;
+  bool  ascii = false;
+  bool  changed = false;
+  bool  insertMode = false;
+  int   key;
+
+  const Byte *const inputTable = ((displayTable == ebcdicDisplayTable)
+                                  ? ascii2ebcdicTable
+                                  : NULL); // No translation
+
+  showEditPrompt();
+  win.setCursor(leftMar,1);
+  ConWindow::showCursor(insertMode);
+
+  for (;;) {
+    win.setCursor((ascii ? leftMar2 + x : leftMar + 3*x + !hiNib) + (x / 8),
+                  y+1);
+    key = win.readKey();
+    doc.nextStep();             // Each key can be undone separately
+
+    switch (key) {
+     case KEY_ESCAPE: goto done;
+     case 0x15:                 // Ctrl+U
+     case 0x12:                 // Ctrl+R
+      if ((key == 0x15) ? undo() : redo()) {
+        changed = true;
+        reread();
+      } else
+        beep();
+      break;
+
+     case KEY_TAB:
+      hiNib = true;
+      ascii = !ascii;
+      break;
+
+     case KEY_IC:
+      insertMode = !insertMode;
+      ConWindow::showCursor(insertMode);
+      break;
+
+     case KEY_DC:
+      if (x + y*lineWidth < bufContents) {
+        changed = true;
+        eraseByte(x,y);
+      } else
+        beep();
+      hiNib = true;
+      break;
+
+     case KEY_DELETE:
+     case KEY_BACKSPACE:
+      if (insertMode) {         // Delete the byte before the cursor
+        const int  i = x + y*lineWidth;
+        if (!hiNib || !i || i > bufContents)
+          beep();
+        else {
+          changed = true;
+          x = (i - 1) % lineWidth;
+          y = (i - 1) / lineWidth;
+          eraseByte(x,y);
+        }
+        hiNib = true;
+        break;
+      } // end if insertMode
+      // else fall thru
+     case KEY_LEFT:
+      if (!hiNib)
+        hiNib = true;
+      else {
+        if (!ascii) hiNib = false;
+        if (--x < 0) x = lineWidth-1;
+      }
+      if (hiNib || (x < lineWidth-1))
+        break;
+      // else fall thru
+     case KEY_UP:   if (--y < 0) y = numLines-1; break;
+
+     default: {
+       const bool  inserting = insertMode && hiNib; // Start a new byte
+       short newByte = -1;
+       if ((key == KEY_RETURN) && other &&
+           (other->bufContents > x + y*lineWidth)) {
+         newByte = other->data[y*lineWidth + x]; // Copy from other file
+         hiNib = ascii; // Always advance cursor to next byte
+       } else if (ascii) {
+         if (isprint(key)) newByte = (inputTable ? inputTable[key] : key);
+       } else { // hex
+         if (isdigit(key))
+           newByte = key - '0';
+         else if (isxdigit(key))
+           newByte = safeUC(key) - 'A' + 10;
+         if (newByte >= 0) {
+           if (inserting)
+             newByte *= 0x10;
+           else if (hiNib)
+             newByte = (newByte * 0x10) | (0x0F & data[y*lineWidth + x]);
+           else
+             newByte |= 0xF0 & data[y*lineWidth + x];
+         } // end if valid digit entered
+       } // end else hex
+       if (newByte >= 0) {
+         changed = true;
+         if (inserting)
+           insertByte(x,y,newByte);
+         else
+           setByte(x,y,newByte);
+       } else
+         break;
+     } // end default and fall thru
+     case KEY_RIGHT:
+      if (hiNib && !ascii)
+        hiNib = false;
+      else {
+        hiNib = true;
+        if (++x >= lineWidth) x = 0;
+      }
+      if (x || !hiNib)
+        break;
+      // else fall thru
+     case KEY_DOWN: if (++y >= numLines) y = 0;  break;
+
+    } // end switch
+
+  } // end forever
+
+ done:
+  moveTo(offset);               // Discard the zeros past the end
+  shown.clear();                // setByte changed the window directly
+  showTitle();
+  showPrompt();
+  ConWindow::hideCursor();
+  return changed;
+} // end FileDisplay::edit
+
+//--------------------------------------------------------------------
+// Delete the byte under the cursor while editing:
+//
+// Input:
+//   x,y:  The position of the byte in the window
+
+void FileDisplay::eraseByte(short x, short y)
+{
+  doc.erase(offset + y*lineWidth + x, 1);
+  forgetMatches();
+  reread();
+} // end FileDisplay::eraseByte
+
+//--------------------------------------------------------------------
+// Insert a byte at the cursor while editing:
+//
+// Input:
+//   x,y:  The position for the new byte in the window
+//   b:    The byte to insert
+
+void FileDisplay::insertByte(short x, short y, Byte b)
+{
+  doc.insert(offset + y*lineWidth + x, b);
+  forgetMatches();
+  reread();
+} // end FileDisplay::insertByte
+
+//--------------------------------------------------------------------
+// Copy bytes from the other file:
+//
+// The files are lined up the way they are displayed, so each byte is
+// replaced by the byte shown in the same place in the other file.
+// This is a single change that can be undone, and it takes the same
+// time however many bytes are copied.
+//
+// Input:
+//   other:  The file to copy from
+//   pos:    The position of the first byte to replace
+//   count:  The number of bytes to copy
+//
+// Output:
+//   count:  The number of bytes copied (fewer if the other file ends)
+//
+// Returns:
+//   true:   The bytes were copied (or there were none to copy)
+//   false:  Unable to edit the file (call ErrorMsg for error message)
+
+bool FileDisplay::copyFrom(const FileDisplay& other, FPos pos, FPos& count)
+{
+  FPos  fromPos = pos - offset + other.offset;
+
+  if (fromPos < 0) {
+    pos   -= fromPos;
+    count += fromPos;
+    fromPos = 0;
+  }
+
+  count = max(min(count, other.doc.size() - fromPos), FPos(0));
+  if (!count) return true;
+
+  if (!makeWritable()) return false;
+
+  doc.nextStep();
+  const bool  ok = doc.copy(pos, other.doc, fromPos, count);
+  doc.nextStep();
+  forgetMatches();
+
+  moveTo(offset);
+  showTitle();
+  return ok;
+} // end FileDisplay::copyFrom
+
+//--------------------------------------------------------------------
+// Get the marked region:
+//
+// Output:
+//   start:  The position of the first byte in the region
+//   count:  The number of bytes in the region
+//
+// Returns:
+//   true:   There is a marked region
+//   false:  The mark is not set, or is at the current position
+
+bool FileDisplay::getRegion(FPos& start, FPos& count) const
+{
+  if (mark < 0 || mark == offset) return false;
+
+  start = min(mark, offset);
+  count = max(mark, offset) - start;
+  return true;
+} // end FileDisplay::getRegion
+
+//--------------------------------------------------------------------
+// Set the mark at the current position:
+
+void FileDisplay::setMark()
+{
+  mark = offset;
+
+  char  buf[32];
+  sprintf(buf, "Mark set at %s", formatPos(mark).c_str());
+  setStatus(buf);
+} // end FileDisplay::setMark
+
+//--------------------------------------------------------------------
+// Redo the last change that was undone:
+//
+// Returns:
+//   true:   The change was redone
+//   false:  There was nothing to redo
+
+bool FileDisplay::redo()
+{
+  if (!doc.redo()) return false;
+
+  forgetMatches();
+  moveTo(offset);
+  showTitle();
+  return true;
+} // end FileDisplay::redo
+
+//--------------------------------------------------------------------
+// Write a document (as a Task):
+//
+// Input:
+//   doc:    The document to write
+//   out:    The new file, or InvalidFile to write the changes in place
+//   start:  The position of the first byte to write to out
+//   count:  The number of bytes to write to out (-1 means all)
+//
+// Output:
+//   ok:   False if unable to write the file
+
+class SaveTask : public Task
+{
+ public:
+  bool  ok;
+
+  SaveTask(const Document& aDoc, File aOut, FPos aStart=0, FPos aCount=-1)
+    : ok(false), doc(aDoc), out(aOut), start(aStart), count(aCount) {};
+  virtual void run(Progress& progress);
+
+ protected:
+  const Document&  doc;
+  File             out;
+  FPos             start;
+  FPos             count;
+}; // end SaveTask
+
+void SaveTask::run(Progress& progress)
+{
+  if (out == InvalidFile)
+    ok = doc.writeChanges(progress);
+  else
+    ok = doc.write(out, start, (count < 0 ? doc.size() : count), progress);
+} // end SaveTask::run
+
+//--------------------------------------------------------------------
+// Write the unsaved changes to the file:
+//
+// If no bytes have moved, only the changed bytes are written over
+// the file.  Otherwise (or if the other file has borrowed bytes from
+// this one, which must not change under it), the whole document is
+// written to a new file, which then replaces the original.
+//
+// Shows the progress of the operation, which the user may cancel.
+// (Cancelling an in-place save may leave some changes written.)
+//
+// Input:
+//   other:  The other file being displayed (may be NULL)
+//
+// Output:
+//   cancelled:  True if the user cancelled the save
+//
+// Returns:
+//   true:   The changes were saved (or there were none)
+//   false:  An error occurred, or the user cancelled
+
+bool FileDisplay::save(const FileDisplay* other, bool& cancelled)
+{
+  cancelled = false;
+
+  if (!doc.modified()) return true;
+
+  if (doc.inPlace() && !(other && other->doc.borrows())) {
+    if (!makeWritable()) return false;
+
+    SaveTask  task(doc, InvalidFile);
+    Progress  progress("Saving", 0, doc.size());
+
+    cancelled = !progress.run(task);
+    if (cancelled || !task.ok || !SyncFile(file)) return false;
+  } else if (!saveCopy(cancelled))
+    return false;
+
+  doc.reset(file);
+  forgetMatches();              // The index may be out of date
+  showTitle();
+  return true;
+} // end FileDisplay::save
+
+//--------------------------------------------------------------------
+// Save the document by writing a new file:
+//
+// Writes the document to a temporary file in the same directory,
+// syncs it, and renames it over the original, so the file is never
+// left half written.  Reopens the file afterwards (read-only).  If
+// the name is a symbolic link, the file it points to is replaced,
+// and the link is left alone.
+//
+// Output:
+//   cancelled:  True if the user cancelled the save
+//
+// Returns:
+//   true:   The file was replaced
+//   false:  An error occurred, or the user cancelled
+
+bool FileDisplay::saveCopy(bool& cancelled)
+{
+  String  target;
+  if (!ResolvePath(fileName, target)) return false;
+
+  String  tempName;
+  File    out = CreateTempFile(target.c_str(), tempName);
+
+  if (out == InvalidFile) return false;
+
+  SaveTask  task(doc, out);
+  Progress  progress("Saving", 0, doc.size());
+
+  cancelled = !progress.run(task);
+
+  bool  ok = (!cancelled && task.ok && SyncFile(out));
+  CloseFile(out);
+
+  // The file stays open until it has been replaced, so if that fails,
+  // the document can still read it:
+  if (ok) ok = RenameFile(tempName.c_str(), target.c_str());
+
+  if (ok) {
+    CloseFile(file);
+    file = OpenFile(fileName);
+    doc.setFile(file);
+    writable = false;
+  }
+
+  if (!ok) RemoveFile(tempName.c_str());
+
+  return ok;
+} // end FileDisplay::saveCopy
+
+//--------------------------------------------------------------------
+// Undo the last change that was not saved:
+//
+// Returns:
+//   true:   The change was undone
+//   false:  There was nothing to undo
+
+bool FileDisplay::undo()
+{
+  if (!doc.undo()) return false;
+
+  forgetMatches();
+  moveTo(offset);
+  showTitle();
+  return true;
+} // end FileDisplay::undo
+
+//--------------------------------------------------------------------
+// Write the marked region to a new file:
+//
+// Includes any unsaved changes.  Bytes from the file are copied with
+// CopyFileRange, so even a huge region is written quickly.
+//
+// Shows the progress of the operation, which the user may cancel.
+//
+// Input:
+//   path:  The file to create (must not already exist)
+//
+// Output:
+//   count:      The number of bytes written
+//   cancelled:  True if the user cancelled
+//
+// Returns:
+//   true:   The region was written (or there is none)
+//   false:  An error occurred, or the user cancelled
+
+bool FileDisplay::writeRegion(const char* path, FPos& count, bool& cancelled)
+{
+  FPos  start = 0;
+
+  cancelled = false;
+  count     = 0;
+
+  if (!getRegion(start, count)) return true;
+
+  count = max(min(count, fileSize() - start), FPos(0));
+
+  File  out = CreateNewFile(path);
+
+  if (out == InvalidFile) return false;
+
+  SaveTask  task(doc, out, start, count);
+  Progress  progress("Writing", start, start + count);
+
+  cancelled = !progress.run(task);
+
+  const bool  ok = (!cancelled && task.ok);
+  CloseFile(out);
+
+  if (!ok) RemoveFile(path);
+
+  return ok;
+} // end FileDisplay::writeRegion
+
+//--------------------------------------------------------------------
+// Return the size of the file (including unsaved changes):
+
+FPos FileDisplay::fileSize()
+{
+  if (!fileName[0]) return 0;   // No file
+
+  doc.update();
+  return doc.size();
+} // end FileDisplay::fileSize
+
+//--------------------------------------------------------------------
+// Reopen the file for writing (if it isn't already):
+//
+// Returns:
+//   true:   The file is writable
+//   false:  Unable to open it for writing
+
+bool FileDisplay::makeWritable()
+{
+  if (!writable) {
+    File w = OpenFile(fileName, true);
+    if (w == InvalidFile) return false;
+    CloseFile(file);
+    file = w;
+    doc.setFile(file);
+    writable = true;
+  }
+
+  return true;
+} // end FileDisplay::makeWritable
+
+//--------------------------------------------------------------------
+void FileDisplay::setByte(short x, short y, Byte b)
+{
+  if (x + y*lineWidth >= bufContents) {
+    if (x + y*lineWidth > bufContents) {
+      short y1 = bufContents / lineWidth;
+      short x1 = bufContents % lineWidth;
+      while (y1 <= numLines) {
+        while (x1 < lineWidth) {
+          if ((x1 == x) && (y1 == y)) goto done;
+          setByte(x1,y1,0);
+          ++x1;
+        }
+        x1 = 0;
+        ++y1;
+      } // end while y1
+    } // end if more than 1 byte past the end
+   done:
+    ++bufContents;
+    data[y*lineWidth + x] = b ^ 1;         // Make sure it's different
+  } // end if past the end
+
+  if (data[y*lineWidth + x] != b) {
+    data[y*lineWidth + x] = b;
+    doc.set(offset + y*lineWidth + x, b);
+    forgetMatches();
+    char str[3];
+    sprintf(str, "%02X", b);
+    win.setAttribs(cFileEdit);
+    win.put(leftMar + 3*x + (x / 8), y+1, str);
+    str[0] = displayTable[b];
+    str[1] = '\0';
+    win.put(leftMar2 + x + (x / 8), y+1, str);
+    win.setAttribs(cFileWin);
+    win.update();
+  }
+} // end FileDisplay::setByte
+
+//--------------------------------------------------------------------
+// Change the file position:
+//
+// Changes the file offset and updates the buffer.
+// Does not update the display.
+//
+// Input:
+//   step:
+//     The number of bytes to move
+//     A negative value means to move backward
+//
+// void FileDisplay::move(int step) /* Inline function */
+
+//--------------------------------------------------------------------
+// Change the file position:
+//
+// Changes the file offset and updates the buffer.
+// Does not update the display.
+//
+// Input:
+//   newOffset:
+//     The new position of the file
+
+void FileDisplay::moveTo(FPos newOffset)
+{
+  if (!fileName[0]) return;     // No file
+
+  offset = newOffset;
+
+  if (offset < 0)
+    offset = 0;
+
+  readBuffer();
+} // end FileDisplay::moveTo
+
+//--------------------------------------------------------------------
+// Fill the buffer from the current offset:
+//
+// The buffer shows the document, including unsaved changes.
+
+void FileDisplay::readBuffer()
+{
+  doc.update();                 // In case the file grew
+  bufContents = doc.read(offset, data, bufSize);
+} // end FileDisplay::readBuffer
+
+//--------------------------------------------------------------------
+// Re-read and redisplay the buffer while editing:
+//
+// Used after a change that moves bytes around, so setByte can't just
+// update the window.
+
+void FileDisplay::reread()
+{
+  readBuffer();
+  if (bufContents < bufSize)
+    memset(data + bufContents, 0, bufSize - bufContents);
+  shown.clear();
+  display();
+} // end FileDisplay::reread
+
+//--------------------------------------------------------------------
+// Change the file position by searching:
+//
+// Changes the file offset and updates the buffer.
+// Does not update the display, except for the status message, which
+// describes the pattern that matched.
+//
+// Input:
+//   searcher:  The pattern(s) to search for
+//
+// Output:
+//   match:  The match that was found
+//
+// Returns:
+//   true:   The search was successful
+//   false:  Search unsuccessful, file not moved
+
+bool FileDisplay::moveTo(const Searcher& searcher, Match& match)
+{
+  if (!fileName[0]) return true; // No file, pretend success
+
+  FirstMatch  handler;
+  ScanTask    task(searcher, doc, offset + 1, handler);
+  Progress    progress("Searching", offset + 1, fileSize());
+
+  if (!progress.run(task) || handler.best.pos < 0) {
+    setStatus(String());
+    return false;               // No match (or cancelled)
+  }
+
+  match = handler.best;
+
+  moveTo(match.pos);
+  setStatus(searcher.describe(match.which));
+
+  return true;
+} // end FileDisplay::moveTo
+
+//--------------------------------------------------------------------
+// Move to the end of the file:
+//
+// Input:
+//   other:  If non NULL, move both files to the end of the shorter file
+
+void FileDisplay::moveToEnd(FileDisplay* other)
+{
+  if (!fileName[0]) return;     // No file
+
+  FPos  end = fileSize();
+  FPos  diff = 0;
+
+  if (other) {
+    // If the files aren't currently at the same position,
+    // we want to keep them offset by the same amount:
+    diff = other->offset - offset;
+
+    end = min(end, other->fileSize() - diff);
+  } // end if moving other file too
+
+  end -= steps[cmmMovePage];
+  end -= end % lineWidth;
+
+  moveTo(end);
+  if (other) other->moveTo(end + diff);
+} // end FileDisplay::moveToEnd
+
+//--------------------------------------------------------------------
+// Find every match in the file:
+//
+// Builds the index used by moveToMatch and for highlighting matches.
+// Shows the progress of the search, which the user may cancel.
+// Does not update the display.
+//
+// Input:
+//   searcher:  The pattern(s) to search for
+//
+// Returns:
+//   true:   The index is complete (or there is no file)
+//   false:  The user cancelled the search (there is no index)
+
+bool FileDisplay::findAll(const Searcher& searcher)
+{
+  if (!fileName[0]) return true; // No file
+
+  forgetMatches();
+  matches = new MatchIndex;
+
+  IndexBuilder  builder(*matches, searcher.lookBehind());
+  ScanTask      task(searcher, doc, 0, builder);
+  Progress      progress("Searching", 0, fileSize());
+
+  if (!progress.run(task)) {
+    forgetMatches();
+    return false;
+  }
+
+  builder.finish();
+  return true;
+} // end FileDisplay::findAll
+
+//--------------------------------------------------------------------
+// Discard the index built by findAll:
+//
+// Called whenever the document changes, because inserting or deleting
+// bytes moves the matches after them, and any change may create or
+// destroy a match.
+
+void FileDisplay::forgetMatches()
+{
+  delete matches;
+  matches = NULL;
+} // end FileDisplay::forgetMatches
+
+//--------------------------------------------------------------------
+// Move to the next or previous match in the index:
+//
+// Input:
+//   delta:  +1 for the next match, -1 for the previous one
+//
+// Returns:
+//   true:   Moved to the match
+//   false:  No more matches in that direction
+
+bool FileDisplay::moveToMatch(int delta)
+{
+  if (!fileName[0]) return true; // No file, pretend success
+  if (!matches) return false;
+
+  // The number of matches before the next position to consider:
+  VecSize  n = matches->lowerBound(offset + (delta > 0 ? 1 : 0));
+
+  if (delta < 0) {
+    if (!n) return false;
+    --n;
+  }
+
+  return moveToMatchNumber(n);
+} // end FileDisplay::moveToMatch
+
+//--------------------------------------------------------------------
+// Move to a match by number:
+//
+// Input:
+//   n:  The match number (0 is the first match)
+//
+// Returns:
+//   true:   Moved to the match
+//   false:  There is no such match
+
+bool FileDisplay::moveToMatchNumber(VecSize n)
+{
+  if (!fileName[0]) return true; // No file, pretend success
+  if (!matches || n >= matches->size()) return false;
+
+  moveTo(matches->get(n).pos);
+
+  return true;
+} // end FileDisplay::moveToMatchNumber
+
+//--------------------------------------------------------------------
+// Overwrite every match in an index (as a Task):
+//
+// The file is processed in blocks that begin at a match, so only
+// the parts of the file that change are read and written.  A match
+// that overlaps one already replaced is skipped.
+//
+// Input:
+//   file:         The file to change (must be writable)
+//   index:        The matches to replace
+//   replaceWith:  The bytes to write over each match
+//
+// Output:
+//   replaced:  The number of matches replaced
+//   ok:        False if unable to write the file
+
+class ReplaceTask : public Task
+{
+ public:
+  VecSize  replaced;
+  bool     ok;
+
+  ReplaceTask(File aFile, const MatchIndex& aIndex, const String& aReplaceWith)
+    : replaced(0), ok(true),
+      file(aFile), index(aIndex), replaceWith(aReplaceWith) {};
+  virtual void run(Progress& progress);
+
+ protected:
+  File               file;
+  const MatchIndex&  index;
+  const String&      replaceWith;
+}; // end ReplaceTask
+
+void ReplaceTask::run(Progress& progress)
+{
+  const int  blockSize = 64 * 1024;
+  const int  length = replaceWith.length();
+
+  Byte *const  buf = new Byte[blockSize + length];
+
+  vector<Match>  found;
+  FPos     end = 0;             // The end of the last replacement
+  VecSize  n = 0;               // The next match to replace
+
+  while (n < index.size()) {
+    const FPos  blockPos = index.get(n).pos;
+
+    if (!progress.update(blockPos)) break;
+
+    n = index.find(blockPos, blockPos + blockSize, found) + found.size();
+
+    SeekFile(file, blockPos);
+    const Size  bytesRead = ReadFile(file, buf, blockSize + length);
+    int  changed = 0;           // The number of bytes to write back
+
+    for (vector<Match>::const_iterator m = found.begin(); m != found.end(); ++m)
+      if (m->pos >= end && m->pos - blockPos + length <= bytesRead) {
+        memcpy(buf + (m->pos - blockPos), replaceWith.data(), length);
+        end = m->pos + length;
+        changed = end - blockPos;
+        ++replaced;
+      } // end if match can be replaced
+
+    SeekFile(file, blockPos);
+    if (!WriteFile(file, buf, changed)) {
+      ok = false;
+      break;
+    }
+  } // end while more matches
+
+  delete [] buf;
+} // end ReplaceTask::run
+
+//--------------------------------------------------------------------
+// Overwrite every match in the index:
+//
+// Shows the progress of the operation, which the user may cancel.
+// Discards the index, which is no longer accurate.
+//
+// Input:
+//   replaceWith:  The bytes to write over each match (matches must
+//                 be at least this long)
+//
+// Output:
+//   replaced:  The number of matches replaced
+//
+// Returns:
+//   true:   Every match was replaced
+//   false:  Cancelled, or unable to write the file
+
+bool FileDisplay::replaceMatches(const String& replaceWith, VecSize& replaced)
+{
+  replaced = 0;
+  if (!matches || !makeWritable()) return false;
+
+  ReplaceTask  task(file, *matches, replaceWith);
+  Progress     progress("Replacing", 0, fileSize());
+
+  const bool  finished = progress.run(task);
+
+  replaced = task.replaced;
+  forgetMatches();
+  moveTo(offset);               // Re-read buffer contents
+
+  return (finished && task.ok);
+} // end FileDisplay::replaceMatches
+
+//--------------------------------------------------------------------
+// Show the number of matches in the status message:
+//
+// Does nothing unless findAll has been used.
+//
+// Input:
+//   searcher:  The Searcher that built the index (for describe)
+
+void FileDisplay::showMatchCount(const Searcher& searcher)
+{
+  if (!matches) return;
+
+  ostringstream  msg;
+
+  VecSize  n = matches->lowerBound(offset);
+
+  if (n < matches->size() && matches->get(n).pos == offset) {
+    msg << "Match " << (n + 1) << " of " << matches->size();
+    String  pattern(searcher.describe(matches->get(n).which));
+    if (!pattern.empty()) msg << ": " << pattern;
+  } else
+    msg << matches->size() << " matches";
+
+  setStatus(msg.str());
+} // end FileDisplay::showMatchCount
+
+//--------------------------------------------------------------------
+// Open a file for display:
+//
+// Opens the file, updates the filename display, and reads the start
+// of the file into the buffer.
+//
+// Input:
+//   aFileName:  The name of the file to open
+//
+// Returns:
+//   True:   Operation successful
+//   False:  Unable to open file (call ErrorMsg for error message)
+
+bool FileDisplay::setFile(const char* aFileName)
+{
+  strncpy(fileName, aFileName, maxPath);
+  fileName[maxPath-1] = '\0';
+
+  status.erase();
+  showTitle();
+
+  bufContents = 0;
+  if (file != InvalidFile) CloseFile(file);
+  forgetMatches();
+  file = OpenFile(fileName);
+  writable = false;
+
+  if (file == InvalidFile)
+    return false;
+
+  offset = 0;
+  mark = -1;
+  doc.reset(file);
+  readBuffer();
+
+  return true;
+} // end FileDisplay::setFile
+
+//--------------------------------------------------------------------
+// Set the status message:
+//
+// The message is shown at the right end of the title line, and
+// remains until it is replaced.
+//
+// Input:
+//   aStatus:  The message to display (empty to clear)
+
+void FileDisplay::setStatus(const String& aStatus)
+{
+  status = aStatus;
+  showTitle();
+} // end FileDisplay::setStatus
+
+//--------------------------------------------------------------------
+// Exchange files with another FileDisplay:
+//
+// Everything about the file changes places, including its buffer,
+// edits, mark, matches, and position.  Each keeps its own window,
+// which is redrawn by the next display.  This lets a file move to
+// another pane without being read again.  Neither title is redrawn.
+//
+// Input:
+//   other:  The FileDisplay to exchange with (it need not have a
+//           window, but must have a buffer of the same size)
+
+void FileDisplay::swapFile(FileDisplay& other)
+{
+  char  name[maxPath];
+  memcpy(name, fileName, maxPath);
+  memcpy(fileName, other.fileName, maxPath);
+  memcpy(other.fileName, name, maxPath);
+
+  doc.swap(other.doc);
+  status.swap(other.status);
+  std::swap(bufContents, other.bufContents);
+  std::swap(data,        other.data);
+  std::swap(file,        other.file);
+  std::swap(mark,        other.mark);
+  std::swap(matches,     other.matches);
+  std::swap(offset,      other.offset);
+  std::swap(writable,    other.writable);
+
+  shown.clear();
+  other.shown.clear();
+} // end FileDisplay::swapFile
+
+//--------------------------------------------------------------------
+// Display the title line:
+//
+// Shows the filename and the status message (if any).
+
+void FileDisplay::showTitle()
+{
+  if (!fileName[0]) return;     // No file
+
+  win.putChar(0,0, ' ', displayWidth);
+  win.put(0,0, fileName);
+  if (doc.modified())
+    win.put(min(int(strlen(fileName)), displayWidth / 2), 0, " (modified)");
+
+  if (!status.empty()) {
+    String  msg(status, 0, displayWidth / 2);
+    win.put(displayWidth - msg.length() - 1, 0, msg.c_str());
+  }
+
+  win.putAttribs(0,0, cFileName, displayWidth);
+  win.update();                 // FIXME
+} // end FileDisplay::showTitle
+
+//====================================================================
+// Main Program:
+//--------------------------------------------------------------------
+// Return the number of files displayed:
+
+int numFiles()
+{
+  return (singleFile ? 1 : 2 + int(moreFiles.size()));
+} // end numFiles
+
+//--------------------------------------------------------------------
+// Return the screen width needed to display a number of bytes per line:
+//
+// That's the offset, the hex display, and the characters, with an
+// extra space between each group of 8 bytes.
+
+int neededWidth(int bytesPerLine)
+{
+  return leftMar + 4 * bytesPerLine + 2 * (bytesPerLine / 8) + 1;
+} // end neededWidth
+
+//--------------------------------------------------------------------
+// Work out the size of the windows from the size of the screen:
+//
+// As many bytes per line as will fit are displayed (16, 32, or 64).
+
+void calcScreenLayout(bool resize = true)
+{
+  int  screenX, screenY;
+
+  ConWindow::getScreenSize(screenX, screenY);
+
+  lineWidth = maxLineWidth;
+  while (lineWidth > minLineWidth && neededWidth(lineWidth) > screenX)
+    lineWidth /= 2;
+
+  displayWidth = neededWidth(lineWidth);
+  leftMar2     = leftMar + 3 * lineWidth + lineWidth / 8;
+
+  if (screenX < screenWidth) {
+    ostringstream  err;
+    err << "The screen must be at least "
+        << screenWidth << " characters wide.";
+    exitMsg(2, err.str().c_str());
+  }
+
+  const int  files = numFiles();
+
+  if (screenY < promptHeight + 2 * max(files, 2)) {
+    ostringstream  err;
+    err << "The screen must be at least "
+        << (promptHeight + 2 * max(files, 2)) << " lines high.";
+    exitMsg(2, err.str().c_str());
+  }
+
+  numLines = screenY - promptHeight - files;
+
+  if (singleFile)
+    linesBetween = 0;
+  else {
+    linesBetween = numLines % files;
+    numLines = (numLines - linesBetween) / files;
+  }
+
+  bufSize = numLines * lineWidth;
+
+  steps[cmmMoveLine] = lineWidth;
+  steps[cmmMovePage] = bufSize-lineWidth;
+
+  // FIXME resize existing windows
+} // end calcScreenLayout
+
+//--------------------------------------------------------------------
+void displayCharacterSet()
+{
+  const bool isASCII = (displayTable == asciiDisplayTable);
+
+  promptWin.putAttribs(3,2, (isASCII ? cCurrentMode : cBackground), 5);
+  promptWin.putAttribs(9,2, (isASCII ? cBackground : cCurrentMode), 6);
+
+  promptWin.update();
+} // end displayCharacterSet
+
+//--------------------------------------------------------------------
+void displayLockState()
+{
+#ifndef WIN32_CONSOLE     // The Win32 version uses Ctrl & Alt instead
+  if (singleFile || !moreFiles.empty()) return;
+
+  promptWin.putAttribs(63,1,
+                       ((lockState == lockBottom) ? cCurrentMode : cBackground),
+                       8);
+  promptWin.putAttribs(63,2,
+                       ((lockState == lockTop)    ? cCurrentMode : cBackground),
+                       11);
+#endif
+} // end displayLockState
+
+//--------------------------------------------------------------------
+// Print a message to stderr and exit:
+//
+// Input:
+//   status:   The exit status to use
+//   message:  The message to print
+
+void exitMsg(int status, const char* message)
+{
+  ConWindow::shutdown();
+
+  cerr << endl << message << endl;
+  exit(status);
+} // end exitMsg
+
+//--------------------------------------------------------------------
+// Normalize the string in the input window:
+//
+// Does nothing unless splitHex mode is active.
+//
+// Input:
+//   pos:  The position of the cursor in buf
+//
+// Returns:
+//   true:   The input buffer was changed
+//   false:  No changes were necessary
+
+bool InputManager::normalize(int pos)
+{
+  if (!splitHex) return false;
+
+  // Change D_ to 0D:
+  if (pos && buf[pos] == ' ' && buf[pos-1] != ' ') {
+    buf[pos] = buf[pos-1];
+    buf[pos-1] = '0';
+    if (pos == len) len += 2;
+    return true;
+  }
+
+  // Change _D to 0D:
+  if (pos < len && buf[pos] == ' ' && buf[pos+1] != ' ') {
+    buf[pos] = '0';
+    return true;
+  }
+
+  return false;                 // No changes necessary
+} // end InputManager::normalize
+
+//--------------------------------------------------------------------
+// Get a string using inWin:
+//
+// Input:
+//   buf:       The buffer where the string will be stored
+//   maxLen:    The maximum number of chars to accept (not including NUL byte)
+//   history:   The history vector to use
+//   restrict:  If not NULL, accept only chars in this string
+//   upcase:    If true, convert all chars with safeUC
+//
+// Returns:
+//   true:   Enter was pressed
+//   false:  Escape was pressed
+
+bool getString(char* buf, int maxLen, StrVec& history,
+               const char* restrict=NULL,
+               bool upcase=false, bool splitHex=false)
+{
+  InputManager  manager(buf, maxLen, history);
+
+  manager.setCharacters(restrict);
+  manager.setSplitHex(splitHex);
+  manager.setUpcase(upcase);
+
+  return manager.run();
+} // end getString
+
+//--------------------------------------------------------------------
+// Construct the InputManager object:
+//
+// Input:
+//   aBuf:      The buffer where the string will be stored
+//   aMaxLen:   The maximum number of chars to accept (not including NUL byte)
+//   aHistory:  The history vector to use
+
+InputManager::InputManager(char* aBuf, int aMaxLen, StrVec& aHistory)
+: buf(aBuf),
+  restrict(NULL),
+  history(aHistory),
+  historyPos(aHistory.size()),
+  maxLen(aMaxLen),
+  len(0),
+  i(0),
+  upcase(false),
+  splitHex(false),
+  insert(true)
+{
+} // end InputManager
+
+//--------------------------------------------------------------------
+// Run the main loop to get an input string:
+//
+// Returns:
+//   true:   Enter was pressed
+//   false:  Escape was pressed
+
+bool InputManager::run()
+{
+  inWin.setCursor(2,1);
+
+  bool  inWinShown = false;
+  bool  done   = false;
+  bool  aborted = true;
+
+  ConWindow::showCursor(insert);
+
+  memset(buf, ' ', maxLen);
+  buf[maxLen] = '\0';
+
+  // We need to be able to display complete bytes:
+  if (splitHex && (maxLen % 3 == 1)) --maxLen;
+
+  // Main input loop:
+  while (!done) {
+    inWin.put(2,1,buf);
+    if (inWinShown) inWin.update(1); // Only update inside the box
+    else { inWin.update();   inWinShown = true; } // Show the input window
+    inWin.setCursor(2+i,1);
+    int key = inWin.readKey();
+    if (upcase) key = safeUC(key);
+
+    switch (key) {
+     case KEY_ESCAPE:  buf[0] = '\0';  done = true;  break; // ESC
+
+     case KEY_RETURN:           // Enter
+      normalize(i);
+      buf[len] = '\0';
+      done = true;
+      aborted = false;
+      break;
+
+     case KEY_BACKSPACE:
+     case KEY_DELETE:           // Backspace on most Unix terminals
+     case 0x08:                 // Backspace (Ctrl-H)
+      if (!i) continue; // Can't back up if we're at the beginning already
+      if (splitHex) {
+        if ((i % 3) == 0) {
+          // At the beginning of a byte; erase last digit of previous byte:
+          if (i == len) len -= 2;
+          i -= 2;
+          buf[i] = ' ';
+        } else if (i < len && buf[i] != ' ') {
+          // On the second digit; erase the first digit:
+          buf[--i] = ' ';
+        } else {
+          // On a blank second digit; delete the entire byte:
+          buf[--i] = ' ';
+          memmove(buf + i, buf + i + 3, maxLen - i - 3);
+          len -= 3;
+          if (len < i) len = i;
+        }
+      } else { // not splitHex mode
+        memmove(buf + i - 1, buf + i, maxLen - i);
+        buf[maxLen-1] = ' ';
+        --len;  --i;
+      } // end else not splitHex mode
+      break;
+
+     case 0x04:                 // Ctrl-D
+     case KEY_DC:
+      if (i >= len) continue;
+      if (splitHex) {
+        i -= i%3;
+        memmove(buf + i, buf + i + 3, maxLen - i - 3);
+        len -= 3;
+        if (len < i) len = i;
+      } else {
+        memmove(buf + i, buf + i + 1, maxLen - i - 1);
+        buf[maxLen-1] = ' ';
+        --len;
+      } // end else not splitHex mode
+      break;
+
+     case KEY_IC:
+      insert = !insert;
+      ConWindow::showCursor(insert);
+      break;
+
+     case 0x02:                 // Ctrl-B
+     case KEY_LEFT:
+      if (i) {
+        --i;
+        if (splitHex) {
+          normalize(i+1);
+          if (i % 3 == 2) --i;
+        }
+      }
+      break;
+
+     case 0x06:                 // Ctrl-F
+     case KEY_RIGHT:
+      if (i < len) {
+        ++i;
+        if (splitHex) {
+          normalize(i-1);
+          if ((i < maxLen) && (i % 3 == 2)) ++i;
+        }
+      }
+      break;
+
+     case 0x0B:                 // Ctrl-K
+      if (len > i) {
+        memset(buf + i, ' ', len - i);
+        len = i;
+      }
+      break;
+
+     case 0x01:                 // Ctrl-A
+     case KEY_HOME:
+      normalize(i);
+      i = 0;
+      break;
+
+     case 0x05:                 // Ctrl-E
+     case KEY_END:
+      if (splitHex && (i < len))
+        normalize(i);
+      i = len;
+      break;
+
+     case 0x10:                 // Ctrl-P
+     case KEY_UP:
+      if (historyPos == 0) beep();
+      else                 useHistory(-1);
+      break;
+
+     case 0x0E:                 // Ctrl-N
+     case KEY_DOWN:
+      if (historyPos == history.size()) beep();
+      else                              useHistory(+1);
+      break;
+
+     default:
+      if (isprint(key) && (!restrict || strchr(restrict, key))) {
+        if (insert) {
+          if (splitHex) {
+            if (buf[i] == ' ') {
+              if (i >= maxLen) continue;
+            } else {
+              if (len >= maxLen) continue;
+              i -= i % 3;
+              memmove(buf + i + 3, buf + i, maxLen - i - 3);
+              buf[i+1] = ' ';
+              len += 3;
+            }
+          } // end if splitHex mode
+          else {
+            if (len >= maxLen) continue;
+            memmove(buf + i + 1, buf + i, maxLen - i - 1);
+            ++len;
+          } // end else not splitHex mode
+        } else { // overstrike mode
+          if (i >= maxLen) continue;
+        } // end else overstrike mode
+        buf[i++] = key;
+        if (splitHex && (i < maxLen) && (i % 3 == 2))
+          ++i;
+        if (i > len) len = i;
+      } // end if is acceptable character to insert
+    } // end switch key
+  } // end while not done
+
+  // Hide the input window & cursor:
+  ConWindow::hideCursor();
+  inWin.hide();
+
+  // Record the result in the history:
+  if (!aborted && len) {
+    String  newValue(buf);
+
+    SVItr  exists = find(history.begin(), history.end(), newValue);
+    if (exists != history.end())
+      // Already in history.  Move it to the end:
+      rotate(exists, exists + 1, history.end());
+    else if (history.size() >= maxHistory) {
+      // History is full.  Replace the first entry & move it to the end:
+      history.front().swap(newValue);
+      rotate(history.begin(), history.begin() + 1, history.end());
+    } else
+      // Just append to history:
+      history.push_back(newValue);
+  } // end if we have a value to store in the history
+
+  return !aborted;
+} // end run
+
+//--------------------------------------------------------------------
+// Switch the current input line with one from the history:
+//
+// Input:
+//   delta:  The number to add to historyPos (-1 previous, +1 next)
+
+void InputManager::useHistory(int delta)
+{
+  // Clean up the current string if necessary:
+  normalize(i);
+
+  // Update the history overlay if necessary:
+  //   We always store the initial value, because it doesn't
+  //   correspond to a valid entry in history.
+  if (len || historyPos == history.size())
+    historyOverlay[historyPos].assign(buf, len);
+
+  // Look for an entry in the overlay:
+  SMItr itr = historyOverlay.find(historyPos += delta);
+
+  String& s = ((itr == historyOverlay.end())
+               ? history[historyPos] : itr->second);
+
+  // Store the new string in the buffer:
+  memset(buf, ' ', maxLen);
+  i = len = min(static_cast<VecSize>(maxLen), s.length());
+  memcpy(buf, s.c_str(), len);
+} // end useHistory
+
+//--------------------------------------------------------------------
+// Convert hex string to bytes:
+//
+// Input:
+//   buf:  Must contain a well-formed string of hex characters
+//         (each byte must be separated by spaces)
+//
+// Output:
+//   buf:  Contains the translated bytes
+//
+// Returns:
+//   The number of bytes in buf
+
+int packHex(Byte* buf)
+{
+  unsigned long val;
+
+  char* in  = reinterpret_cast<char*>(buf);
+  Byte* out = buf;
+
+  while (*in) {
+    if (*in == ' ')
+      ++in;
+    else {
+      val = strtoul(in, &in, 16);
+      *(out++) = Byte(val);
+    }
+  }
+
+  return out - buf;
+} // end packHex
+
+//--------------------------------------------------------------------
+// Position the input window:
+//
+// Input:
+//   cmd:     Indicates where the window should be positioned
+//   width:   The width of the window
+//   title:   The title for the window
+//   height:  The height of the window (including the border)
+
+void positionInWin(Command cmd, short width, const char* title,
+                   short height=3)
+{
+  inWin.resize(width, height);
+  inWin.move((displayWidth-width)/2,
+             ((!singleFile && (cmd & cmgGotoBottom))
+              ? ((cmd & cmgGotoTop)
+                 ? numLines + linesBetween                   // Moving both
+                 : numLines + numLines/2 + 1 + linesBetween) // Moving bottom
+              : numLines/2));                                // Moving top
+
+  inWin.border();
+  inWin.put((width-strlen(title))/2,0, title);
+} // end positionInWin
+
+//--------------------------------------------------------------------
+// Display an error message in the input window:
+//
+// Waits for a key to be pressed before hiding the window.
+//
+// Input:
+//   cmd:      Indicates where the window should be positioned
+//   message:  The message to display
+
+void showError(Command cmd, const String& message)
+{
+  positionInWin(cmd, min(int(message.length()) + 4, screenWidth), " Error ");
+
+  inWin.put(2,1, message.c_str());
+  inWin.update();
+  beep();
+  inWin.readKey();
+  inWin.hide();
+} // end showError
+
+//--------------------------------------------------------------------
+// Display prompt window for editing:
+
+void showEditPrompt()
+{
+  promptWin.clear();
+  promptWin.border();
+  promptWin.put(3,1, "Arrow keys move cursor        TAB hex\x3C\x3E"
+                "ASCII       ESC done");
+  if (displayTable == ebcdicDisplayTable)
+    promptWin.put(42,1, "EBCDIC");
+
+  promptWin.putAttribs( 3,1, cPromptKey, 10);
+  promptWin.putAttribs(33,1, cPromptKey, 3);
+  promptWin.putAttribs(54,1, cPromptKey, 3);
+
+  promptWin.put(3,2, "INS insert  DEL delete");
+  promptWin.putAttribs( 3,2, cPromptKey, 3);
+  promptWin.putAttribs(15,2, cPromptKey, 3);
+
+  if (!singleFile) {
+    promptWin.put(26,2, "RET copy byte from other file");
+    promptWin.putAttribs(26,2, cPromptKey, 3);
+  }
+  promptWin.put(59,2, "^U undo  ^R redo");
+  promptWin.putAttribs(59,2, cPromptKey, 2);
+  promptWin.putAttribs(68,2, cPromptKey, 2);
+  promptWin.update();
+} // end showEditPrompt
+
+//--------------------------------------------------------------------
+// Display prompt window:
+
+void showPrompt()
+{
+  promptWin.clear();
+  promptWin.border();
+
+#ifdef WIN32_CONSOLE
+  promptWin.put(1,1, "Arrow keys move  F find      "
+                "RET next difference  ESC quit  ALT  freeze top");
+  promptWin.put(1,2, "C ASCII/EBCDIC   E edit file   "
+                "G goto position      Q quit  CTRL freeze bottom");
+  const short
+    topBotLength = 4,
+    topLength    = 15;
+#else // curses
+  promptWin.put(1,1, "Arrow keys move  F find      "
+                "RET next difference  ESC quit  T move top");
+  promptWin.put(1,2, "C ASCII/EBCDIC   E edit file   "
+                "G goto position      Q quit  B move bottom");
+  const short
+    topBotLength = 1,
+    topLength    = 10;
+#endif
+
+  promptWin.putAttribs( 1,1, cPromptKey, 10);
+  promptWin.putAttribs(18,1, cPromptKey, 1);
+  promptWin.putAttribs(30,1, cPromptKey, 3);
+  promptWin.putAttribs(51,1, cPromptKey, 3);
+  promptWin.putAttribs( 1,2, cPromptKey, 1);
+  promptWin.putAttribs(18,2, cPromptKey, 1);
+  promptWin.putAttribs(32,2, cPromptKey, 1);
+  promptWin.putAttribs(53,2, cPromptKey, 1);
+  if (!moreFiles.empty()) {
+    // The N-way view can't find, edit, or move files separately:
+    promptWin.putChar(18,1, ' ', 6);
+    promptWin.putChar(18,2, ' ', 11);
+  }
+  if (singleFile || !moreFiles.empty()) {
+    // Erase "move top" & "move bottom":
+    promptWin.putChar(61,1, ' ', topLength);
+    promptWin.putChar(61,2, ' ', topLength + 3);
+  } else {
+    promptWin.putAttribs(61,1, cPromptKey, topBotLength);
+    promptWin.putAttribs(61,2, cPromptKey, topBotLength);
+  }
+  displayLockState();
+  displayCharacterSet();        // Calls promptWin.update()
+} // end showPrompt
+
+//--------------------------------------------------------------------
+// Initialize program:
+//
+// Returns:
+//   True:   Initialization complete
+//   False:  Error
+
+bool initialize()
+{
+#ifdef CONWIN_HEADLESS
+  if (!(headless ? ConWindow::startupHeadless() : ConWindow::startup()))
+#else
+  if (!ConWindow::startup())
+#endif
+    return false;
+
+  ConWindow::hideCursor();
+
+  calcScreenLayout(false);
+
+  inWin.init(0,0, inWidth+2,3, cPromptBdr);
+  inWin.border();
+  inWin.put((inWidth-4)/2,0, " Goto ");
+  inWin.setAttribs(cPromptWin);
+  inWin.hide();
+
+  const int  y = numFiles() * (numLines + 1) + linesBetween;
+
+  promptWin.init(0,y, displayWidth,promptHeight, cBackground);
+  showPrompt();
+
+  if (!singleFile) diffs.resize();
+
+  file1.init(0, (singleFile ? NULL : &diffs));
+
+  if (!singleFile) file2.init(numLines + linesBetween + 1, &diffs);
+
+  for (VecSize i = 0; i < moreFiles.size(); ++i)
+    moreFiles[i]->init((i + 2) * (numLines + 1) + linesBetween, &diffs);
+
+  return true;
+} // end initialize
+
+//--------------------------------------------------------------------
+// Read a command from the keyboard:
+//
+// Input:
+//   wait:  If false, return cmNothing unless a key is already waiting
+//
+// Returns:
+//   Command code
+
+#ifdef WIN32_CONSOLE
+Command readCommand(bool wait)
+{
+  KEY_EVENT_RECORD e;
+  Command  cmd = cmNothing;
+
+  while (cmd == cmNothing) {
+    if (wait)
+      ConWindow::readKey(e);
+    else if (!ConWindow::pollKey(e))
+      break;                    // No key waiting
+
+    switch (safeUC(e.uChar.AsciiChar)) {
+     case KEY_RETURN:           // Enter
+     case ' ':                  // Space
+      cmd = cmNextDiff;
+      break;
+
+     case 0x05:                 // Ctrl+E
+     case 'E':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmEditBottom;
+      else
+        cmd = cmEditTop;
+      break;
+
+     case 0x12:                 // Ctrl+R
+     case 'R':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmReplaceBottom;
+      else
+        cmd = cmReplaceTop;
+      break;
+
+     case 'U':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmUndoBottom;
+      else
+        cmd = cmUndoTop;
+      break;
+
+     case 'Y':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmRedoBottom;
+      else
+        cmd = cmRedoTop;
+      break;
+
+     case 'W':  cmd = cmSave;  break;
+
+     case 'S':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmSyncBottom;
+      else
+        cmd = cmSyncTop;
+      break;
+
+     case 'M':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmMark|cmgGotoBottom;
+      else
+        cmd = cmMark|cmgGotoBoth;
+      break;
+
+     case 'X':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmExportBottom;
+      else
+        cmd = cmExportTop;
+      break;
+
+     case 'P':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmPatchBottom;
+      else
+        cmd = cmPatchTop;
+      break;
+
+     case 'F':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmFind|cmgGotoBottom;
+      else
+        cmd = cmFind|cmgGotoBoth;
+      break;
+
+     case 0x06:               // Ctrl+F
+      cmd = cmFind|cmgGotoTop;
+      break;
+
+     case 'G':
+      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
+        cmd = cmgGoto|cmgGotoBottom;
+      else
+        cmd = cmgGoto|cmgGotoBoth;
+      break;
+
+     case 0x07:               // Ctrl+G
+      cmd = cmgGoto|cmgGotoTop;
+      break;
+
+     case KEY_ESCAPE:         // Esc
+     case 0x03:               // Ctrl+C
+     case 'Q':
+      cmd = cmQuit;
+      break;
+
+     case 'C':  cmd = cmToggleASCII;  break;
+
+     case '>':
+     case '.':  cmd = cmNextPair;  break;
+     case '<':
+     case ',':  cmd = cmPrevPair;  break;
+
+     default:                 // Try extended codes
+      switch (e.wVirtualKeyCode) {
+       case VK_DOWN:   cmd = cmmMove|cmmMoveLine|cmmMoveForward;  break;
+       case VK_RIGHT:  cmd = cmmMove|cmmMoveByte|cmmMoveForward;  break;
+       case VK_NEXT:   cmd = cmmMove|cmmMovePage|cmmMoveForward;  break;
+       case VK_END:    cmd = cmmMove|cmmMoveAll|cmmMoveForward;   break;
+       case VK_LEFT:   cmd = cmmMove|cmmMoveByte;                 break;
+       case VK_UP:     cmd = cmmMove|cmmMoveLine;                 break;
+       case VK_PRIOR:  cmd = cmmMove|cmmMovePage;                 break;
+       case VK_HOME:   cmd = cmmMove|cmmMoveAll;                  break;
+      } // end switch virtual key code
+      break;
+    } // end switch ASCII code
+  } // end while no command
+
+  if (cmd & cmmMove) {
+    if ((e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED)) == 0)
+      cmd |= cmmMoveTop;
+    if ((e.dwControlKeyState & (LEFT_CTRL_PRESSED|RIGHT_CTRL_PRESSED)) == 0)
+      cmd |= cmmMoveBottom;
+  } // end if move command
+
+  return cmd;
+} // end readCommand
+
+#else // using curses interface
+Command readCommand(bool wait)
+{
+  Command  cmd = cmNothing;
+
+  while (cmd == cmNothing) {
+    int e = (wait ? promptWin.readKey() : promptWin.pollKey());
+    if (!wait && e < 0) break;  // No key waiting
+
+    switch (safeUC(e)) {
+     case KEY_RETURN:           // Enter
+     case ' ':                  // Space
+      cmd = cmNextDiff;
+      break;
+
+     case 'E':
+      if (lockState == lockTop)
+        cmd = cmEditBottom;
+      else
+        cmd = cmEditTop;
+      break;
+
+     case 'R':
+      if (lockState == lockTop)
+        cmd = cmReplaceBottom;
+      else
+        cmd = cmReplaceTop;
+      break;
+
+     case 'U':
+      if (lockState == lockTop)
+        cmd = cmUndoBottom;
+      else
+        cmd = cmUndoTop;
+      break;
+
+     case 'Y':
+      if (lockState == lockTop)
+        cmd = cmRedoBottom;
+      else
+        cmd = cmRedoTop;
+      break;
+
+     case 'W':  cmd = cmSave;  break;
+
+     case 'S':
+      if (lockState == lockTop)
+        cmd = cmSyncBottom;
+      else
+        cmd = cmSyncTop;
+      break;
+
+     case 'M':
+      cmd = cmMark;
+      if (lockState != lockTop)    cmd |= cmgGotoTop;
+      if (lockState != lockBottom) cmd |= cmgGotoBottom;
+      break;
+
+     case 'X':
+      if (lockState == lockTop)
+        cmd = cmExportBottom;
+      else
+        cmd = cmExportTop;
+      break;
+
+     case 'P':
+      if (lockState == lockTop)
+        cmd = cmPatchBottom;
+      else
+        cmd = cmPatchTop;
+      break;
+
+     case 'F':
+      cmd = cmFind;
+      if (lockState != lockTop)    cmd |= cmgGotoTop;
+      if (lockState != lockBottom) cmd |= cmgGotoBottom;
+      break;
+
+     case 'G':
+      cmd = cmgGoto;
+      if (lockState != lockTop)    cmd |= cmgGotoTop;
+      if (lockState != lockBottom) cmd |= cmgGotoBottom;
+      break;
+
+     case KEY_ESCAPE:
+     case 0x03:               // Ctrl+C
+     case 'Q':
+      cmd = cmQuit;
+      break;
+
+     case 'C':  cmd = cmToggleASCII;  break;
+
+     case '>':
+     case '.':  cmd = cmNextPair;  break;
+     case '<':
+     case ',':  cmd = cmPrevPair;  break;
+
+     case 'B':  if (!singleFile) cmd = cmUseBottom;              break;
+     case 'T':  if (!singleFile) cmd = cmUseTop;                 break;
+
+     case KEY_DOWN:   cmd = cmmMove|cmmMoveLine|cmmMoveForward;  break;
+     case KEY_RIGHT:  cmd = cmmMove|cmmMoveByte|cmmMoveForward;  break;
+     case KEY_NPAGE:  cmd = cmmMove|cmmMovePage|cmmMoveForward;  break;
+     case KEY_END:    cmd = cmmMove|cmmMoveAll|cmmMoveForward;   break;
+     case KEY_LEFT:   cmd = cmmMove|cmmMoveByte;                 break;
+     case KEY_UP:     cmd = cmmMove|cmmMoveLine;                 break;
+     case KEY_PPAGE:  cmd = cmmMove|cmmMovePage;                 break;
+     case KEY_HOME:   cmd = cmmMove|cmmMoveAll;                  break;
+    } // end switch ASCII code
+  } // end while no command
+
+  if (cmd & cmmMove) {
+    if (lockState != lockTop)    cmd |= cmmMoveTop;
+    if (lockState != lockBottom) cmd |= cmmMoveBottom;
+  } // end if move command
+
+  return cmd;
+} // end readCommand
+#endif  // end else curses interface
+
+//--------------------------------------------------------------------
+// Get the next command:
+//
+// Returns:
+//   The command set aside by mergeMoves, or the next one from the
+//   keyboard
+
+Command getCommand()
+{
+  Command  cmd = pendingCmd;
+  pendingCmd = cmNothing;
+
+  return (cmd != cmNothing ? cmd : readCommand(true));
+} // end getCommand
+
+//--------------------------------------------------------------------
+// Combine waiting movement commands:
+//
+// When a movement key repeats faster than the screen can be updated,
+// the keystrokes pile up.  This adds every relative movement command
+// that is already waiting to the net movement of each file, so they
+// take a single update.  The first other command is set aside for
+// getCommand.  At most maxMerge commands are combined, so a stream
+// of keys can't keep the screen from updating.
+//
+// Input/Output:
+//   step1:  The net movement of the top file
+//   step2:  The net movement of the bottom file
+
+const int  maxMerge = 100;
+
+void mergeMoves(FPos& step1, FPos& step2)
+{
+  for (int n = 0; n < maxMerge; ++n) {
+    const Command  cmd = readCommand(false);
+
+    if ((cmd & cmmMove) == 0 || (cmd & cmmMoveSize) == cmmMoveAll) {
+      pendingCmd = cmd;         // Not a relative move (or no key waiting)
+      return;
+    }
+
+    const int  step = steps[cmd & cmmMoveSize];
+
+    if (cmd & cmmMoveTop)
+      step1 += ((cmd & cmmMoveForward) ? step : -step);
+    if (cmd & cmmMoveBottom)
+      step2 += ((cmd & cmmMoveForward) ? step : -step);
+  } // end for each waiting command
+} // end mergeMoves
+
+//--------------------------------------------------------------------
+// Get a file position and move there:
+
+void gotoPosition(Command cmd)
+{
+  positionInWin(cmd, inWidth+2, " Goto ");
+
+  const int  maxLen = inWidth-2;
+  char  buf[maxLen+1];
+
+  getString(buf, maxLen, positionHistory, hexDigits, true);
+
+  if (!buf[0])
+    return;
+
+  FPos  pos = strtoul(buf, NULL, 16);
+
+  if (cmd & cmgGotoTop)
+    file1.moveTo(pos);
+  if (cmd & cmgGotoBottom)
+    file2.moveTo(pos);
+} // end gotoPosition
+
+//--------------------------------------------------------------------
+// Convert a search string to the bytes to search for:
+//
+// Input:
+//   s:    The search string, as entered in the Find dialog
+//   hex:  True if s is a hex string (see packHex)
+//
+// Returns:
+//   The bytes to search for (translated to EBCDIC if necessary)
+
+String searchBytes(const String& s, bool hex)
+{
+  String  bytes(s);
+
+  if (hex) {
+    vector<Byte>  buf(s.begin(), s.end());
+    buf.push_back('\0');
+    bytes.assign(reinterpret_cast<char*>(&buf[0]), packHex(&buf[0]));
+  } else if (displayTable == ebcdicDisplayTable) {
+    for (StrItr c = bytes.begin(); c != bytes.end(); ++c)
+      *c = ascii2ebcdicTable[Byte(*c)];
+  } // end else if text in EBCDIC mode
+
+  return bytes;
+} // end searchBytes
+
+//--------------------------------------------------------------------
+// Prepare to search for text in any encoding:
+//
+// Adds the text as ASCII, EBCDIC, UTF-16LE, and UTF-16BE, and makes
+// the search ignore case, so a single pass finds every variant.  The
+// EBCDIC pattern folds case the EBCDIC way, in its own automaton.
+//
+// Input:
+//   text:  The text to search for (in ASCII)
+//
+// Output:
+//   searcher:  Contains the patterns
+
+void addEncodings(MultiSearch& searcher, const String& text)
+{
+  String  ebcdic(text), utf16le, utf16be;
+
+  for (VecSize i = 0; i < text.length(); ++i) {
+    ebcdic[i] = ascii2ebcdicTable[Byte(text[i])];
+    utf16le += text[i];
+    utf16le += '\0';
+    utf16be += '\0';
+    utf16be += text[i];
+  }
+
+  const String  label('"' + text + "\" ");
+
+  searcher.ignoreCase();
+  searcher.add(text,    label + "ASCII");
+  searcher.add(utf16le, label + "UTF-16LE");
+  searcher.add(utf16be, label + "UTF-16BE");
+  searcher.ignoreCase(ascii2ebcdicTable);
+  searcher.add(ebcdic,  label + "EBCDIC");
+  searcher.build();
+} // end addEncodings
+
+//--------------------------------------------------------------------
+// Load the patterns for a multiple pattern search:
+//
+// Each line of the file is either a sequence of hex bytes, or text
+// enclosed in double quotes.  Blank lines and lines beginning with #
+// are ignored.
+//
+// Input:
+//   fileName:  The file to read (NULL means use the search history)
+//
+// Output:
+//   searcher:  Contains the patterns
+//
+// Returns:
+//   true:   Patterns loaded
+//   false:  Unable to read the file, or it contained an invalid line
+
+bool loadPatterns(const char* fileName, MultiSearch& searcher)
+{
+  if (!fileName) {
+    SVConstItr  s;
+    for (s = hexSearchHistory.begin(); s != hexSearchHistory.end(); ++s)
+      searcher.add(searchBytes(*s, true), *s);
+    for (s = textSearchHistory.begin(); s != textSearchHistory.end(); ++s)
+      searcher.add(searchBytes(*s, false), '"' + *s + '"');
+
+    return true;
+  } // end if using search history
+
+  ifstream  in(fileName);
+  if (!in) return false;
+
+  String  line;
+  while (getline(in, line)) {
+    StrIdx  end = line.find_last_not_of(" \t\r");
+    if (end == String::npos || line[0] == '#') continue;
+    line.erase(end + 1);
+
+    if (line[0] == '"') {
+      if (line.length() < 2 || line[end] != '"') return false;
+      searcher.add(searchBytes(line.substr(1, end - 1), false), line);
+    } else {
+      if (line.find_first_not_of(" 0123456789ABCDEFabcdef") != String::npos)
+        return false;
+      searcher.add(searchBytes(line, true), line);
+    }
+  } // end while more lines
+
+  return true;
+} // end loadPatterns
+
+//--------------------------------------------------------------------
+// Replace the last search:
+//
+// Also discards the match indexes, which belonged to the old search.
+//
+// Input:
+//   searcher:  The new search (ownership is transferred)
+
+void setSearch(Searcher* searcher)
+{
+  delete lastSearch;
+  lastSearch = searcher;
+
+  file1.forgetMatches();
+  file2.forgetMatches();
+} // end setSearch
+
+//--------------------------------------------------------------------
+// Move a file to the next (or previous) match of the last search:
+//
+// Uses the match index if there is one.  Otherwise, only searching
+// forwards is possible.
+//
+// Input:
+//   file:   The file to move
+//   delta:  +1 to search forwards, -1 to search backwards
+//
+// Returns:
+//   true:   The file moved to the match
+//   false:  No match found
+
+bool moveToNextMatch(FileDisplay& file, int delta)
+{
+  if (file.haveMatches())
+    return file.moveToMatch(delta);
+
+  Match  match;
+
+  return (delta > 0 && file.moveTo(*lastSearch, match));
+} // end moveToNextMatch
+
+//--------------------------------------------------------------------
+// Search for text or bytes in the files:
+
+void searchFiles(Command cmd)
+{
+  const bool havePrev  = (lastSearch != NULL);
+  const bool haveIndex = (file1.haveMatches() || file2.haveMatches());
+
+  positionInWin(cmd, 53, " Find ", 5);
+
+  inWin.put(2, 1,"H Hex search     T Text search");
+  inWin.put(2, 2,"M Multi-pattern  R Regex");
+  inWin.put(2, 3,"X Any encoding");
+  inWin.putAttribs( 2,1, cPromptKey, 1);
+  inWin.putAttribs(19,1, cPromptKey, 1);
+  inWin.putAttribs( 2,2, cPromptKey, 1);
+  inWin.putAttribs(19,2, cPromptKey, 1);
+  inWin.putAttribs( 2,3, cPromptKey, 1);
+  if (havePrev) {
+    inWin.put(36, 1,"N Next match");
+    inWin.put(19, 3,"A Find all");
+    inWin.putAttribs(36,1, cPromptKey, 1);
+    inWin.putAttribs(19,3, cPromptKey, 1);
+  }
+  if (haveIndex) {
+    inWin.put(36, 2,"P Prev match");
+    inWin.put(36, 3,"J Jump to match");
+    inWin.putAttribs(36,2, cPromptKey, 1);
+    inWin.putAttribs(36,3, cPromptKey, 1);
+  }
+  inWin.update();
+  int key = safeUC(inWin.readKey());
+
+  if (key == KEY_ESCAPE) {
+    inWin.hide();
+    return;
+  }
+
+  int  delta = 1;               // Search forwards
+
+  if (key == 'N' && havePrev) {
+    inWin.hide();
+  } else if (key == 'P' && haveIndex) {
+    inWin.hide();
+    delta = -1;
+  } else if (key == 'A' && havePrev) {
+    inWin.hide();
+    if ((cmd & cmgGotoTop) && !file1.findAll(*lastSearch)) return;
+    if (cmd & cmgGotoBottom) file2.findAll(*lastSearch);
+    return;
+  } else if (key == 'J' && haveIndex) {
+    positionInWin(cmd, inWidth+2, " Match # ");
+
+    const int  maxLen = inWidth-2;
+    char  buf[maxLen+1];
+
+    getString(buf, maxLen, matchNumberHistory, "0123456789");
+
+    if (!buf[0]) return;
+
+    VecSize  n = strtoul(buf, NULL, 10);
+
+    if (!n ||
+        ((cmd & cmgGotoTop)    && !file1.moveToMatchNumber(n - 1)) ||
+        ((cmd & cmgGotoBottom) && !file2.moveToMatchNumber(n - 1)))
+      beep();
+    return;
+  } else if (key == 'M') {
+    positionInWin(cmd, screenWidth, " Pattern File (blank for search history) ");
+
+    const int  maxLen = screenWidth-4;
+    char  buf[maxLen+1];
+
+    if (!getString(buf, maxLen, patternFileHistory)) return;
+
+    MultiSearch*  searcher = new MultiSearch;
+
+    if (!loadPatterns((buf[0] ? buf : NULL), *searcher) ||
+        !searcher->size()) {
+      delete searcher;
+      beep();
+      return;
+    }
+
+    searcher->build();
+    setSearch(searcher);
+  } else if (key == 'X') {
+    positionInWin(cmd, screenWidth, " Find Text (Any Encoding or Case) ");
+
+    const int  maxLen = screenWidth-4;
+    char  buf[maxLen+1];
+
+    if (!getString(buf, maxLen, textSearchHistory) || !buf[0]) return;
+
+    MultiSearch*  searcher = new MultiSearch;
+    addEncodings(*searcher, buf);
+    setSearch(searcher);
+  } else if (key == 'R') {
+    positionInWin(cmd, screenWidth, " Find Regular Expression ");
+
+    const int  maxLen = screenWidth-4;
+    char  buf[maxLen+1];
+
+    if (!getString(buf, maxLen, regexSearchHistory) || !buf[0]) return;
+
+    RegexSearch*  searcher = new RegexSearch;
+    String        error;
+
+    if (!searcher->compile(buf, error)) {
+      delete searcher;
+      showError(cmd, error);
+      return;
+    }
+
+    setSearch(searcher);
+  } else {
+    const bool hex = (key == 'H');
+
+    positionInWin(cmd, screenWidth, (hex ? " Find Hex Bytes" : " Find Text "));
+
+    const int  maxLen = screenWidth-4;
+    char  buf[maxLen+1];
+
+    if (hex)
+      getString(buf, maxLen, hexSearchHistory, hexDigits, true, true);
+    else
+      getString(buf, maxLen, textSearchHistory);
+
+    const String  searchFor(searchBytes(buf, hex));
+
+    if (searchFor.empty()) return;
+
+    setSearch(new ExactSearch(reinterpret_cast<const Byte*>(searchFor.data()),
+                              searchFor.length()));
+  } // end else need to read search string
+
+  bool problem = false;
+
+  if ((cmd & cmgGotoTop) && !moveToNextMatch(file1, delta))
+    problem = true;
+  if ((cmd & cmgGotoBottom) && !moveToNextMatch(file2, delta))
+    problem = true;
+
+  if (problem) beep();
+} // end searchFiles
+
+//--------------------------------------------------------------------
+// Replace every occurrence of text or bytes in a file:
+//
+// The replacement must be the same length as the search string.
+// All the matches are found (and counted) before the user is asked
+// to confirm the replacement.
+//
+// Input:
+//   cmd:  cmReplaceTop or cmReplaceBottom
+
+void replaceBytes(Command cmd)
+{
+  FileDisplay&   file  = (cmd == cmReplaceTop ? file1 : file2);
+  const Command  where = (cmd == cmReplaceTop ? cmgGotoTop : cmgGotoBottom);
+
+  if (file.modified()) {
+    // Replacing works on the file itself, so it must be up to date:
+    showError(where, "Save your changes (press W) before replacing");
+    return;
+  }
+
+  positionInWin(where, 32, " Replace ");
+
+  inWin.put(2, 1,"H Hex bytes     T Text");
+  inWin.putAttribs( 2,1, cPromptKey, 1);
+  inWin.putAttribs(18,1, cPromptKey, 1);
+  inWin.update();
+  int key = safeUC(inWin.readKey());
+
+  if (key != 'H' && key != 'T') {
+    inWin.hide();
+    return;
+  }
+
+  const bool hex = (key == 'H');
+  StrVec&    history = (hex ? hexSearchHistory : textSearchHistory);
+
+  const int  maxLen = screenWidth-4;
+  char  buf[maxLen+1];
+
+  positionInWin(where, screenWidth, (hex ? " Replace Hex Bytes " : " Replace Text "));
+  if (hex)
+    getString(buf, maxLen, history, hexDigits, true, true);
+  else
+    getString(buf, maxLen, history);
+
+  const String  searchFor(searchBytes(buf, hex));
+  if (searchFor.empty()) return;
+
+  positionInWin(where, screenWidth, " With ");
+  if (hex)
+    getString(buf, maxLen, history, hexDigits, true, true);
+  else
+    getString(buf, maxLen, history);
+
+  const String  replaceWith(searchBytes(buf, hex));
+  if (replaceWith.empty()) return;
+
+  if (replaceWith.length() != searchFor.length()) {
+    showError(where, "The replacement must be the same length as the "
+              "search string");
+    return;
+  }
+
+  setSearch(new ExactSearch(reinterpret_cast<const Byte*>(searchFor.data()),
+                            searchFor.length()));
+
+  if (!file.findAll(*lastSearch)) return; // Cancelled
+
+  const VecSize  count = file.matchCount();
+
+  if (!count) {
+    file.forgetMatches();
+    showError(where, "Not found");
+    return;
+  }
+
+  // Show the matches while asking for confirmation:
+  file.showMatchCount(*lastSearch);
+  file.display();
+
+  ostringstream  msg;
+  msg << "Replace " << count << (count == 1 ? " match" : " matches")
+      << " (Y/N):";
+
+  promptWin.clear();
+  promptWin.border();
+  promptWin.put(30,1, msg.str().c_str());
+  promptWin.update();
+  promptWin.setCursor(31 + msg.str().length(), 1);
+  ConWindow::showCursor();
+  key = promptWin.readKey();
+  ConWindow::hideCursor();
+  showPrompt();
+
+  if (safeUC(key) != 'Y') return;
+
+  VecSize  replaced;
+  bool     ok = file.replaceMatches(replaceWith, replaced);
+
+  msg.str("");
+  msg << "Replaced " << replaced << " of " << count;
+  if (!ok) msg << " (stopped)";
+
+  file.setStatus(msg.str());
+  if (!ok) beep();
+} // end replaceBytes
+
+//--------------------------------------------------------------------
+// Find the end of a run of differences (as a Task):
+//
+// Compares the documents (including unsaved changes) in blocks, so a
+// run can be much longer than the screen.  The run ends at the first
+// runGap bytes in a row that are the same in both files, so bytes
+// that just happen to match don't break it up.
+//
+// Input:
+//   file:   The file that will be changed
+//   other:  The file to compare it with
+//   start:  The position in file of the first differing byte
+//   delta:  The position in other minus the position in file
+//
+// Output:
+//   end:    The position in file just past the run (or just past the
+//           end of other, if it ends first)
+
+class RunTask : public Task
+{
+ public:
+  FPos  end;
+
+  RunTask(const FileDisplay& aFile, const FileDisplay& aOther,
+          FPos aStart, FPos aDelta)
+    : end(aStart), file(aFile), other(aOther), delta(aDelta) {};
+  virtual void run(Progress& progress);
+
+ protected:
+  const FileDisplay&  file;
+  const FileDisplay&  other;
+  FPos                delta;
+}; // end RunTask
+
+const int  runGap = 16;          // Matching bytes that end a run
+
+void RunTask::run(Progress& progress)
+{
+  const int  blockSize = 64 * 1024;
+
+  Byte *const  buf1 = new Byte[2 * blockSize];
+  Byte *const  buf2 = buf1 + blockSize;
+
+  FPos  pos  = end;
+  int   same = 0;                // Matching bytes since the last difference
+
+  while (same < runGap && progress.update(pos)) {
+    const int  size1 = file.read(pos, buf1, blockSize);
+    const int  size2 = other.read(pos + delta, buf2, blockSize);
+    const int  size  = min(size1, size2);
+
+    for (int i = 0; i < size && same < runGap; ++i)
+      if (buf1[i] != buf2[i]) {
+        end  = pos + i + 1;
+        same = 0;
+      } else
+        ++same;
+
+    if (same < runGap && size1 < size2)
+      end = pos + size2;        // Bytes past the end of file all differ
+
+    if (size2 < blockSize) break; // Reached the end of other
+
+    pos += blockSize;
+  } // end while in the run and not cancelled
+
+  delete [] buf1;
+} // end RunTask::run
+
+//--------------------------------------------------------------------
+// Copy bytes from the other file:
+//
+// Copies either the first run of differences on the screen (however
+// long it is) or the marked region.
+//
+// Input:
+//   cmd:  cmSyncTop or cmSyncBottom (the file to change)
+
+void syncBytes(Command cmd)
+{
+  FileDisplay&   file  = (cmd == cmSyncTop ? file1 : file2);
+  FileDisplay&   other = (cmd == cmSyncTop ? file2 : file1);
+  const Command  where = (cmd == cmSyncTop ? cmgGotoTop : cmgGotoBottom);
+
+  FPos  start = 0, count = 0;
+  const bool  haveRegion = file.getRegion(start, count);
+
+  positionInWin(where, 40, " Copy From Other File ");
+
+  inWin.put(2, 1,"D Difference run");
+  inWin.putAttribs(2,1, cPromptKey, 1);
+  if (haveRegion) {
+    inWin.put(21, 1,"M Marked region");
+    inWin.putAttribs(21,1, cPromptKey, 1);
+  }
+  inWin.update();
+  const int key = safeUC(inWin.readKey());
+  inWin.hide();
+
+  if (key == 'D') {
+    const int  first = diffs.firstDiff();
+    if (first < 0) {
+      showError(where, "There are no differences on the screen");
+      return;
+    }
+
+    start = file.getOffset() + first;
+
+    RunTask   task(file, other, start, other.getOffset() - file.getOffset());
+    Progress  progress("Comparing", start,
+                       max(file.fileSize(), other.fileSize()));
+
+    if (!progress.run(task)) return; // Cancelled
+    count = task.end - start;
+  } else if (key != 'M' || !haveRegion)
+    return;
+
+  if (!file.copyFrom(other, start, count)) {
+    showError(where, String("Unable to edit file: ") + ErrorMsg());
+    return;
+  }
+
+  if (!count) {
+    showError(where, "The other file has no bytes there");
+    return;
+  }
+
+  ostringstream  msg;
+  msg << "Copied " << count << (count == 1 ? " byte" : " bytes");
+  file.setStatus(msg.str());
+} // end syncBytes
+
+//--------------------------------------------------------------------
+// Write the marked region of a file to a new file:
+//
+// Input:
+//   cmd:  cmExportTop or cmExportBottom
+
+void exportRegion(Command cmd)
+{
+  FileDisplay&   file  = (cmd == cmExportTop ? file1 : file2);
+  const Command  where = (cmd == cmExportTop ? cmgGotoTop : cmgGotoBottom);
+
+  FPos  start, count;
+
+  if (!file.getRegion(start, count)) {
+    showError(where, "Press M to mark one end of the region first");
+    return;
+  }
+
+  positionInWin(where, screenWidth, " Write Marked Region to File ");
+
+  const int  maxLen = screenWidth-4;
+  char  buf[maxLen+1];
+
+  if (!getString(buf, maxLen, exportFileHistory) || !buf[0]) return;
+
+  bool  cancelled;
+
+  if (!file.writeRegion(buf, count, cancelled)) {
+    if (!cancelled)
+      showError(where, String("Unable to write file: ") + ErrorMsg());
+    return;
+  }
+
+  ostringstream  msg;
+  msg << "Wrote " << count << (count == 1 ? " byte" : " bytes");
+  file.setStatus(msg.str());
+} // end exportRegion
+
+//====================================================================
+// Patch files:
+//
+// A patch turns one file (the base) into another (the target).  It
+// lists the ranges where the target differs from the base, along with
+// hashes to check that it is applied to the right file.  Numbers are
+// 8 byte little-endian integers.  A patch starts with:
+//
+//   "VBDPATCH"  Identifies the file (8 bytes)
+//   version     The format version (2)
+//
+// Then comes a hunk for each range that changed, in order:
+//
+//   'H'         Starts a hunk (1 byte)
+//   position    Where the range starts
+//   length      The number of bytes in the range
+//   old hash    The hash of the base bytes the range replaces (only
+//               those before the end of the base)
+//   new hash    The hash of the target bytes
+//   data        The target bytes (length bytes)
+//
+// And it ends with a trailer:
+//
+//   'E'         Ends the patch (1 byte)
+//   base size, base hash, target size, target hash
+//
+// The hashes are 64 bit FNV-1a.  To apply a patch, write each hunk
+// over the base, then set the file's size to the target size.
+//--------------------------------------------------------------------
+
+const char  patchMagic[]    = "VBDPATCH";
+const Hash  patchVersion    = 2;
+const int   patchNumberSize = 8;
+const int   patchHunkSize   = 64 * 1024; // The longest hunk written
+
+const Hash  fnvBasis = 14695981039346656037ULL;
+const Hash  fnvPrime = 1099511628211ULL;
+
+//--------------------------------------------------------------------
+// Add bytes to an FNV-1a hash:
+//
+// Input:
+//   hash:  The hash so far (fnvBasis to start a new one)
+//   buf:   The bytes to add
+//   size:  The number of bytes in buf
+//
+// Returns:
+//   The new hash
+
+Hash hashBytes(Hash hash, const Byte* buf, int size)
+{
+  while (size-- > 0) {
+    hash ^= *(buf++);
+    hash *= fnvPrime;
+  }
+
+  return hash;
+} // end hashBytes
+
+//--------------------------------------------------------------------
+// Store a number in a patch:
+//
+// Input:
+//   out:  Where to store it (patchNumberSize bytes)
+//   n:    The number to store
+
+void packNumber(Byte* out, Hash n)
+{
+  for (int i = 0; i < patchNumberSize; ++i, n >>= 8)
+    out[i] = Byte(n & 0xFF);
+} // end packNumber
+
+//--------------------------------------------------------------------
+// Read a number from a patch:
+//
+// Input:
+//   in:  Where the number is stored (patchNumberSize bytes)
+
+Hash unpackNumber(const Byte* in)
+{
+  Hash  n = 0;
+
+  for (int i = patchNumberSize; i-- > 0; )
+    n = (n << 8) | in[i];
+
+  return n;
+} // end unpackNumber
+
+//--------------------------------------------------------------------
+// Write a patch (as a Task):
+//
+// Reads both files once, in blocks, so the memory used doesn't depend
+// on the size of the files or the differences.  Like a difference
+// run, a hunk ends only at runGap matching bytes in a row, and long
+// ranges are split into hunks of at most patchHunkSize bytes.
+//
+// Input:
+//   base:    The file the patch will be applied to
+//   target:  The file the patch will produce
+//   out:     The patch file (positioned at the start)
+//
+// Output:
+//   ok:      False if an error occurred (or the user cancelled)
+//   hunks:   The number of hunks written
+//   bytes:   The number of target bytes in them
+
+class PatchTask : public Task
+{
+ public:
+  bool     ok;
+  VecSize  hunks;
+  FPos     bytes;
+
+  PatchTask(const FileDisplay& aBase, const FileDisplay& aTarget, File aOut)
+    : ok(false), hunks(0), bytes(0), base(aBase), target(aTarget),
+      out(aOut), hunkPos(0) {};
+  virtual void run(Progress& progress);
+
+ protected:
+  const FileDisplay&  base;
+  const FileDisplay&  target;
+  File                out;
+  FPos                hunkPos;  // Where the current hunk starts
+  vector<Byte>        newBytes; // The target bytes in the current hunk
+  vector<Byte>        oldBytes; // The base bytes they replace
+
+  bool  writeHunk(VecSize length);
+}; // end PatchTask
+
+void PatchTask::run(Progress& progress)
+{
+  const int  blockSize = 64 * 1024;
+
+  Byte *const  buf1 = new Byte[2 * blockSize];
+  Byte *const  buf2 = buf1 + blockSize;
+
+  Byte  header[2 * patchNumberSize];
+  memcpy(header, patchMagic, patchNumberSize);
+  packNumber(header + patchNumberSize, patchVersion);
+
+  ok = WriteFile(out, header, sizeof(header));
+
+  Hash  baseHash   = fnvBasis;
+  Hash  targetHash = fnvBasis;
+  FPos  baseSize   = 0;
+  FPos  targetSize = 0;
+  int   same       = 0;         // Matching bytes since the last difference
+
+  for (FPos pos = 0; ok; pos += blockSize) {
+    if (!progress.update(pos)) {
+      ok = false;
+      break;
+    }
+
+    const int  size1 = base.read(pos, buf1, blockSize);
+    const int  size2 = target.read(pos, buf2, blockSize);
+
+    if (size1 <= 0 && size2 <= 0) break; // Reached the end of both files
+
+    baseHash   = hashBytes(baseHash,   buf1, size1);
+    targetHash = hashBytes(targetHash, buf2, size2);
+    baseSize   += max(size1, 0);
+    targetSize += max(size2, 0);
+
+    for (int i = 0; ok && i < size2; ++i) {
+      const bool  differ = (i >= size1 || buf1[i] != buf2[i]);
+
+      if (newBytes.empty()) {
+        if (!differ) continue;
+        hunkPos = pos + i;
+        same    = 0;
+      } else if (differ)
+        same = 0;
+      else
+        ++same;
+
+      newBytes.push_back(buf2[i]);
+      if (i < size1) oldBytes.push_back(buf1[i]);
+
+      if (same >= runGap || newBytes.size() >= VecSize(patchHunkSize))
+        ok = writeHunk(newBytes.size() - same);
+    } // end for each byte in the target's block
+  } // end for each block
+
+  delete [] buf1;
+
+  if (ok && !newBytes.empty())
+    ok = writeHunk(newBytes.size() - same);
+
+  if (ok) {
+    Byte  trailer[1 + 4 * patchNumberSize];
+    trailer[0] = 'E';
+    packNumber(trailer + 1,                     baseSize);
+    packNumber(trailer + 1 +   patchNumberSize, baseHash);
+    packNumber(trailer + 1 + 2*patchNumberSize, targetSize);
+    packNumber(trailer + 1 + 3*patchNumberSize, targetHash);
+
+    ok = WriteFile(out, trailer, sizeof(trailer));
+  }
+} // end PatchTask::run
+
+//--------------------------------------------------------------------
+// Write the current hunk to the patch:
+//
+// Input:
+//   length:  The number of bytes in the hunk (the rest of newBytes
+//            are the same in both files, and are discarded)
+//
+// Returns:
+//   true:   The hunk was written
+//   false:  An error occurred
+
+bool PatchTask::writeHunk(VecSize length)
+{
+  const VecSize  oldLength = min(length, oldBytes.size());
+
+  Byte  header[1 + 4 * patchNumberSize];
+  header[0] = 'H';
+  packNumber(header + 1,                   hunkPos);
+  packNumber(header + 1 + patchNumberSize, length);
+  packNumber(header + 1 + 2*patchNumberSize,
+             (oldLength ? hashBytes(fnvBasis, &oldBytes[0], oldLength)
+                        : fnvBasis));
+  packNumber(header + 1 + 3*patchNumberSize,
+             hashBytes(fnvBasis, &newBytes[0], length));
+
+  const bool  ok = (WriteFile(out, header, sizeof(header)) &&
+                    WriteFile(out, &newBytes[0], length));
+
+  ++hunks;
+  bytes += length;
+  newBytes.clear();
+  oldBytes.clear();
+
+  return ok;
+} // end PatchTask::writeHunk
+
+//--------------------------------------------------------------------
+// Write a patch that turns one file into the other:
+//
+// Input:
+//   cmd:  cmPatchTop to turn the top file into the bottom one, or
+//         cmPatchBottom for the reverse
+
+void exportPatch(Command cmd)
+{
+  FileDisplay&   base   = (cmd == cmPatchTop ? file1 : file2);
+  FileDisplay&   target = (cmd == cmPatchTop ? file2 : file1);
+  const Command  where  = (cmd == cmPatchTop ? cmgGotoTop : cmgGotoBottom);
+
+  if (base.modified() || target.modified()) {
+    showError(where, "Save your changes (press W) before writing a patch");
+    return;
+  }
+
+  positionInWin(where, screenWidth, " Write Patch to File ");
+
+  const int  maxLen = screenWidth-4;
+  char  buf[maxLen+1];
+
+  if (!getString(buf, maxLen, exportFileHistory) || !buf[0]) return;
+
+  File  out = CreateNewFile(buf);
+
+  if (out == InvalidFile) {
+    showError(where, String("Unable to write file: ") + ErrorMsg());
+    return;
+  }
+
+  PatchTask  task(base, target, out);
+  Progress   progress("Writing patch", 0,
+                      max(base.fileSize(), target.fileSize()));
+
+  const bool  cancelled = !progress.run(task);
+  const bool  ok        = (!cancelled && task.ok);
+  const String  error(ok || cancelled ? "" : ErrorMsg());
+
+  CloseFile(out);
+
+  if (!ok) {
+    RemoveFile(buf);
+    if (!cancelled) showError(where, "Unable to write file: " + error);
+    return;
+  }
+
+  ostringstream  msg;
+  msg << "Wrote " << task.hunks << (task.hunks == 1 ? " hunk, " : " hunks, ")
+      << task.bytes << (task.bytes == 1 ? " byte" : " bytes");
+  base.setStatus(msg.str());
+} // end exportPatch
+
+//--------------------------------------------------------------------
+// A patch that has been read:
+//
+// Member Variables:
+//   baseSize, baseHash:      The file the patch applies to
+//   targetSize, targetHash:  The file it produces
+//   hunks:                   The hunks, in order (not their data)
+
+struct PatchHunk
+{
+  FPos  pos;                    // Where the range starts
+  FPos  length;                 // The number of bytes in the range
+  FPos  data;                   // Where the bytes are in the patch file
+  Hash  oldHash;                // The hash of the bytes they replace
+  Hash  newHash;                // The hash of the new bytes
+}; // end PatchHunk
+
+struct Patch
+{
+  FPos               baseSize;
+  Hash               baseHash;
+  FPos               targetSize;
+  Hash               targetHash;
+  vector<PatchHunk>  hunks;
+}; // end Patch
+
+//--------------------------------------------------------------------
+// Hash part of a file:
+//
+// Input:
+//   file:   The file to read
+//   pos:    The position of the first byte to hash
+//   count:  The number of bytes to hash
+//
+// Output:
+//   hash:   The hash of those bytes
+//
+// Returns:
+//   true:   The bytes were hashed
+//   false:  Unable to read them all (call ErrorMsg for error message)
+
+bool hashFile(File file, FPos pos, FPos count, Hash& hash)
+{
+  Byte  buf[64 * 1024];
+
+  hash = fnvBasis;
+
+  if (SeekFile(file, pos) != pos) return false;
+
+  while (count > 0) {
+    const Size  got = ReadFile(file, buf, Size(min(count, FPos(sizeof(buf)))));
+    if (got <= 0) return false;
+
+    hash   = hashBytes(hash, buf, got);
+    count -= got;
+  } // end while more to hash
+
+  return true;
+} // end hashFile
+
+//--------------------------------------------------------------------
+// Read the hunks and trailer of a patch:
+//
+// Only the hunk headers are read; the data is skipped.
+//
+// Input:
+//   file:   The patch file (positioned at the start)
+//
+// Output:
+//   patch:  The patch
+//   error:  What was wrong with it
+//
+// Returns:
+//   true:   The patch was read
+//   false:  The file is not a valid patch
+
+bool readPatch(File file, Patch& patch, String& error)
+{
+  const FPos  fileSize = SeekFile(file, 0, SeekEnd);
+  Byte        buf[1 + 4 * patchNumberSize];
+
+  if (SeekFile(file, 0) != 0 ||
+      ReadFile(file, buf, 2 * patchNumberSize) != 2 * patchNumberSize ||
+      memcmp(buf, patchMagic, patchNumberSize)) {
+    error = "Not a VBinDiff patch";
+    return false;
+  }
+
+  if (unpackNumber(buf + patchNumberSize) != patchVersion) {
+    error = "Unsupported patch version";
+    return false;
+  }
+
+  FPos  at  = 2 * patchNumberSize; // The position in the patch
+  FPos  end = 0;                   // The end of the last hunk
+
+  patch.hunks.clear();
+
+  for (;;) {
+    if (ReadFile(file, buf, 1) != 1) break;
+
+    if (buf[0] == 'E') {
+      if (ReadFile(file, buf + 1, 4 * patchNumberSize) != 4*patchNumberSize ||
+          at + 1 + 4 * patchNumberSize != fileSize)
+        break;
+
+      patch.baseSize   = unpackNumber(buf + 1);
+      patch.baseHash   = unpackNumber(buf + 1 +   patchNumberSize);
+      patch.targetSize = unpackNumber(buf + 1 + 2*patchNumberSize);
+      patch.targetHash = unpackNumber(buf + 1 + 3*patchNumberSize);
+
+      if (patch.baseSize < 0 || patch.targetSize < end) break;
+
+      return true;
+    } // end if trailer
+
+    if (buf[0] != 'H' ||
+        ReadFile(file, buf + 1, 4 * patchNumberSize) != 4 * patchNumberSize)
+      break;
+
+    PatchHunk  hunk;
+    hunk.pos     = unpackNumber(buf + 1);
+    hunk.length  = unpackNumber(buf + 1 + patchNumberSize);
+    hunk.oldHash = unpackNumber(buf + 1 + 2*patchNumberSize);
+    hunk.newHash = unpackNumber(buf + 1 + 3*patchNumberSize);
+    hunk.data    = at + 1 + 4 * patchNumberSize;
+
+    at = hunk.data + hunk.length;
+
+    if (hunk.pos < end || hunk.length <= 0 || at > fileSize ||
+        SeekFile(file, at) != at)
+      break;
+
+    end = hunk.pos + hunk.length;
+    patch.hunks.push_back(hunk);
+  } // end forever
+
+  error = "The patch is damaged";
+  return false;
+} // end readPatch
+
+//--------------------------------------------------------------------
+// Write the hunks of a patch to a file:
+//
+// Uses positioned writes, so bytes that don't change are never read
+// or written.
+//
+// Input:
+//   file:   The patch file
+//   patch:  The patch
+//   out:    The file to write to
+//
+// Returns:
+//   true:   The hunks were written
+//   false:  An error occurred (call ErrorMsg for error message)
+
+bool writeHunks(File file, const Patch& patch, File out)
+{
+  Byte  buf[64 * 1024];
+
+  for (vector<PatchHunk>::const_iterator h = patch.hunks.begin();
+       h != patch.hunks.end(); ++h) {
+    if (SeekFile(file, h->data) != h->data ||
+        SeekFile(out, h->pos) != h->pos) return false;
+
+    for (FPos left = h->length; left > 0; ) {
+      const Size  got = ReadFile(file, buf, Size(min(left, FPos(sizeof(buf)))));
+      if (got <= 0 || !WriteFile(out, buf, got)) return false;
+
+      left -= got;
+    } // end while more data in this hunk
+  } // end for each hunk
+
+  return true;
+} // end writeHunks
+
+//--------------------------------------------------------------------
+// Report an error about a file (when running without the display):
+//
+// Input:
+//   name:     The file the error is about
+//   message:  What went wrong
+//   status:   The exit status to return
+//
+// Returns:
+//   status
+
+int fileError(const char* name, const String& message, int status=1)
+{
+  cerr << program_name << ": " << name << ": " << message << endl;
+  return status;
+} // end fileError
+
+//--------------------------------------------------------------------
+// Apply a patch (the --apply mode):
+//
+// Before writing anything, checks that the base is the right size,
+// that each hunk matches the bytes it replaces, and that each hunk's
+// data matches its hash.  After writing, reads each hunk back and
+// checks it.  Bytes that don't change are never read, so a small
+// patch to a huge file is quick.  (When writing a new file, the base
+// is copied with CopyFileRange, which shares the blocks on
+// filesystems that allow it.  The whole new file is then checked
+// against the target hash, since it must be read only once.)
+//
+// Input:
+//   patchName:  The patch file
+//   baseName:   The file to apply it to
+//   outName:    The file to create (NULL means change baseName)
+//
+// Returns:
+//   The exit status (0 for success; errors are reported on cerr)
+
+int applyPatch(const char* patchName, const char* baseName,
+               const char* outName)
+{
+  File  file = OpenFile(patchName);
+  if (file == InvalidFile) return fileError(patchName, ErrorMsg());
+
+  Patch   patch;
+  String  error;
+
+  if (!readPatch(file, patch, error)) return fileError(patchName, error);
+
+  File  base = OpenFile(baseName, !outName);
+  if (base == InvalidFile) return fileError(baseName, ErrorMsg());
+
+  if (SeekFile(base, 0, SeekEnd) != patch.baseSize)
+    return fileError(baseName, "The file is not the size the patch expects");
+
+  for (vector<PatchHunk>::const_iterator h = patch.hunks.begin();
+       h != patch.hunks.end(); ++h) {
+    Hash  hash;
+
+    if (!hashFile(base, h->pos,
+                  max(min(h->length, patch.baseSize - h->pos), FPos(0)),
+                  hash))
+      return fileError(baseName, ErrorMsg());
+
+    if (hash != h->oldHash)
+      return fileError(baseName, "The file does not match the patch at "
+                                 + formatPos(h->pos));
+
+    if (!hashFile(file, h->data, h->length, hash))
+      return fileError(patchName, ErrorMsg());
+
+    if (hash != h->newHash)
+      return fileError(patchName, "The patch is damaged at "
+                                  + formatPos(h->pos));
+  } // end for each hunk
+
+  File  out = base;
+
+  if (outName) {
+    out = CreateNewFile(outName);
+    if (out == InvalidFile) return fileError(outName, ErrorMsg());
+
+    if (!CopyFileRange(base, 0, out, min(patch.baseSize, patch.targetSize)))
+      error = ErrorMsg();
+  }
+
+  const char*  outFile = (outName ? outName : baseName);
+
+  if (error.empty() &&
+      (!writeHunks(file, patch, out) ||
+       !ResizeFile(out, patch.targetSize) || !SyncFile(out)))
+    error = ErrorMsg();
+
+  for (vector<PatchHunk>::const_iterator h = patch.hunks.begin();
+       error.empty() && h != patch.hunks.end(); ++h) {
+    Hash  hash;
+
+    if (!hashFile(out, h->pos, h->length, hash))
+      error = ErrorMsg();
+    else if (hash != h->newHash)
+      error = ("The patched bytes did not read back correctly at "
+               + formatPos(h->pos));
+  } // end for each hunk
+
+  if (error.empty() && SeekFile(out, 0, SeekEnd) != patch.targetSize)
+    error = "The patched file is the wrong size";
+
+  if (error.empty() && outName) {
+    Hash  hash;
+
+    if (!hashFile(out, 0, patch.targetSize, hash))
+      error = ErrorMsg();
+    else if (hash != patch.targetHash)
+      error = "The patched file does not match the patch";
+  } // end if new file written
+
+  if (outName) CloseFile(out);
+  CloseFile(base);
+  CloseFile(file);
+
+  if (!error.empty()) {
+    if (outName) RemoveFile(outName);
+    return fileError(outFile, error);
+  }
+
+  return 0;
+} // end applyPatch
+
+//====================================================================
+// Comparing files without the display:
+//--------------------------------------------------------------------
+
+const int  streamBlockSize = 1024 * 1024; // Bytes read at a time
+
+//--------------------------------------------------------------------
+// Receive the differences found by compareFiles:
+//
+// found is called for each run of differing bytes, in order.  A run
+// that crosses the end of a block is passed in pieces.  Past the end
+// of the shorter file, its buffer is NULL.  found returns false to
+// stop the comparison.
+
+class DiffHandler
+{
+ public:
+  virtual ~DiffHandler() {};
+  virtual bool found(FPos pos, const Byte* buf1, const Byte* buf2,
+                     int count) = 0;
+}; // end DiffHandler
+
+//--------------------------------------------------------------------
+// Fill a buffer from a file:
+//
+// Keeps reading until the buffer is full or the file ends, so both
+// files stay in step.
+//
+// Returns:
+//   The number of bytes read (less than size only at the end of the
+//   file), or -1 if an error occurred
+
+int readBlock(File file, Byte* buf, int size)
+{
+  int  got = 0;
+
+  while (got < size) {
+    const Size  bytesRead = ReadFile(file, buf + got, size - got);
+    if (bytesRead < 0) return -1;
+    if (bytesRead == 0) break;
+    got += bytesRead;
+  }
+
+  return got;
+} // end readBlock
+
+//--------------------------------------------------------------------
+// Count the matching bytes at the start of two buffers:
+//
+// Skips matching stretches a chunk at a time with memcmp, which is
+// much faster than comparing bytes one by one.
+
+int matchLength(const Byte* buf1, const Byte* buf2, int size)
+{
+  const int  chunk = 256;
+  int        i     = 0;
+
+  while (i + chunk <= size && !memcmp(buf1 + i, buf2 + i, chunk))
+    i += chunk;
+
+  while (i < size && buf1[i] == buf2[i])
+    ++i;
+
+  return i;
+} // end matchLength
+
+//--------------------------------------------------------------------
+// Compare two files, passing the differences to a handler:
+//
+// Reads each file once, from the current position, in blocks of
+// streamBlockSize, so it needs the same memory for any size of file.
+// Bytes past the end of the shorter file all differ.
+//
+// Input:
+//   file1, file2:  The files to compare (positioned at the start)
+//   handler:       Receives the differences
+//
+// Returns:
+//   true:   The comparison finished (or the handler stopped it)
+//   false:  Unable to read a file (call ErrorMsg for error message)
+
+bool compareFiles(File file1, File file2, DiffHandler& handler)
+{
+  Byte *const  buf1 = new Byte[2 * streamBlockSize];
+  Byte *const  buf2 = buf1 + streamBlockSize;
+
+  bool  ok   = true;
+  bool  more = true;
+
+  for (FPos pos = 0; more; pos += streamBlockSize) {
+    const int  size1 = readBlock(file1, buf1, streamBlockSize);
+    const int  size2 = readBlock(file2, buf2, streamBlockSize);
+
+    if (size1 < 0 || size2 < 0) {
+      ok = false;
+      break;
+    }
+
+    const int  size = min(size1, size2);
+
+    for (int i = 0; more && i < size; ) {
+      i += matchLength(buf1 + i, buf2 + i, size - i);
+
+      int  end = i;
+      while (end < size && buf1[end] != buf2[end])
+        ++end;
+
+      if (end > i)
+        more = handler.found(pos + i, buf1 + i, buf2 + i, end - i);
+
+      i = end;
+    } // end for each run of differences in this block
+
+    if (more && size1 != size2)
+      more = handler.found(pos + size,
+                           (size1 > size ? buf1 + size : NULL),
+                           (size2 > size ? buf2 + size : NULL),
+                           max(size1, size2) - size);
+
+    if (size1 < streamBlockSize || size2 < streamBlockSize)
+      break;                    // Reached the end of a file
+  } // end for each block
+
+  delete [] buf1;
+
+  return ok;
+} // end compareFiles
+
+//--------------------------------------------------------------------
+// Write a list of the differing ranges (the --report mode):
+//
+// Joins the pieces passed to found into ranges, and writes each one
+// as soon as it ends, so the memory used is the same for any number
+// of differences.  At most reportBytes bytes of each range are kept
+// for --bytes.
+//
+// Member Variables:
+//   format:     How to write the report
+//   showBytes:  True if the report includes each range's first bytes
+//   ranges:     The number of ranges written
+//   total:      The number of differing bytes
+//   start:      The position of the current range
+//   length:     The length of the current range (0 if none)
+//   bytes1/2:   The first bytes of the current range in each file
+//   have1/2:    The number of bytes in bytes1/2
+
+const int  reportBytes = 16;    // The most bytes shown for each range
+
+class ReportWriter : public DiffHandler
+{
+ public:
+  FPos  ranges;
+  FPos  total;
+
+  ReportWriter(ReportFormat aFormat, bool aShowBytes);
+  virtual bool found(FPos pos, const Byte* buf1, const Byte* buf2,
+                     int count);
+  void  begin(const char* name1, const char* name2, FPos size1, FPos size2);
+  void  end(FPos size1, FPos size2);
+
+ protected:
+  ReportFormat  format;
+  bool          showBytes;
+  String        name1, name2;
+  FPos          start;
+  FPos          length;
+  Byte          bytes1[reportBytes];
+  Byte          bytes2[reportBytes];
+  int           have1, have2;
+
+  void  writeRange();
+
+  static String  hex(const Byte* buf, int count, const char* separator);
+  static String  quote(const String& s);
+}; // end ReportWriter
+
+//--------------------------------------------------------------------
+// Constructor:
+
+ReportWriter::ReportWriter(ReportFormat aFormat, bool aShowBytes)
+: ranges(0),
+  total(0),
+  format(aFormat),
+  showBytes(aShowBytes),
+  start(0),
+  length(0),
+  have1(0),
+  have2(0)
+{
+} // end ReportWriter::ReportWriter
+
+//--------------------------------------------------------------------
+// Start the report:
+//
+// Input:
+//   aName1, aName2:  The names of the files
+//   size1, size2:    The sizes of the files
+
+void ReportWriter::begin(const char* aName1, const char* aName2,
+                         FPos size1, FPos size2)
+{
+  name1 = aName1;
+  name2 = aName2;
+
+  switch (format) {
+   case reportJSON:
+    cout << "{\"file1\": " << quote(name1) << ", \"file2\": " << quote(name2)
+         << ",\n \"size1\": " << size1 << ", \"size2\": " << size2
+         << ",\n \"ranges\": [";
+    break;
+
+   case reportCSV:
+    cout << (showBytes ? "offset,length,bytes1,bytes2\n" : "offset,length\n");
+    break;
+
+   default:
+    break;
+  } // end switch format
+} // end ReportWriter::begin
+
+//--------------------------------------------------------------------
+// Finish the report:
+//
+// Writes the last range and the summary.  (For CSV, the summary goes
+// to the standard error, so the output is just the table.)
+//
+// Input:
+//   size1, size2:  The sizes of the files
+
+void ReportWriter::end(FPos size1, FPos size2)
+{
+  if (length) writeRange();
+
+  switch (format) {
+   case reportJSON:
+    cout << (ranges ? "\n ],\n" : "],\n")
+         << " \"rangeCount\": " << ranges
+         << ", \"differentBytes\": " << total << "}\n";
+    break;
+
+   case reportCSV:
+    cerr << name1 << " and " << name2 << ": " << ranges
+         << (ranges == 1 ? " range, " : " ranges, ") << total
+         << (total == 1 ? " byte differs\n" : " bytes differ\n");
+    break;
+
+   default:
+    if (!ranges)
+      cout << name1 << " and " << name2 << " are identical\n";
+    else {
+      cout << ranges << (ranges == 1 ? " range, " : " ranges, ") << total
+           << (total == 1 ? " byte differs" : " bytes differ");
+      if (size1 != size2)
+        cout << " (" << name1 << " is " << size1 << " bytes, "
+             << name2 << " is " << size2 << ')';
+      cout << '\n';
+    }
+    break;
+  } // end switch format
+} // end ReportWriter::end
+
+//--------------------------------------------------------------------
+// Add differing bytes to the report:
+
+bool ReportWriter::found(FPos pos, const Byte* buf1, const Byte* buf2,
+                         int count)
+{
+  if (length && pos != start + length) {
+    writeRange();
+    length = 0;
+  }
+
+  if (!length) {
+    start = pos;
+    have1 = have2 = 0;
+  }
+
+  if (showBytes) {
+    const int  room = int(min(FPos(reportBytes) - min(length, FPos(reportBytes)),
+                              FPos(count)));
+
+    if (buf1 && have1 == length) {
+      memcpy(bytes1 + have1, buf1, room);
+      have1 += room;
+    }
+
+    if (buf2 && have2 == length) {
+      memcpy(bytes2 + have2, buf2, room);
+      have2 += room;
+    }
+  } // end if showing bytes
+
+  length += count;
+  total  += count;
+
+  return true;
+} // end ReportWriter::found
+
+//--------------------------------------------------------------------
+// Write the current range:
+
+void ReportWriter::writeRange()
+{
+  const bool  more = (length > reportBytes); // Not all bytes are shown
+
+  switch (format) {
+   case reportJSON:
+    cout << (ranges ? ",\n  " : "\n  ") << "{\"offset\": " << start
+         << ", \"length\": " << length;
+    if (showBytes)
+      cout << ", \"bytes1\": \"" << hex(bytes1, have1, "")
+           << "\", \"bytes2\": \"" << hex(bytes2, have2, "") << '"';
+    cout << '}';
+    break;
+
+   case reportCSV:
+    cout << start << ',' << length;
+    if (showBytes)
+      cout << ',' << hex(bytes1, have1, "") << ',' << hex(bytes2, have2, "");
+    cout << '\n';
+    break;
+
+   default: {
+    cout << formatPos(start) << "  " << length << (length == 1 ? " byte\n" : " bytes\n");
+    if (showBytes) {
+      cout << "  " << name1 << ": "
+           << (have1 ? hex(bytes1, have1, " ") : "(past the end)")
+           << (more && have1 ? " ...\n" : "\n");
+      cout << "  " << name2 << ": "
+           << (have2 ? hex(bytes2, have2, " ") : "(past the end)")
+           << (more && have2 ? " ...\n" : "\n");
+    }
+   } break;
+  } // end switch format
+
+  ++ranges;
+} // end ReportWriter::writeRange
+
+//--------------------------------------------------------------------
+// Format bytes in hex:
+//
+// Input:
+//   buf:        The bytes
+//   count:      The number of bytes
+//   separator:  What to put between the bytes
+
+String ReportWriter::hex(const Byte* buf, int count, const char* separator)
+{
+  String  s;
+
+  for (int i = 0; i < count; ++i) {
+    if (i) s += separator;
+    s += hexDigits[buf[i] >> 4];
+    s += hexDigits[buf[i] & 0x0F];
+  }
+
+  return s;
+} // end ReportWriter::hex
+
+//--------------------------------------------------------------------
+// Quote a string for JSON:
+
+String ReportWriter::quote(const String& s)
+{
+  String  q("\"");
+
+  for (StrConstItr c = s.begin(); c != s.end(); ++c) {
+    if (*c == '"' || *c == '\\')
+      q += '\\';
+    else if (Byte(*c) < 0x20) {
+      char  buf[8];
+      sprintf(buf, "\\u%04X", Byte(*c));
+      q += buf;
+      continue;
+    }
+    q += *c;
+  } // end for each character
+
+  return q + '"';
+} // end ReportWriter::quote
+
+//--------------------------------------------------------------------
+// Open the two files to compare (when running without the display):
+//
+// Input:
+//   name1, name2:  The files to open
+//
+// Output:
+//   file1, file2:  The open files (positioned at the start)
+//   size1, size2:  Their sizes
+//
+// Returns:
+//   0 for success, or the exit status (2) after reporting an error
+
+int openFiles(const char* name1, const char* name2,
+              File& file1, File& file2, FPos& size1, FPos& size2)
+{
+  file1 = OpenFile(name1);
+  if (file1 == InvalidFile) return fileError(name1, ErrorMsg(), 2);
+
+  file2 = OpenFile(name2);
+  if (file2 == InvalidFile) return fileError(name2, ErrorMsg(), 2);
+
+  size1 = SeekFile(file1, 0, SeekEnd);
+  size2 = SeekFile(file2, 0, SeekEnd);
+
+  if (size1 < 0 || SeekFile(file1, 0) != 0)
+    return fileError(name1, ErrorMsg(), 2);
+
+  if (size2 < 0 || SeekFile(file2, 0) != 0)
+    return fileError(name2, ErrorMsg(), 2);
+
+  return 0;
+} // end openFiles
+
+//--------------------------------------------------------------------
+// Write a report of the differences between two files:
+//
+// Input:
+//   name1, name2:  The files to compare
+//
+// Returns:
+//   The exit status: 0 if the files are the same, 1 if they differ,
+//   or 2 if an error occurred
+
+int writeReport(const char* name1, const char* name2)
+{
+  File  file1, file2;
+  FPos  size1, size2;
+
+  if (int status = openFiles(name1, name2, file1, file2, size1, size2))
+    return status;
+
+  ReportWriter  report(reportFormat, reportShowBytes);
+
+  report.begin(name1, name2, size1, size2);
+
+  if (!compareFiles(file1, file2, report))
+    return fileError(name1, ErrorMsg(), 2);
+
+  report.end(size1, size2);
+
+  CloseFile(file1);
+  CloseFile(file2);
+
+  return (report.ranges ? 1 : 0);
+} // end writeReport
+
+//--------------------------------------------------------------------
+// Compare the contents of two files of the same size:
+//
+// The files are compared a block at a time with memcmp, which
+// compares many bytes at once, and the comparison stops at the first
+// block that differs.  Only the buffer passed in is used, so files
+// can be compared on several threads at once.
+//
+// Input:
+//   file1, file2:  The files to compare (positioned at the start)
+//   buf:           Room for 2 * streamBlockSize bytes
+//
+// Returns:
+//   0 if the files are the same, 1 if they differ, or -1 or -2 if
+//   file1 or file2 couldn't be read (call ErrorMsg for error message)
+
+int sameContents(File file1, File file2, Byte* buf)
+{
+  Byte *const  buf1 = buf;
+  Byte *const  buf2 = buf + streamBlockSize;
+
+  for (;;) {
+    const int  got1 = readBlock(file1, buf1, streamBlockSize);
+    if (got1 < 0) return -1;
+
+    const int  got2 = readBlock(file2, buf2, streamBlockSize);
+    if (got2 < 0) return -2;
+
+    if (got1 != got2 || memcmp(buf1, buf2, got1)) return 1;
+
+    if (got1 < streamBlockSize) return 0; // Reached the end of both
+  } // end forever
+} // end sameContents
+
+//--------------------------------------------------------------------
+// Compare two files, just to set the exit status (the -q mode):
+//
+// Files of different sizes differ, so they aren't read at all.
+//
+// Input:
+//   name1, name2:  The files to compare
+//
+// Returns:
+//   The exit status: 0 if the files are the same, 1 if they differ,
+//   or 2 if an error occurred
+
+int quickCompare(const char* name1, const char* name2)
+{
+  File  file1, file2;
+  FPos  size1, size2;
+
+  if (int status = openFiles(name1, name2, file1, file2, size1, size2))
+    return status;
+
+  int  status = (size1 == size2 ? 0 : 1);
+
+  if (!status) {
+    Byte *const  buf = new Byte[2 * streamBlockSize];
+
+    status = sameContents(file1, file2, buf);
+    if (status < 0)
+      status = fileError((status == -1 ? name1 : name2), ErrorMsg(), 2);
+
+    delete [] buf;
+  } // end if the files are the same size
+
+  CloseFile(file1);
+  CloseFile(file2);
+
+  return status;
+} // end quickCompare
+
+//--------------------------------------------------------------------
+// List each differing byte, like cmp -l (the -l mode):
+//
+// Each line has the position of the byte (counting from 1) and its
+// value in each file (in octal).  The lines are formatted with a
+// table of octal strings into a large buffer, which is written all
+// at once.
+//
+// Member Variables:
+//   count:   The number of bytes listed
+//   buf:     The lines not yet written
+//   used:    The number of characters in buf
+//   width:   The width of the position column
+//   octal:   The octal string for each byte value
+
+class ListWriter : public DiffHandler
+{
+ public:
+  FPos  count;
+
+  ListWriter(FPos size);
+  ~ListWriter() { flush(); };
+  virtual bool found(FPos pos, const Byte* buf1, const Byte* buf2,
+                     int size);
+  void  flush();
+
+ protected:
+  enum { bufSize = 64 * 1024, maxLine = 64 };
+
+  char  buf[bufSize];
+  int   used;
+  int   width;
+  char  octal[256][3];
+}; // end ListWriter
+
+//--------------------------------------------------------------------
+// Constructor:
+//
+// Input:
+//   size:  The size of the shorter file (which sets the width of the
+//          position column, as in cmp)
+
+ListWriter::ListWriter(FPos size)
+: count(0),
+  used(0),
+  width(1)
+{
+  while (size >= 10) {
+    size /= 10;
+    ++width;
+  }
+
+  for (int b = 0; b < 256; ++b) {
+    octal[b][0] = (b >= 0100 ? '0' + (b >> 6)     : ' ');
+    octal[b][1] = (b >= 010  ? '0' + (b >> 3 & 7) : ' ');
+    octal[b][2] = '0' + (b & 7);
+  }
+} // end ListWriter::ListWriter
+
+//--------------------------------------------------------------------
+// List differing bytes:
+//
+// Stops at the end of the shorter file, like cmp.
+
+bool ListWriter::found(FPos pos, const Byte* buf1, const Byte* buf2,
+                       int size)
+{
+  if (!buf1 || !buf2) return false; // Reached the end of a file
+
+  char  digits[24];
+
+  for (int i = 0; i < size; ++i) {
+    if (used > bufSize - maxLine) flush();
+
+    char*  out = buf + used;
+    FPos   n   = pos + i + 1;
+    int    d   = 0;
+
+    do {
+      digits[d++] = '0' + int(n % 10);
+      n /= 10;
+    } while (n);
+
+    for (int pad = width - d; pad > 0; --pad)
+      *(out++) = ' ';
+    while (d)
+      *(out++) = digits[--d];
+
+    *(out++) = ' ';
+    memcpy(out, octal[buf1[i]], 3);
+    out += 3;
+    *(out++) = ' ';
+    memcpy(out, octal[buf2[i]], 3);
+    out += 3;
+    *(out++) = '\n';
+
+    used = out - buf;
+  } // end for each differing byte
+
+  count += size;
+
+  return true;
+} // end ListWriter::found
+
+//--------------------------------------------------------------------
+// Write the lines in the buffer:
+
+void ListWriter::flush()
+{
+  if (used) cout.write(buf, used);
+  used = 0;
+} // end ListWriter::flush
+
+//--------------------------------------------------------------------
+// List the bytes that differ between two files:
+//
+// Input:
+//   name1, name2:  The files to compare
+//
+// Returns:
+//   The exit status: 0 if the files are the same, 1 if they differ,
+//   or 2 if an error occurred
+
+int listDifferences(const char* name1, const char* name2)
+{
+  File  file1, file2;
+  FPos  size1, size2;
+
+  if (int status = openFiles(name1, name2, file1, file2, size1, size2))
+    return status;
+
+  ListWriter  list(min(size1, size2));
+
+  if (!compareFiles(file1, file2, list))
+    return fileError(name1, ErrorMsg(), 2);
+
+  list.flush();
+  cout.flush();
+
+  CloseFile(file1);
+  CloseFile(file2);
+
+  if (size1 != size2) {
+    cerr << program_name << ": EOF on " << (size1 < size2 ? name1 : name2);
+    if (min(size1, size2))
+      cerr << " after byte " << min(size1, size2) << endl;
+    else
+      cerr << " which is empty" << endl;
+  }
+
+  return ((list.count || size1 != size2) ? 1 : 0);
+} // end listDifferences
+
+//--------------------------------------------------------------------
+// Write the lines that differ as they look on the screen (--dump):
+//
+// Each page shows up to dumpPageLines lines of the first file, then
+// the same lines of the second file, like the top and bottom windows.
+// Lines that differ are shown with some lines of context around
+// them, and each stretch of identical lines is replaced by a note
+// saying how many were left out.  The rows are formatted by
+// formatLine, just like the display, and written as ANSI text or
+// HTML.
+//
+// The files are read in blocks, and the previous block is kept so the
+// context before a difference is always available.  Identical lines
+// are skipped with memcmp, so only the lines written are formatted.
+//
+// Member Variables:
+//   different:    True if any line differs
+//   html:         True for HTML, false for ANSI text
+//   context:      The number of identical lines shown around a
+//                 difference
+//   name1/2:      The names of the files
+//   buffers:      The memory for the blocks
+//   cur1/2:       The current block of each file
+//   prev1/2:      The previous block of each file
+//   size1/2:      The number of bytes in cur1/2
+//   blockLine:    The number of the first line in cur1/2
+//   nextLine:     The first line not yet written or left out
+//   after:        The lines of context still to write after a
+//                 difference
+//   page:         The lines waiting to be written
+//   out:          The text waiting to be written
+
+const int  dumpLineWidth = minLineWidth; // The 80 column layout
+const int  dumpPageLines = 32;  // The most lines in one page
+const int  dumpBlockLines = streamBlockSize / dumpLineWidth;
+
+class DumpWriter
+{
+ public:
+  bool  different;
+
+  DumpWriter(bool aHTML, int aContext, const char* aName1, const char* aName2);
+  ~DumpWriter();
+  bool  run(File file1, File file2);
+
+ protected:
+  struct Line
+  {
+    FPos  pos;                  // The position of the line in the files
+    Byte  bytes1[dumpLineWidth];
+    Byte  bytes2[dumpLineWidth];
+    int   length1, length2;     // The number of bytes in each file
+  }; // end Line
+
+  bool          html;
+  int           context;
+  String        name1, name2;
+  Byte*         buffers;
+  Byte*         cur1;
+  Byte*         cur2;
+  Byte*         prev1;
+  Byte*         prev2;
+  int           size1, size2;
+  FPos          blockLine;
+  FPos          nextLine;
+  int           after;
+  vector<Line>  page;
+  String        out;
+
+  void  addLine(FPos line);
+  bool  differs(int i) const;
+  void  flush();
+  void  lineLengths(int i, int& length1, int& length2) const;
+  void  skipTo(FPos line);
+  void  writePage();
+  void  writeRow(const char* row, const Style* style,
+                  int width=screenWidth);
+  void  writeTitle(const String& name);
+}; // end DumpWriter
+
+//--------------------------------------------------------------------
+// Constructor:
+//
+// Input:
+//   aHTML:     True to write HTML, false for ANSI text
+//   aContext:  The number of lines of context around differences
+//   aName1, aName2:  The names of the files
+
+DumpWriter::DumpWriter(bool aHTML, int aContext,
+                       const char* aName1, const char* aName2)
+: different(false),
+  html(aHTML),
+  context(min(max(aContext, 0), dumpBlockLines)),
+  name1(aName1),
+  name2(aName2),
+  size1(0),
+  size2(0),
+  blockLine(0),
+  nextLine(0),
+  after(0)
+{
+  buffers = new Byte[4 * streamBlockSize];
+
+  cur1  = buffers;
+  cur2  = cur1 + streamBlockSize;
+  prev1 = cur2 + streamBlockSize;
+  prev2 = prev1 + streamBlockSize;
+
+  page.reserve(dumpPageLines);
+} // end DumpWriter::DumpWriter
+
+//--------------------------------------------------------------------
+// Destructor:
+
+DumpWriter::~DumpWriter()
+{
+  delete [] buffers;
+} // end DumpWriter::~DumpWriter
+
+//--------------------------------------------------------------------
+// Compare the files and write the dump:
+//
+// Input:
+//   file1, file2:  The files (positioned at the start)
+//
+// Returns:
+//   true:   The dump was written
+//   false:  Unable to read a file (call ErrorMsg for error message)
+
+bool DumpWriter::run(File file1, File file2)
+{
+  if (html)
+    out += "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">\n"
+           "<style>\n"
+           "pre.vbindiff { background: #0000AA; color: #FFFFFF; }\n"
+           ".vbindiff .diff { color: #FF5555; font-weight: bold; }\n"
+           ".vbindiff .name { background: #FFFFFF; color: #000000; }\n"
+           "</style></head><body><pre class=\"vbindiff\">\n";
+
+  bool  ok = true;
+
+  for (;;) {
+    size1 = readBlock(file1, cur1, streamBlockSize);
+    size2 = readBlock(file2, cur2, streamBlockSize);
+
+    if (size1 < 0 || size2 < 0) {
+      ok = false;
+      break;
+    }
+
+    const int  common = min(size1, size2);
+    const int  total  = max(size1, size2);
+    const int  lines  = (total + dumpLineWidth - 1) / dumpLineWidth;
+
+    for (int i = 0; i < lines; ++i) {
+      if (!after) {
+        // Skip to the next line that differs:
+        const int  start = i * dumpLineWidth;
+        const int  pos   = (start < common
+                            ? start + matchLength(cur1 + start, cur2 + start,
+                                                  common - start)
+                            : start);
+
+        if (pos >= total) break; // The rest of the block is identical
+
+        i = pos / dumpLineWidth;
+        skipTo(max(blockLine + i - context, nextLine));
+
+        while (nextLine < blockLine + i)
+          addLine(nextLine);
+      } // end if looking for a difference
+
+      if (differs(i)) {
+        different = true;
+        after     = context;
+      } else
+        --after;
+
+      addLine(blockLine + i);
+    } // end for each line in the block
+
+    if (size1 < streamBlockSize || size2 < streamBlockSize)
+      break;                    // Reached the end of a file
+
+    swap(cur1, prev1);
+    swap(cur2, prev2);
+    blockLine += dumpBlockLines;
+  } // end forever
+
+  if (ok) {
+    const FPos  size = (blockLine * dumpLineWidth + max(size1, size2));
+
+    writePage();                // skipTo only writes it if lines are left out
+    skipTo((size + dumpLineWidth - 1) / dumpLineWidth);
+
+    if (html) out += "</pre></body></html>\n";
+  } // end if ok
+
+  flush();
+
+  return ok;
+} // end DumpWriter::run
+
+//--------------------------------------------------------------------
+// Add a line to the page:
+//
+// Writes the page when it is full.
+//
+// Input:
+//   line:  The number of the line (in the current or previous block)
+
+void DumpWriter::addLine(FPos line)
+{
+  int  i = int(line - blockLine);
+
+  const Byte*  buf1 = cur1;
+  const Byte*  buf2 = cur2;
+
+  if (i < 0) {
+    buf1 = prev1;               // The previous block is always full
+    buf2 = prev2;
+    i   += dumpBlockLines;
+  }
+
+  page.push_back(Line());
+  Line&  l = page.back();
+
+  l.pos = line * dumpLineWidth;
+
+  if (buf1 == cur1)
+    lineLengths(i, l.length1, l.length2);
+  else
+    l.length1 = l.length2 = dumpLineWidth;
+
+  memcpy(l.bytes1, buf1 + i * dumpLineWidth, l.length1);
+  memcpy(l.bytes2, buf2 + i * dumpLineWidth, l.length2);
+
+  nextLine = line + 1;
+
+  if (page.size() == VecSize(dumpPageLines)) writePage();
+} // end DumpWriter::addLine
+
+//--------------------------------------------------------------------
+// Return true if a line of the current block differs:
+
+bool DumpWriter::differs(int i) const
+{
+  int  length1, length2;
+
+  lineLengths(i, length1, length2);
+
+  return (length1 != length2 ||
+          memcmp(cur1 + i * dumpLineWidth, cur2 + i * dumpLineWidth, length1));
+} // end DumpWriter::differs
+
+//--------------------------------------------------------------------
+// Write the text waiting in the buffer:
+
+void DumpWriter::flush()
+{
+  cout.write(out.data(), out.size());
+  out.erase();
+} // end DumpWriter::flush
+
+//--------------------------------------------------------------------
+// Find the number of bytes in a line of the current block:
+//
+// Input:
+//   i:  The line number within the block
+//
+// Output:
+//   length1, length2:  The number of bytes of each file in the line
+
+void DumpWriter::lineLengths(int i, int& length1, int& length2) const
+{
+  const int  start = i * dumpLineWidth;
+
+  length1 = min(max(size1 - start, 0), dumpLineWidth);
+  length2 = min(max(size2 - start, 0), dumpLineWidth);
+} // end DumpWriter::lineLengths
+
+//--------------------------------------------------------------------
+// Leave out the identical lines before a line:
+//
+// Writes the page, then a note saying how many lines were left out.
+//
+// Input:
+//   line:  The next line to write
+
+void DumpWriter::skipTo(FPos line)
+{
+  if (line <= nextLine) return;
+
+  writePage();
+
+  ostringstream  note;
+  note << "          ... " << (line - nextLine)
+       << (line - nextLine == 1 ? " identical line" : " identical lines");
+
+  char   row[screenWidth + 1];
+  Style  style[screenWidth];
+
+  sprintf(row, "%-*.*s", screenWidth, screenWidth, note.str().c_str());
+  fill(style, style + screenWidth, cFileWin);
+
+  writeRow(row, style);
+
+  nextLine = line;
+
+  if (out.size() >= VecSize(streamBlockSize)) flush();
+} // end DumpWriter::skipTo
+
+//--------------------------------------------------------------------
+// Write the lines in the page:
+//
+// First the lines of the first file, then the same lines of the
+// second, each under a title with the file's name.
+
+void DumpWriter::writePage()
+{
+  if (page.empty()) return;
+
+  for (int which = 0; which < 2; ++which) {
+    writeTitle(which ? name2 : name1);
+
+    for (vector<Line>::const_iterator l = page.begin(); l != page.end(); ++l) {
+      const Byte*  bytes  = (which ? l->bytes2  : l->bytes1);
+      const int    length = (which ? l->length2 : l->length1);
+      const int    common = min(l->length1, l->length2);
+
+      Byte  diff[dumpLineWidth];
+      for (int j = 0; j < dumpLineWidth; ++j)
+        diff[j] = (j < common ? l->bytes1[j] != l->bytes2[j] : j < length);
+
+      // An offset of 4GB or more pushes the rest of the row right:
+      char   row[screenWidth + maxPosWidth];
+      Style  style[screenWidth + maxPosWidth];
+      char*  str = formatPos(row, l->pos);
+      const int  extra = int(str - row) - (leftMar - 2);
+      const int  width = screenWidth + extra;
+
+      *(str++) = ':';
+      memset(str, ' ', width - (str - row));
+      fill(style, style + width, cFileWin);
+
+      formatLine<dumpLineWidth>(bytes, length, diff, NULL, NULL,
+                                row + extra, style + extra);
+
+      writeRow(row, style, width);
+    } // end for each line in the page
+  } // end for each file
+
+  page.clear();
+
+  if (out.size() >= VecSize(streamBlockSize)) flush();
+} // end DumpWriter::writePage
+
+//--------------------------------------------------------------------
+// Add a row to the output:
+//
+// Changes the style only where it changes in the row.
+//
+// Input:
+//   row:    The characters
+//   style:  The style of each character
+//   width:  The number of characters in row
+
+void DumpWriter::writeRow(const char* row, const Style* style, int width)
+{
+  // ANSI sequences for cFileWin, cFileDiff, and cFileName (the colors
+  // the curses version uses):
+  static const char  sgrWin[]  = "\033[0;37;44m";
+  static const char  sgrDiff[] = "\033[0;1;31;44m";
+  static const char  sgrName[] = "\033[0;30;47m";
+
+  for (int x = 0, end; x < width; x = end) {
+    const Style  current = style[x];
+
+    for (end = x + 1; end < width && style[end] == current; ++end)
+      ;
+
+    if (!html) {
+      out += (current == cFileDiff ? sgrDiff :
+              current == cFileName ? sgrName : sgrWin);
+      out.append(row + x, end - x);
+      continue;
+    }
+
+    if (current == cFileDiff)      out += "<span class=\"diff\">";
+    else if (current == cFileName) out += "<span class=\"name\">";
+
+    for (int i = x; i < end; ++i) {
+      const char  c = row[i];
+
+      if (c == '<')       out += "&lt;";
+      else if (c == '>')  out += "&gt;";
+      else if (c == '&')  out += "&amp;";
+      else                out += c;
+    } // end for each character in the run
+
+    if (current != cFileWin) out += "</span>";
+  } // end for each run of characters in the same style
+
+  out += (html ? "\n" : "\033[0m\n");
+} // end DumpWriter::writeRow
+
+//--------------------------------------------------------------------
+// Add a title line with a file name to the output:
+
+void DumpWriter::writeTitle(const String& name)
+{
+  char   row[screenWidth + 1];
+  Style  style[screenWidth];
+
+  sprintf(row, "%-*.*s", screenWidth, screenWidth, name.c_str());
+  fill(style, style + screenWidth, cFileName);
+
+  writeRow(row, style);
+} // end DumpWriter::writeTitle
+
+//--------------------------------------------------------------------
+// Write a dump of the lines that differ between two files:
+//
+// Input:
+//   name1, name2:  The files to compare
+//   context:       The number of lines to show around each difference
+//
+// Returns:
+//   The exit status: 0 if the files are the same, 1 if they differ,
+//   or 2 if an error occurred
+
+int dumpDifferences(const char* name1, const char* name2, int context)
+{
+  File  file1, file2;
+  FPos  size1, size2;
+
+  if (int status = openFiles(name1, name2, file1, file2, size1, size2))
+    return status;
+
+  DumpWriter  dump(dumpHTML, context, name1, name2);
+
+  if (!dump.run(file1, file2))
+    return fileError(name1, ErrorMsg(), 2);
+
+  CloseFile(file1);
+  CloseFile(file2);
+
+  return (dump.different ? 1 : 0);
+} // end dumpDifferences
+
+//--------------------------------------------------------------------
+// Move both files to the next difference:
+//
+// Shows the progress of the comparison, which the user may cancel.
+// If cancelled, the files return to where they started.
+
+class NextDiffTask : public Task
+{
+ public:
+  virtual void run(Progress& progress);
+}; // end NextDiffTask
+
+void NextDiffTask::run(Progress& progress)
+{
+  do {
+    file1.move(bufSize);
+    file2.move(bufSize);
+  } while (!diffs.compute() && progress.update(file1.getOffset()));
+} // end NextDiffTask::run
+
+//--------------------------------------------------------------------
+// Find the next difference in the N-way view:
+//
+// Rather than comparing a screenful at a time, this reads a block of
+// streamBlockSize bytes from each file and compares it with the
+// first file's using matchLength (which uses memcmp), so each file
+// is read and compared once, however many files there are.  It
+// starts on the page after the one displayed.
+//
+// Member Variables:
+//   found:
+//     How far past the displayed positions the first difference is
+//     (or the end of the files, if there are no more differences),
+//     or -1 if the task was cancelled
+
+class NextDiffAllTask : public Task
+{
+ public:
+  FPos  found;
+  NextDiffAllTask() : found(-1) {};
+  virtual void run(Progress& progress);
+}; // end NextDiffAllTask
+
+void NextDiffAllTask::run(Progress& progress)
+{
+  FileVec  files(moreFiles);
+  files.insert(files.begin(), &file2);
+  files.insert(files.begin(), &file1);
+
+  const VecSize  count = files.size();
+  Byte *const    buf   = new Byte[count * streamBlockSize];
+
+  for (FPos pos = bufSize; ; pos += streamBlockSize) {
+    int  common  = streamBlockSize;
+    int  longest = 0;
+
+    for (VecSize i = 0; i < count; ++i) {
+      const int  got = max(files[i]->read(files[i]->getOffset() + pos,
+                                          buf + i * streamBlockSize,
+                                          streamBlockSize), 0);
+      common  = min(common, got);
+      longest = max(longest, got);
+    } // end for each file
+
+    int  same = common;
+    for (VecSize i = 1; i < count && same; ++i)
+      same = matchLength(buf, buf + i * streamBlockSize, same);
+
+    if (same < longest || longest < streamBlockSize) {
+      found = pos + same;
+      break;
+    }
+
+    if (!progress.update(file1.getOffset() + pos + streamBlockSize)) break;
+  } // end for each block
+
+  delete [] buf;
+} // end NextDiffAllTask::run
+
+//--------------------------------------------------------------------
+// Move the files to the next difference:
+//
+// The files move a page at a time, so the difference is displayed.
+// If the user cancels the comparison, the files stay where they are.
+
+void nextDifference()
+{
+  if (!moreFiles.empty()) {
+    FPos  total = max(file1.fileSize(), file2.fileSize());
+    for (VecSize i = 0; i < moreFiles.size(); ++i)
+      total = max(total, moreFiles[i]->fileSize());
+
+    NextDiffAllTask  task;
+    Progress         progress("Comparing", file1.getOffset(), total);
+
+    if (progress.run(task) && task.found >= 0) {
+      const FPos  step = task.found - task.found % bufSize;
+
+      file1.move(step);
+      file2.move(step);         // handleCmd moves the others
+    }
+    return;
+  } // end if N-way view
+
+  const FPos  start1 = file1.getOffset();
+  const FPos  start2 = file2.getOffset();
+
+  NextDiffTask  task;
+  Progress      progress("Comparing", start1,
+                         max(file1.fileSize(), file2.fileSize()));
+
+  if (!progress.run(task)) {
+    file1.moveTo(start1);
+    file2.moveTo(start2);
+  }
+} // end nextDifference
+
+//--------------------------------------------------------------------
+// Save the unsaved changes to both files:
+//
+// Returns:
+//   true:   Everything was saved
+//   false:  An error was displayed, or the user cancelled
+
+bool saveChanges()
+{
+  bool  cancelled;
+
+  if (!file1.save(&file2, cancelled)) {
+    if (!cancelled)
+      showError(cmgGotoTop, String("Unable to save changes: ") + ErrorMsg());
+    return false;
+  }
+
+  if (!file2.save(&file1, cancelled)) {
+    if (!cancelled)
+      showError(cmgGotoBottom,
+                String("Unable to save changes: ") + ErrorMsg());
+    return false;
+  }
+
+  return true;
+} // end saveChanges
+
+//--------------------------------------------------------------------
+// Offer to save unsaved changes before quitting:
+//
+// Returns:
+//   true:   Go ahead and quit
+//   false:  The user pressed ESC, or the changes could not be saved
+
+bool confirmQuit()
+{
+  if (!file1.modified() && !file2.modified()) return true;
+
+  promptWin.clear();
+  promptWin.border();
+  promptWin.put(25,1,"Save changes (Y/N, ESC cancel):");
+  promptWin.update();
+  promptWin.setCursor(57,1);
+  ConWindow::showCursor();
+
+  int  key;
+  while ((key = safeUC(promptWin.readKey())) != 'Y' && key != 'N' &&
+         key != KEY_ESCAPE)
+    beep();
+
+  ConWindow::hideCursor();
+  showPrompt();
+
+  if (key == KEY_ESCAPE) return false;
+
+  return (key == 'N' || saveChanges());
+} // end confirmQuit
+
+//--------------------------------------------------------------------
+// Show which snapshots are displayed (the --series mode):
+
+void showSeriesPosition()
+{
+  ostringstream  pos1, pos2;
+
+  pos1 << (seriesPos + 1) << " of " << seriesNames.size();
+  pos2 << (seriesPos + 2) << " of " << seriesNames.size();
+
+  file1.setStatus(pos1.str());
+  file2.setStatus(pos2.str());
+} // end showSeriesPosition
+
+//--------------------------------------------------------------------
+// Step to the next or previous pair of snapshots (the --series mode):
+//
+// The snapshot that stays on the screen moves to the other pane with
+// its buffer, edits, and matches, so it isn't read again.  The one
+// that leaves is set aside in spareFile, so stepping straight back
+// doesn't read it again either.  Any other snapshot is opened, and
+// just a screenful of it read.  Each pane stays at the same position.
+//
+// Input:
+//   cmd:  cmNextPair or cmPrevPair
+
+void stepSeries(Command cmd)
+{
+  const bool  forward = (cmd == cmNextPair);
+
+  if (seriesNames.empty() ||
+      (forward ? seriesPos + 2 >= seriesNames.size() : seriesPos == 0)) {
+    beep();
+    return;
+  }
+
+  // outPane's snapshot leaves the screen, and inPane gets a new one:
+  FileDisplay&   outPane = (forward ? file1 : file2);
+  FileDisplay&   inPane  = (forward ? file2 : file1);
+  const Command  outWhere = (forward ? cmgGotoTop : cmgGotoBottom);
+  const Command  inWhere  = (forward ? cmgGotoBottom : cmgGotoTop);
+
+  if (outPane.modified()) {
+    showError(outWhere, "Save or undo the changes first");
+    return;
+  }
+
+  const String&  name  = seriesNames[forward ? seriesPos + 2 : seriesPos - 1];
+  const bool     spare = !strcmp(spareFile.getFileName(), name.c_str());
+
+  if (!spare) {
+    // Make sure it can be opened before anything is changed:
+    const File  file = OpenFile(name.c_str());
+    if (file == InvalidFile) {
+      showError(inWhere, "Unable to open " + name + ": " + ErrorMsg());
+      return;
+    }
+    CloseFile(file);
+  } // end if snapshot is not loaded
+
+  const FPos  offset1 = file1.getOffset();
+  const FPos  offset2 = file2.getOffset();
+
+  spareFile.swapFile(outPane);
+  outPane.swapFile(inPane);     // inPane now has the old spare
+
+  if (!spare) inPane.setFile(name.c_str());
+
+  seriesPos += (forward ? 1 : -1);
+
+  if (file1.getOffset() != offset1) file1.moveTo(offset1);
+  if (file2.getOffset() != offset2) file2.moveTo(offset2);
+
+  showSeriesPosition();
+} // end stepSeries
+
+//--------------------------------------------------------------------
+// Handle a command:
+//
+// Input:
+//   cmd:  The command to be handled
+
+void handleCmd(Command cmd)
+{
+  // The N-way view only moves and compares the files:
+  if (!moreFiles.empty() && cmd != cmNothing && !(cmd & cmmMove) &&
+      (cmd & cmgGotoMask) != cmgGoto && cmd != cmNextDiff &&
+      cmd != cmToggleASCII) {
+    beep();
+    return;
+  }
+
+  if (cmd & cmmMove) {
+    int  step = steps[cmd & cmmMoveSize];
+
+    if ((cmd & cmmMoveForward) == 0)
+      step *= -1;               // We're moving backward
+
+    if ((cmd & cmmMoveForward) && !step) {
+      if (cmd & cmmMoveTop)
+        file1.moveToEnd((!singleFile && (cmd & cmmMoveBottom)) ? &file2 : NULL);
+      else
+        file2.moveToEnd(NULL);
+    } else if (!step) {
+      if (cmd & cmmMoveTop)    file1.moveTo(0);
+      if (cmd & cmmMoveBottom) file2.moveTo(0);
+    } else {
+      FPos  step1 = ((cmd & cmmMoveTop)    ? step : 0);
+      FPos  step2 = ((cmd & cmmMoveBottom) ? step : 0);
+
+      mergeMoves(step1, step2);
+
+      if (step1) file1.move(step1);
+      if (step2) file2.move(step2);
+    } // end else relative move
+  } // end if move
+  else if ((cmd & cmgGotoMask) == cmgGoto)
+    gotoPosition(cmd);
+  else if ((cmd & cmgGotoMask) == cmFind)
+    searchFiles(cmd);
+  else if ((cmd & cmgGotoMask) == cmMark) {
+    if (cmd & cmgGotoTop)    file1.setMark();
+    if (cmd & cmgGotoBottom) file2.setMark();
+  }
+  else if (cmd == cmNextDiff) {
+    if (lockState) {
+      lockState = lockNeither;
+      displayLockState();
+    }
+    nextDifference();
+  } // end else if cmNextDiff
+  else if (cmd == cmUseTop) {
+    if (lockState == lockBottom)
+      lockState = lockNeither;
+    else
+      lockState = lockBottom;
+    displayLockState();
+  }
+  else if (cmd == cmUseBottom) {
+    if (lockState == lockTop)
+      lockState = lockNeither;
+    else
+      lockState = lockTop;
+    displayLockState();
+  }
+  else if (cmd == cmToggleASCII) {
+    displayTable = ((displayTable == asciiDisplayTable)
+                    ? ebcdicDisplayTable
+                    : asciiDisplayTable );
+    displayCharacterSet();
+  }
+  else if (cmd == cmEditTop)
+    file1.edit(singleFile ? NULL : &file2);
+  else if (cmd == cmEditBottom)
+    file2.edit(&file1);
+  else if (cmd == cmReplaceTop || cmd == cmReplaceBottom)
+    replaceBytes(cmd);
+  else if (cmd == cmUndoTop || cmd == cmUndoBottom) {
+    if (!(cmd == cmUndoTop ? file1 : file2).undo()) beep();
+  }
+  else if (cmd == cmRedoTop || cmd == cmRedoBottom) {
+    if (!(cmd == cmRedoTop ? file1 : file2).redo()) beep();
+  }
+  else if (cmd == cmSave)
+    saveChanges();
+  else if ((cmd == cmSyncTop || cmd == cmSyncBottom) && !singleFile)
+    syncBytes(cmd);
+  else if (cmd == cmExportTop || cmd == cmExportBottom)
+    exportRegion(cmd);
+  else if ((cmd == cmPatchTop || cmd == cmPatchBottom) && !singleFile)
+    exportPatch(cmd);
+  else if (cmd == cmNextPair || cmd == cmPrevPair)
+    stepSeries(cmd);
+
+  // The other files in the N-way view follow the top one:
+  for (VecSize i = 0; i < moreFiles.size(); ++i)
+    moreFiles[i]->moveTo(file1.getOffset());
+
+  // Make sure we haven't gone past the end of both files:
+  while (diffs.compute() < 0) {
+    file1.move(-steps[cmmMovePage]);
+    file2.move(-steps[cmmMovePage]);
+    for (VecSize i = 0; i < moreFiles.size(); ++i)
+      moreFiles[i]->moveTo(file1.getOffset());
+  }
 
-  String& s = ((itr == historyOverlay.end())
-               ? history[historyPos] : itr->second);
+  if (lastSearch) {
+    file1.showMatchCount(*lastSearch);
+    file2.showMatchCount(*lastSearch);
+  }
 
-  // Store the new string in the buffer:
-  memset(buf, ' ', maxLen);
-  i = len = min(static_cast<VecSize>(maxLen), s.length());
-  memcpy(buf, s.c_str(), len);
-} // end useHistory
+  file1.display();
+  file2.display();
+  for (VecSize i = 0; i < moreFiles.size(); ++i)
+    moreFiles[i]->display();
+} // end handleCmd
 
 //--------------------------------------------------------------------
-// Convert hex string to bytes:
+// Display files until the user quits:
 //
-// Input:
-//   buf:  Must contain a well-formed string of hex characters
-//         (each byte must be separated by spaces)
+// With one file, just display it.  With two, compare them.  With
+// three or more, use the N-way view: each file gets a pane, bytes
+// where any file disagrees are marked, and the files move together.
 //
-// Output:
-//   buf:  Contains the translated bytes
+// May be called again after it returns, to display other files.
+//
+// Input:
+//   count:  The number of files
+//   names:  The files to display
 //
 // Returns:
-//   The number of bytes in buf
+//   The exit status
 
-int packHex(Byte* buf)
+int viewFiles(int count, const char* const* names)
 {
-  unsigned long val;
+  singleFile = (count == 1);
+  for (int i = 2; i < count; ++i)
+    moreFiles.push_back(new FileDisplay);
 
-  char* in  = reinterpret_cast<char*>(buf);
-  Byte* out = buf;
+  if (!initialize()) {
+    cerr << '\n' << program_name << ": Unable to initialize windows\n";
+    return 1;
+  }
 
-  while (*in) {
-    if (*in == ' ')
-      ++in;
-    else {
-      val = strtoul(in, &in, 16);
-      *(out++) = Byte(val);
+  for (int i = 0; i < count; ++i) {
+    FileDisplay&  file = (i == 0 ? file1 : i == 1 ? file2 : *moreFiles[i-2]);
+
+    if (!file.setFile(names[i])) {
+      ostringstream errMsg;
+
+      const char* errStr = ErrorMsg();
+      errMsg << "Unable to open " << names[i] << ": " << errStr;
+      exitMsg(1, errMsg.str().c_str());
     }
-  }
+  } // end for each file
 
-  return out - buf;
-} // end packHex
+  if (runMode == runSeries) {
+    spareFile.resize();         // Give it a buffer to swap
+    showSeriesPosition();
+  }
 
-//--------------------------------------------------------------------
-// Position the input window:
-//
-// Input:
-//   cmd:    Indicates where the window should be positioned
-//   width:  The width of the window
-//   title:  The title for the window
+  diffs.compute();
 
-void positionInWin(Command cmd, short width, const char* title)
-{
-  inWin.resize(width, 3);
-  inWin.move((screenWidth-width)/2,
-             ((!singleFile && (cmd & cmgGotoBottom))
-              ? ((cmd & cmgGotoTop)
-                 ? numLines + linesBetween                   // Moving both
-                 : numLines + numLines/2 + 1 + linesBetween) // Moving bottom
-              : numLines/2));                                // Moving top
+  file1.display();
+  file2.display();
+  for (VecSize i = 0; i < moreFiles.size(); ++i)
+    moreFiles[i]->display();
 
-  inWin.border();
-  inWin.put((width-strlen(title))/2,0, title);
-} // end positionInWin
+  Command  cmd;
+  while ((cmd = getCommand()) != cmQuit || !confirmQuit())
+    handleCmd(cmd);
 
-//--------------------------------------------------------------------
-// Display prompt window for editing:
+  file1.shutDown();
+  file2.shutDown();
+  inWin.close();
+  promptWin.close();
 
-void showEditPrompt()
-{
-  promptWin.clear();
-  promptWin.border();
-  promptWin.put(3,1, "Arrow keys move cursor        TAB hex\x3C\x3E"
-                "ASCII       ESC done");
-  if (displayTable == ebcdicDisplayTable)
-    promptWin.put(42,1, "EBCDIC");
+  for (VecSize i = 0; i < moreFiles.size(); ++i)
+    delete moreFiles[i];
+  moreFiles.clear();
 
-  promptWin.putAttribs( 3,1, cPromptKey, 10);
-  promptWin.putAttribs(33,1, cPromptKey, 3);
-  promptWin.putAttribs(54,1, cPromptKey, 3);
+  ConWindow::shutdown();
 
-  if (!singleFile) {
-    promptWin.put(25,2, "RET copy byte from other file");
-    promptWin.putAttribs(25,2, cPromptKey, 3);
-  }
-  promptWin.update();
-} // end showEditPrompt
+  return 0;
+} // end viewFiles
 
+//====================================================================
+// Comparing directories:
 //--------------------------------------------------------------------
-// Display prompt window:
-
-void showPrompt()
-{
-  promptWin.clear();
-  promptWin.border();
 
-#ifdef WIN32_CONSOLE
-  promptWin.put(1,1, "Arrow keys move  F find      "
-                "RET next difference  ESC quit  ALT  freeze top");
-  promptWin.put(1,2, "C ASCII/EBCDIC   E edit file   "
-                "G goto position      Q quit  CTRL freeze bottom");
-  const short
-    topBotLength = 4,
-    topLength    = 15;
-#else // curses
-  promptWin.put(1,1, "Arrow keys move  F find      "
-                "RET next difference  ESC quit  T move top");
-  promptWin.put(1,2, "C ASCII/EBCDIC   E edit file   "
-                "G goto position      Q quit  B move bottom");
-  const short
-    topBotLength = 1,
-    topLength    = 10;
-#endif
+typedef vector<DirEntry>  DirVec;
 
-  promptWin.putAttribs( 1,1, cPromptKey, 10);
-  promptWin.putAttribs(18,1, cPromptKey, 1);
-  promptWin.putAttribs(30,1, cPromptKey, 3);
-  promptWin.putAttribs(51,1, cPromptKey, 3);
-  promptWin.putAttribs( 1,2, cPromptKey, 1);
-  promptWin.putAttribs(18,2, cPromptKey, 1);
-  promptWin.putAttribs(32,2, cPromptKey, 1);
-  promptWin.putAttribs(53,2, cPromptKey, 1);
-  if (singleFile) {
-    // Erase "move top" & "move bottom":
-    promptWin.putChar(61,1, ' ', topLength);
-    promptWin.putChar(61,2, ' ', topLength + 3);
-  } else {
-    promptWin.putAttribs(61,1, cPromptKey, topBotLength);
-    promptWin.putAttribs(61,2, cPromptKey, topBotLength);
-  }
-  displayLockState();
-  displayCharacterSet();        // Calls promptWin.update()
-} // end showPrompt
+enum PairState {
+  pairUnchecked,                // Files of the same size, not yet read
+  pairSame,                     // The files are the same
+  pairDiffer,                   // The files differ
+  pairOnly1,                    // Only the first tree has it
+  pairOnly2,                    // Only the second tree has it
+  pairMixed,                    // A file in one tree, a directory in the other
+  pairError                     // Unable to compare them
+};
 
 //--------------------------------------------------------------------
-// Initialize program:
+// A name found in either directory tree:
 //
-// Returns:
-//   True:   Initialization complete
-//   False:  Error
-
-bool initialize()
+// Member Variables:
+//   path:
+//     The name relative to the top of each tree (a directory's name
+//     ends with a slash)
+//   size:
+//     The size of both files, if they are the same size
+//   state:
+//     How the two compare
+//   error:
+//     Why they couldn't be compared (for pairError)
+
+struct FilePair
 {
-  if (!ConWindow::startup())
-    return false;
-
-  ConWindow::hideCursor();
-
-  calcScreenLayout(false);
-
-  inWin.init(0,0, inWidth+2,3, cPromptBdr);
-  inWin.border();
-  inWin.put((inWidth-4)/2,0, " Goto ");
-  inWin.setAttribs(cPromptWin);
-  inWin.hide();
+  String     path;
+  FPos       size;
+  PairState  state;
+  String     error;
+}; // end FilePair
 
-  int y;
-  if (singleFile) y = numLines + 1;
-  else            y = numLines * 2 + linesBetween + 2;
+typedef vector<FilePair>  PairVec;
 
-  promptWin.init(0,y, screenWidth,promptHeight, cBackground);
-  showPrompt();
-
-  if (!singleFile) diffs.resize();
-
-  file1.init(0, (singleFile ? NULL : &diffs));
-
-  if (!singleFile) file2.init(numLines + linesBetween + 1, &diffs);
-
-  return true;
-} // end initialize
+//--------------------------------------------------------------------
+bool byName(const DirEntry& a, const DirEntry& b)
+{
+  return a.name < b.name;
+} // end byName
 
 //--------------------------------------------------------------------
-// Get a command from the keyboard:
+// Pair up the names in two directory trees:
 //
-// Returns:
-//   Command code
+// Files that are in both trees but aren't the same size are marked
+// as different without being read.  A directory that is in both
+// trees is paired up in turn, and its contents follow its name.
+//
+// Input:
+//   top1, top2:  The top of each tree (ending with a slash)
+//   sub:         The directory to pair up, relative to the top
+//                (empty for the top, otherwise ending with a slash)
+//
+// Output:
+//   pairs:  Has an entry added for each name in either directory,
+//           in order by name
 
-#ifdef WIN32_CONSOLE
-Command getCommand()
+void pairFiles(const String& top1, const String& top2, const String& sub,
+               PairVec& pairs)
 {
-  KEY_EVENT_RECORD e;
-  Command  cmd = cmNothing;
+  DirVec    list1, list2;
+  FilePair  pair;
 
-  while (cmd == cmNothing) {
-    ConWindow::readKey(e);
+  pair.path  = sub;
+  pair.size  = 0;
+  pair.state = pairError;
 
-    switch (safeUC(e.uChar.AsciiChar)) {
-     case KEY_RETURN:           // Enter
-     case ' ':                  // Space
-      cmd = cmNextDiff;
-      break;
+  if (!ListDirectory((top1 + sub).c_str(), list1)) {
+    pair.error = top1 + sub + ": " + ErrorMsg();
+    pairs.push_back(pair);
+    return;
+  }
 
-     case 0x05:                 // Ctrl+E
-     case 'E':
-      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
-        cmd = cmEditBottom;
-      else
-        cmd = cmEditTop;
-      break;
+  if (!ListDirectory((top2 + sub).c_str(), list2)) {
+    pair.error = top2 + sub + ": " + ErrorMsg();
+    pairs.push_back(pair);
+    return;
+  }
 
-     case 'F':
-      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
-        cmd = cmFind|cmgGotoBottom;
-      else
-        cmd = cmFind|cmgGotoBoth;
-      break;
+  sort(list1.begin(), list1.end(), byName);
+  sort(list2.begin(), list2.end(), byName);
 
-     case 0x06:               // Ctrl+F
-      cmd = cmFind|cmgGotoTop;
-      break;
+  DirVec::const_iterator  e1 = list1.begin();
+  DirVec::const_iterator  e2 = list2.begin();
 
-     case 'G':
-      if (e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED))
-        cmd = cmgGoto|cmgGotoBottom;
-      else
-        cmd = cmgGoto|cmgGotoBoth;
-      break;
+  while (e1 != list1.end() || e2 != list2.end()) {
+    pair.size  = 0;
+    pair.state = pairUnchecked;
 
-     case 0x07:               // Ctrl+G
-      cmd = cmgGoto|cmgGotoTop;
-      break;
+    if (e2 == list2.end() || (e1 != list1.end() && e1->name < e2->name)) {
+      pair.path  = sub + e1->name + (e1->isDir ? "/" : "");
+      pair.state = pairOnly1;
+      ++e1;
+    } else if (e1 == list1.end() || e2->name < e1->name) {
+      pair.path  = sub + e2->name + (e2->isDir ? "/" : "");
+      pair.state = pairOnly2;
+      ++e2;
+    } else {
+      pair.path = sub + e1->name;
 
-     case KEY_ESCAPE:         // Esc
-     case 0x03:               // Ctrl+C
-     case 'Q':
-      cmd = cmQuit;
-      break;
+      if (e1->isDir && e2->isDir) {
+        pairFiles(top1, top2, pair.path + '/', pairs);
+        ++e1;  ++e2;
+        continue;
+      }
 
-     case 'C':  cmd = cmToggleASCII;  break;
+      if (e1->isDir != e2->isDir) pair.state = pairMixed;
+      else if (e1->size != e2->size) pair.state = pairDiffer;
+      else pair.size = e1->size;
 
-     default:                 // Try extended codes
-      switch (e.wVirtualKeyCode) {
-       case VK_DOWN:   cmd = cmmMove|cmmMoveLine|cmmMoveForward;  break;
-       case VK_RIGHT:  cmd = cmmMove|cmmMoveByte|cmmMoveForward;  break;
-       case VK_NEXT:   cmd = cmmMove|cmmMovePage|cmmMoveForward;  break;
-       case VK_END:    cmd = cmmMove|cmmMoveAll|cmmMoveForward;   break;
-       case VK_LEFT:   cmd = cmmMove|cmmMoveByte;                 break;
-       case VK_UP:     cmd = cmmMove|cmmMoveLine;                 break;
-       case VK_PRIOR:  cmd = cmmMove|cmmMovePage;                 break;
-       case VK_HOME:   cmd = cmmMove|cmmMoveAll;                  break;
-      } // end switch virtual key code
-      break;
-    } // end switch ASCII code
-  } // end while no command
+      ++e1;  ++e2;
+    } // end else name is in both directories
 
-  if (cmd & cmmMove) {
-    if ((e.dwControlKeyState & (LEFT_ALT_PRESSED|RIGHT_ALT_PRESSED)) == 0)
-      cmd |= cmmMoveTop;
-    if ((e.dwControlKeyState & (LEFT_CTRL_PRESSED|RIGHT_CTRL_PRESSED)) == 0)
-      cmd |= cmmMoveBottom;
-  } // end if move command
+    pairs.push_back(pair);
+  } // end while more names
+} // end pairFiles
 
-  return cmd;
-} // end getCommand
+//====================================================================
+// Class PairChecker:
+//
+// Reads the pairs of files that are the same size, to see whether
+// they are the same.
+//
+// The pairs are compared on several threads at once (one for each
+// processor), so that the storage is kept busy even when most of the
+// files are small.  Each thread takes the next pair until there are
+// none left.  The largest pairs go first, so that one big file near
+// the end of the list doesn't leave the other threads with nothing
+// to do.
+//
+// Member Variables:
+//   top1, top2:  The top of each tree (ending with a slash)
+//   pairs:       The pairs being compared
+//   todo:        The indexes of the pairs to compare, largest first
+//   next:        The index in todo of the next pair to compare
+//   lock:        Protects next
+//--------------------------------------------------------------------
 
-#else // using curses interface
-Command getCommand()
+class PairChecker
 {
-  Command  cmd = cmNothing;
-
-  while (cmd == cmNothing) {
-    int e = promptWin.readKey();
-
-    switch (safeUC(e)) {
-     case KEY_RETURN:           // Enter
-     case ' ':                  // Space
-      cmd = cmNextDiff;
-      break;
-
-     case 'E':
-      if (lockState == lockTop)
-        cmd = cmEditBottom;
-      else
-        cmd = cmEditTop;
-      break;
+ protected:
+  const String&    top1;
+  const String&    top2;
+  PairVec&         pairs;
+  vector<VecSize>  todo;
+  VecSize          next;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t  lock;
+#endif
 
-     case 'F':
-      cmd = cmFind;
-      if (lockState != lockTop)    cmd |= cmgGotoTop;
-      if (lockState != lockBottom) cmd |= cmgGotoBottom;
-      break;
+ public:
+  PairChecker(const String& aTop1, const String& aTop2, PairVec& aPairs);
+  ~PairChecker();
+  void  run();
 
-     case 'G':
-      cmd = cmgGoto;
-      if (lockState != lockTop)    cmd |= cmgGotoTop;
-      if (lockState != lockBottom) cmd |= cmgGotoBottom;
-      break;
+ protected:
+  void  check(Byte* buf, FilePair& pair);
+  void  checkAll();
+#ifdef HAVE_PTHREADS
+  static void*  worker(void* checker);
+#endif
+}; // end PairChecker
 
-     case KEY_ESCAPE:
-     case 0x03:               // Ctrl+C
-     case 'Q':
-      cmd = cmQuit;
-      break;
+// Sorts the indexes of pairs with the largest files first:
 
-     case 'C':  cmd = cmToggleASCII;  break;
+struct LargerPair
+{
+  const PairVec*  pairs;
 
-     case 'B':  if (!singleFile) cmd = cmUseBottom;              break;
-     case 'T':  if (!singleFile) cmd = cmUseTop;                 break;
+  bool operator()(VecSize a, VecSize b) const
+    { return (*pairs)[a].size > (*pairs)[b].size; };
+}; // end LargerPair
 
-     case KEY_DOWN:   cmd = cmmMove|cmmMoveLine|cmmMoveForward;  break;
-     case KEY_RIGHT:  cmd = cmmMove|cmmMoveByte|cmmMoveForward;  break;
-     case KEY_NPAGE:  cmd = cmmMove|cmmMovePage|cmmMoveForward;  break;
-     case KEY_END:    cmd = cmmMove|cmmMoveAll|cmmMoveForward;   break;
-     case KEY_LEFT:   cmd = cmmMove|cmmMoveByte;                 break;
-     case KEY_UP:     cmd = cmmMove|cmmMoveLine;                 break;
-     case KEY_PPAGE:  cmd = cmmMove|cmmMovePage;                 break;
-     case KEY_HOME:   cmd = cmmMove|cmmMoveAll;                  break;
-    } // end switch ASCII code
-  } // end while no command
+//--------------------------------------------------------------------
+// Constructor:
+//
+// Input:
+//   aTop1, aTop2:  The top of each tree (must remain valid)
+//   aPairs:        The pairs to compare (from pairFiles)
+
+PairChecker::PairChecker(const String& aTop1, const String& aTop2,
+                         PairVec& aPairs)
+: top1(aTop1),
+  top2(aTop2),
+  pairs(aPairs),
+  next(0)
+{
+  for (VecSize i = 0; i < pairs.size(); ++i)
+    if (pairs[i].state == pairUnchecked) todo.push_back(i);
 
-  if (cmd & cmmMove) {
-    if (lockState != lockTop)    cmd |= cmmMoveTop;
-    if (lockState != lockBottom) cmd |= cmmMoveBottom;
-  } // end if move command
+  LargerPair  larger = { &pairs };
+  stable_sort(todo.begin(), todo.end(), larger);
 
-  return cmd;
-} // end getCommand
-#endif  // end else curses interface
+#ifdef HAVE_PTHREADS
+  pthread_mutex_init(&lock, NULL);
+#endif
+} // end PairChecker::PairChecker
 
 //--------------------------------------------------------------------
-// Get a file position and move there:
+// Destructor:
 
-void gotoPosition(Command cmd)
+PairChecker::~PairChecker()
 {
-  positionInWin(cmd, inWidth+2, " Goto ");
+#ifdef HAVE_PTHREADS
+  pthread_mutex_destroy(&lock);
+#endif
+} // end PairChecker::~PairChecker
 
-  const int  maxLen = inWidth-2;
-  char  buf[maxLen+1];
+//--------------------------------------------------------------------
+// Compare all the pairs:
+//
+// Returns when every pair has been compared.
 
-  getString(buf, maxLen, positionHistory, hexDigits, true);
+void PairChecker::run()
+{
+#ifdef HAVE_PTHREADS
+  const long  processors = sysconf(_SC_NPROCESSORS_ONLN);
 
-  if (!buf[0])
-    return;
+  VecSize  threads = (processors > 1 ? processors : 1);
+  if (threads > todo.size()) threads = todo.size();
 
-  FPos  pos = strtoul(buf, NULL, 16);
+  vector<pthread_t>  workers;
 
-  if (cmd & cmgGotoTop)
-    file1.moveTo(pos);
-  if (cmd & cmgGotoBottom)
-    file2.moveTo(pos);
-} // end gotoPosition
+  // This thread is one of the workers:
+  while (threads-- > 1) {
+    pthread_t  thread;
+    if (pthread_create(&thread, NULL, worker, this) != 0) break;
+    workers.push_back(thread);
+  }
+
+  checkAll();
+
+  for (VecSize i = 0; i < workers.size(); ++i)
+    pthread_join(workers[i], NULL);
+#else
+  checkAll();
+#endif
+} // end PairChecker::run
 
 //--------------------------------------------------------------------
-// Search for text or bytes in the files:
+// Compare one pair of files:
+//
+// Input:
+//   buf:   Room for 2 * streamBlockSize bytes
+//   pair:  The pair to compare
+//
+// Output:
+//   pair:  Its state is pairSame, pairDiffer, or pairError
 
-void searchFiles(Command cmd)
+void PairChecker::check(Byte* buf, FilePair& pair)
 {
-  const bool havePrev = !lastSearch.empty();
+  const String  name1 = top1 + pair.path;
+  const String  name2 = top2 + pair.path;
 
-  positionInWin(cmd, (havePrev ? 47 : 32), " Find ");
+  File  file1 = OpenFile(name1.c_str());
+  File  file2 = InvalidFile;
+  int   result = -1;
 
-  inWin.put(2, 1,"H Hex search   T Text search");
-  inWin.putAttribs( 2,1, cPromptKey, 1);
-  inWin.putAttribs(17,1, cPromptKey, 1);
-  if (havePrev) {
-    inWin.put(33, 1,"N Next match");
-    inWin.putAttribs(33,1, cPromptKey, 1);
+  if (file1 != InvalidFile) {
+    file2 = OpenFile(name2.c_str());
+    result = (file2 == InvalidFile ? -2 : sameContents(file1, file2, buf));
   }
-  inWin.update();
-  int key = safeUC(inWin.readKey());
 
-  bool hex = false;
+  if (result < 0) {
+    pair.state = pairError;
+    pair.error = (result == -1 ? name1 : name2) + ": " + ErrorMsg();
+  } else
+    pair.state = (result ? pairDiffer : pairSame);
 
-  if (key == KEY_ESCAPE) {
-    inWin.hide();
-    return;
-  } else if (key == 'H')
-    hex = true;
+  if (file1 != InvalidFile) CloseFile(file1);
+  if (file2 != InvalidFile) CloseFile(file2);
+} // end PairChecker::check
 
-  if (key == 'N' && havePrev) {
-    inWin.hide();
-  } else {
-    positionInWin(cmd, screenWidth, (hex ? " Find Hex Bytes" : " Find Text "));
+//--------------------------------------------------------------------
+// Compare pairs until there are none left:
+//
+// Called by each thread.  Each pair is changed only by the thread
+// that took it.
 
-    const int  maxLen = screenWidth-4;
-    Byte  buf[maxLen+1];
-    int   searchLen;
+void PairChecker::checkAll()
+{
+  Byte *const  buf = new Byte[2 * streamBlockSize];
 
-    if (hex) {
-      getString(reinterpret_cast<char*>(buf), maxLen, hexSearchHistory, hexDigits, true, true);
-      searchLen = packHex(buf);
-    } else {
-      getString(reinterpret_cast<char*>(buf), maxLen, textSearchHistory);
+  for (;;) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&lock);
+    const VecSize  i = next++;
+    pthread_mutex_unlock(&lock);
+#else
+    const VecSize  i = next++;
+#endif
 
-      searchLen = strlen(reinterpret_cast<char*>(buf));
-      if (displayTable == ebcdicDisplayTable) {
-        for (int i = 0; i < searchLen; ++i)
-          buf[i] = ascii2ebcdicTable[buf[i]];
-      } // end if in EBCDIC mode
-    } // end else text search
+    if (i >= todo.size()) break;
 
-    if (!searchLen) return;
+    check(buf, pairs[todo[i]]);
+  } // end forever
 
-    lastSearch.assign(reinterpret_cast<char*>(buf), searchLen);
-  } // end else need to read search string
+  delete [] buf;
+} // end PairChecker::checkAll
 
-  bool problem = false;
-  const Byte *const  searchPattern =
-    reinterpret_cast<const Byte*>(lastSearch.c_str());
+#ifdef HAVE_PTHREADS
+//--------------------------------------------------------------------
+// A worker thread:
+//
+// Input:
+//   checker:  The PairChecker whose pairs should be compared
 
-  if ((cmd & cmgGotoTop) &&
-      !file1.moveTo(searchPattern, lastSearch.length()))
-    problem = true;
-  if ((cmd & cmgGotoBottom) &&
-      !file2.moveTo(searchPattern, lastSearch.length()))
-    problem = true;
+void* PairChecker::worker(void* checker)
+{
+  static_cast<PairChecker*>(checker)->checkAll();
 
-  if (problem) beep();
-} // end searchFiles
+  return NULL;
+} // end PairChecker::worker
+#endif // HAVE_PTHREADS
 
 //--------------------------------------------------------------------
-// Handle a command:
+// List the results of comparing two trees:
+//
+// The pairs of files that differ are numbered, so one can be chosen.
 //
 // Input:
-//   cmd:  The command to be handled
+//   pairs:  The pairs to list
+//   all:    False means list only the pairs of files that differ
 
-void handleCmd(Command cmd)
+void listPairs(const PairVec& pairs, bool all)
 {
-  if (cmd & cmmMove) {
-    int  step = steps[cmd & cmmMoveSize];
+  static const char *const  label[] = {
+    "unchecked", "identical", "differs", "only in 1", "only in 2",
+    "file & dir", "error"
+  };
 
-    if ((cmd & cmmMoveForward) == 0)
-      step *= -1;               // We're moving backward
+  int  number = 0;
 
-    if ((cmd & cmmMoveForward) && !step) {
-      if (cmd & cmmMoveTop)
-        file1.moveToEnd((!singleFile && (cmd & cmmMoveBottom)) ? &file2 : NULL);
-      else
-        file2.moveToEnd(NULL);
-    } else {
-      if (cmd & cmmMoveTop) {
-        if (step)
-          file1.move(step);
-        else
-          file1.moveTo(0);
-      } // end if moving top file
-
-      if (cmd & cmmMoveBottom) {
-        if (step)
-          file2.move(step);
-        else
-          file2.moveTo(0);
-      } // end if moving bottom file
-    } // end else not moving to end
-  } // end if move
-  else if ((cmd & cmgGotoMask) == cmgGoto)
-    gotoPosition(cmd);
-  else if ((cmd & cmgGotoMask) == cmFind)
-    searchFiles(cmd);
-  else if (cmd == cmNextDiff) {
-    if (lockState) {
-      lockState = lockNeither;
-      displayLockState();
-    }
-    do {
-      file1.move(bufSize);
-      file2.move(bufSize);
-    } while (!diffs.compute());
-  } // end else if cmNextDiff
-  else if (cmd == cmUseTop) {
-    if (lockState == lockBottom)
-      lockState = lockNeither;
-    else
-      lockState = lockBottom;
-    displayLockState();
-  }
-  else if (cmd == cmUseBottom) {
-    if (lockState == lockTop)
-      lockState = lockNeither;
+  for (PairVec::const_iterator p = pairs.begin(); p != pairs.end(); ++p) {
+    if (p->state == pairDiffer) {
+      char  buf[16];
+      sprintf(buf, "%5d  ", ++number);
+      cout << buf;
+    } else if (!all)
+      continue;
     else
-      lockState = lockTop;
-    displayLockState();
-  }
-  else if (cmd == cmToggleASCII) {
-    displayTable = ((displayTable == asciiDisplayTable)
-                    ? ebcdicDisplayTable
-                    : asciiDisplayTable );
-    displayCharacterSet();
-  }
-  else if (cmd == cmEditTop)
-    file1.edit(singleFile ? NULL : &file2);
-  else if (cmd == cmEditBottom)
-    file2.edit(&file1);
+      cout << "       ";
 
-  // Make sure we haven't gone past the end of both files:
-  while (diffs.compute() < 0) {
-    file1.move(-steps[cmmMovePage]);
-    file2.move(-steps[cmmMovePage]);
-  }
+    cout << label[p->state];
+    cout.write("            ", 12 - strlen(label[p->state]));
+    cout << (p->state == pairError ? p->error : p->path) << '\n';
+  } // end for each pair
+} // end listPairs
 
-  file1.display();
-  file2.display();
-} // end handleCmd
+//--------------------------------------------------------------------
+// Compare two directory trees:
+//
+// Lists each file found in either tree, and whether the files are
+// identical, differ, or are missing from one tree.  Then, if the
+// user is at a terminal, offers to display any pair that differs.
+//
+// Input:
+//   name1, name2:  The directories to compare
+//
+// Returns:
+//   The exit status: 0 if the trees are the same, 1 if they differ,
+//   or 2 if an error occurred
+
+int compareDirectories(const char* name1, const char* name2)
+{
+  String  top1(name1), top2(name2);
+
+  if (*top1.rbegin() != '/') top1 += '/';
+  if (*top2.rbegin() != '/') top2 += '/';
+
+  PairVec  pairs;
+  pairFiles(top1, top2, String(), pairs);
+
+  PairChecker  checker(top1, top2, pairs);
+  checker.run();
+
+  int  counts[pairError + 1] = { 0 };
+
+  for (PairVec::const_iterator p = pairs.begin(); p != pairs.end(); ++p)
+    ++counts[p->state];
+
+  listPairs(pairs, true);
+
+  cout << '\n' << counts[pairSame] << " identical, "
+       << counts[pairDiffer] << (counts[pairDiffer] == 1 ? " differs, "
+                                                         : " differ, ")
+       << counts[pairOnly1] << " only in 1 (" << name1 << "), "
+       << counts[pairOnly2] << " only in 2 (" << name2 << ")";
+  if (counts[pairMixed]) cout << ", " << counts[pairMixed] << " file & dir";
+  if (counts[pairError]) cout << ", " << counts[pairError] << " errors";
+  cout << endl;
+
+  const int  differ = counts[pairDiffer];
+
+  if (differ && IsInteractive()) {
+    String  answer;
+
+    for (;;) {
+      cout << "\nDisplay which pair (1-" << differ << ", or Enter to quit)? "
+           << flush;
+      if (!getline(cin, answer) || answer.empty()) break;
+
+      int  choice = atoi(answer.c_str());
+      if (choice < 1 || choice > differ) {
+        cout << "There is no pair " << answer << ".\n";
+        continue;
+      }
+
+      PairVec::const_iterator p = pairs.begin();
+      for (;; ++p)
+        if (p->state == pairDiffer && !--choice) break;
+
+      const String  name1 = top1 + p->path;
+      const String  name2 = top2 + p->path;
+      const char*   names[2] = { name1.c_str(), name2.c_str() };
+
+      viewFiles(2, names);
+
+      listPairs(pairs, false);
+    } // end forever
+  } // end if offering to display a pair
+
+  if (counts[pairError]) return 2;
+
+  return (counts[pairSame] == int(pairs.size()) ? 0 : 1);
+} // end compareDirectories
 
 //====================================================================
 // Initialization and option processing:
@@ -1762,14 +8765,40 @@ void usage(bool showHelp, int exitStatus)
     cout << titleString << endl;
 
     if (showHelp)
-      cout << "Usage: " << program_name << " FILE1 [FILE2]\n\
+      cout << "Usage: " << program_name << " FILE1 [FILE2 [FILE3...]]\n\
+  or:  " << program_name << " DIR1 DIR2\n\
+  or:  " << program_name << " --series FILE1 FILE2 FILE3...\n\
+  or:  " << program_name << " --report [--json|--csv] [--bytes] FILE1 FILE2\n\
+  or:  " << program_name << " -q|-l FILE1 FILE2\n\
+  or:  " << program_name << " --dump [--html] FILE1 FILE2 [CONTEXT]\n\
+  or:  " << program_name << " --apply PATCH FILE [OUTPUT]\n\
 Compare FILE1 and FILE2 byte by byte.\n\
 If FILE2 is omitted, just display FILE1.\n\
+Given three or more files, compare them all at once.\n\
+Given two directories, compare every file in them.\n\
 \n\
 Options:\n\
+  -A, --apply              apply PATCH to FILE (or to a copy named OUTPUT)\n\
+  -B, --bytes              include the first bytes of each range in a report\n\
+  -C, --csv                write the report as CSV\n\
+  -D, --dump               write the lines that differ, as on the screen,\n\
+                           with CONTEXT lines around them (default 3)\n\
+  -J, --json               write the report as JSON\n\
+  -l, --list               list each differing byte, like cmp -l\n\
+  -q, --quiet              just set the exit status, like cmp -s\n\
+  -R, --report             list the ranges that differ, without the display\n\
+  -S, --series             compare each file with the next; < and > step\n\
+                           to the previous or next pair\n\
+  -W, --html               write the dump as HTML instead of ANSI text\n\
       --help               display this help information and exit\n\
       -L, --license        display license & warranty information and exit\n\
       -V, --version        display version information and exit\n";
+#ifdef CONWIN_HEADLESS
+    if (showHelp)
+      cout << "\
+  -H, --headless           run without a terminal, reading keys from stdin\n\
+                           and printing the final screen\n";
+#endif
   }
 
   exit(exitStatus);
@@ -1782,6 +8811,76 @@ bool usage(GetOpt* getopt, const GetOpt::Option* option,
   return false;                 // Never happens
 } // end usage
 
+//--------------------------------------------------------------------
+// Apply a patch instead of comparing files:
+
+bool useApply(GetOpt*, const GetOpt::Option*, const char*,
+              GetOpt::Connection, const char*, int*)
+{
+  runMode = runApply;
+  return true;
+} // end useApply
+
+//--------------------------------------------------------------------
+// Work like cmp instead of displaying the files:
+
+bool useCmpMode(GetOpt*, const GetOpt::Option* option, const char*,
+                GetOpt::Connection, const char*, int*)
+{
+  runMode = (option->shortName == 'q' ? runQuiet : runList);
+  return true;
+} // end useCmpMode
+
+//--------------------------------------------------------------------
+// Write a dump instead of displaying the files:
+
+bool useDump(GetOpt*, const GetOpt::Option* option, const char*,
+             GetOpt::Connection, const char*, int*)
+{
+  runMode = runDump;
+  if (option->shortName == 'W') dumpHTML = true;
+  return true;
+} // end useDump
+
+//--------------------------------------------------------------------
+// Write a report instead of displaying the files:
+
+bool useReport(GetOpt*, const GetOpt::Option* option, const char*,
+               GetOpt::Connection, const char*, int*)
+{
+  runMode = runReport;
+
+  switch (option->shortName) {
+   case 'B':  reportShowBytes = true;     break;
+   case 'C':  reportFormat = reportCSV;   break;
+   case 'J':  reportFormat = reportJSON;  break;
+  }
+
+  return true;
+} // end useReport
+
+#ifdef CONWIN_HEADLESS
+//--------------------------------------------------------------------
+// Run without a terminal (for testing and benchmarks):
+
+bool useHeadless(GetOpt*, const GetOpt::Option*, const char*,
+                 GetOpt::Connection, const char*, int*)
+{
+  headless = true;
+  return true;
+} // end useHeadless
+#endif // CONWIN_HEADLESS
+
+//--------------------------------------------------------------------
+// Step through a series of snapshots:
+
+bool useSeries(GetOpt*, const GetOpt::Option*, const char*,
+               GetOpt::Connection, const char*, int*)
+{
+  runMode = runSeries;
+  return true;
+} // end useSeries
+
 //--------------------------------------------------------------------
 // Handle options:
 //
@@ -1797,9 +8896,22 @@ void processOptions(int& argc, char**& argv)
 {
   static const GetOpt::Option options[] =
   {
+    { 'A', "apply",      NULL, 0, &useApply },
+    { 'B', "bytes",      NULL, 0, &useReport },
+    { 'C', "csv",        NULL, 0, &useReport },
+    { 'D', "dump",       NULL, 0, &useDump },
+    { 'J', "json",       NULL, 0, &useReport },
+    { 'R', "report",     NULL, 0, &useReport },
+    { 'S', "series",     NULL, 0, &useSeries },
+    { 'W', "html",       NULL, 0, &useDump },
+    { 'l', "list",       NULL, 0, &useCmpMode },
+    { 'q', "quiet",      NULL, 0, &useCmpMode },
     { '?', "help",       NULL, 0, &usage },
     { 'L', "license",    NULL, 0, &license },
     { 'V', "version",    NULL, 0, &usage },
+#ifdef CONWIN_HEADLESS
+    { 'H', "headless",   NULL, 0, &useHeadless },
+#endif
     { 0 }
   };
 
@@ -1829,52 +8941,57 @@ int main(int argc, char* argv[])
 
   processOptions(argc, argv);
 
-  if (argc < 2 || argc > 3)
-    usage(1);
+  if (runMode == runApply) {
+    if (argc < 3 || argc > 4)
+      usage(true, 2);
 
-  cout << "\
-VBinDiff " PACKAGE_VERSION ", Copyright 1995-2017 Christopher J. Madsen\n\
-VBinDiff comes with ABSOLUTELY NO WARRANTY; for details type `vbindiff -L'.\n";
+    return applyPatch(argv[1], argv[2], (argc == 4 ? argv[3] : NULL));
+  }
 
-  singleFile = (argc == 2);
-  if (!initialize()) {
-    cerr << '\n' << program_name << ": Unable to initialize windows\n";
-    return 1;
+  if (runMode == runReport) {
+    if (argc != 3)
+      usage(true, 2);
+
+    return writeReport(argv[1], argv[2]);
   }
 
-  {
-    ostringstream errMsg;
+  if (runMode == runDump) {
+    if (argc < 3 || argc > 4 ||
+        (argc == 4 && strspn(argv[3], "0123456789") != strlen(argv[3])))
+      usage(true, 2);
 
-    if (!file1.setFile(argv[1])) {
-      const char* errStr = ErrorMsg();
-      errMsg << "Unable to open " << argv[1] << ": " << errStr;
-    }
-    else if (!singleFile && !file2.setFile(argv[2])) {
-      const char* errStr = ErrorMsg();
-      errMsg << "Unable to open " << argv[2] << ": " << errStr;
-    }
-    string error(errMsg.str());
-    if (error.length())
-      exitMsg(1, error.c_str());
-  } // end block around errMsg
+    return dumpDifferences(argv[1], argv[2],
+                           (argc == 4 ? atoi(argv[3]) : 3));
+  }
 
-  diffs.compute();
+  if (runMode == runList || runMode == runQuiet) {
+    if (argc != 3)
+      usage(true, 2);
 
-  file1.display();
-  file2.display();
+    return (runMode == runList ? listDifferences(argv[1], argv[2])
+                               : quickCompare(argv[1], argv[2]));
+  }
 
-  Command  cmd;
-  while ((cmd = getCommand()) != cmQuit)
-    handleCmd(cmd);
+  if (runMode == runSeries) {
+    if (argc < 3)
+      usage(true, 2);
 
-  file1.shutDown();
-  file2.shutDown();
-  inWin.close();
-  promptWin.close();
+    seriesNames.assign(argv + 1, argv + argc);
+    argc = 3;                   // Start with the first pair
+  }
+  else if (argc < 2)
+    usage(1);
+  else if (argc == 3 && IsDirectory(argv[1]) && IsDirectory(argv[2]))
+    return compareDirectories(argv[1], argv[2]);
 
-  ConWindow::shutdown();
+#ifdef CONWIN_HEADLESS
+  if (!headless)              // Keep the screen printed at exit clean
+#endif
+    cout << "\
+VBinDiff " PACKAGE_VERSION ", Copyright 1995-2017 Christopher J. Madsen\n\
+VBinDiff comes with ABSOLUTELY NO WARRANTY; for details type `vbindiff -L'.\n";
 
-  return 0;
+  return viewFiles(argc - 1, argv + 1);
 } // end main
 
 //--------------------------------------------------------------------
@@ -34,6 +34,7 @@ void exitMsg(int status, const char* message); // From vbindiff.cpp
 #define F_WHITE (FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_BLUE)
 #define F_YELLOW (FOREGROUND_GREEN|FOREGROUND_RED)
 #define B_BLUE  BACKGROUND_BLUE
+#define B_CYAN  (BACKGROUND_GREEN|BACKGROUND_BLUE)
 #define B_WHITE (BACKGROUND_RED|BACKGROUND_GREEN|BACKGROUND_BLUE)
 
 static const WORD colorStyle[] = {
@@ -45,7 +46,8 @@ static const WORD colorStyle[] = {
   F_BLACK|B_WHITE,                      // cFileName
   F_WHITE|B_BLUE,                       // cFileWin
   F_RED|B_BLUE|FOREGROUND_INTENSITY,    // cFileDiff
-  F_YELLOW|B_BLUE|FOREGROUND_INTENSITY  // cFileEdit
+  F_YELLOW|B_BLUE|FOREGROUND_INTENSITY, // cFileEdit
+  F_BLACK|B_CYAN                        // cFileMatch
 };
 
 //====================================================================
@@ -155,6 +157,33 @@ void ConWindow::readKey(KEY_EVENT_RECORD& event)
   } // end forever
 } // end ConWindow::readKey
 
+//--------------------------------------------------------------------
+// Read the next key down event without waiting:
+//
+// Output:
+//   event:  Contains a key down event (if one was waiting)
+//
+// Returns:
+//   true:   A key was waiting
+//   false:  No key down event was waiting
+
+bool ConWindow::pollKey(KEY_EVENT_RECORD& event)
+{
+  INPUT_RECORD  e;
+  DWORD         count;
+
+  while (PeekConsoleInput(inBuf, &e, 1, &count) && count) {
+    ReadConsoleInput(inBuf, &e, 1, &count);
+
+    if ((e.EventType == KEY_EVENT) && e.Event.KeyEvent.bKeyDown) {
+      event = e.Event.KeyEvent;
+      return true;
+    }
+  } // end while events waiting
+
+  return false;
+} // end ConWindow::pollKey
+
 //--------------------------------------------------------------------
 // Curses-compatible readKey function:
 
@@ -181,6 +210,27 @@ int ConWindow::readKey()
   return e.uChar.AsciiChar;
 } // end ConWindow::readKey
 
+//--------------------------------------------------------------------
+// Curses-compatible pollKey function:
+//
+// Returns:
+//   The key pressed (as readKey), or -1 if no key is waiting
+
+int ConWindow::pollKey()
+{
+  INPUT_RECORD  e;
+  DWORD         count;
+
+  while (PeekConsoleInput(inBuf, &e, 1, &count) && count) {
+    if ((e.EventType == KEY_EVENT) && e.Event.KeyEvent.bKeyDown)
+      return readKey();
+
+    ReadConsoleInput(inBuf, &e, 1, &count); // Discard other events
+  } // end while events waiting
+
+  return -1;
+} // end ConWindow::pollKey
+
 //--------------------------------------------------------------------
 // Make the cursor visible:
 
@@ -353,6 +403,22 @@ void ConWindow::putAttribs(short x, short y, Style color, short count)
     (c++)->Attributes = colorStyle[color];
 } // end ConWindow::putAttribs
 
+//--------------------------------------------------------------------
+// Change the attributes of a row of characters:
+//
+// Input:
+//   x,y:     The position in the window to start changing attributes
+//   colors:  The attribute for each character
+//   count:   The number of characters to change
+
+void ConWindow::putAttribs(short x, short y, const Style* colors, short count)
+{
+  PCHAR_INFO  c = data + x + size.X * y;
+
+  while (count--)
+    (c++)->Attributes = colorStyle[*(colors++)];
+} // end ConWindow::putAttribs
+
 //--------------------------------------------------------------------
 // Write a character using the current attributes:
 //
@@ -385,6 +451,38 @@ void ConWindow::resize(short width, short height)
   clear();
 } // end ConWindow::resize
 
+//--------------------------------------------------------------------
+// Scroll part of the window:
+//
+// The lines scrolled into view are blank.
+//
+// Input:
+//   top, bottom:  The first and last lines of the region to scroll
+//   lines:        The number of lines to scroll up (negative for down)
+
+void ConWindow::scroll(short top, short bottom, short lines)
+{
+  const int  height = bottom - top + 1;
+  const int  keep   = height - (lines < 0 ? -lines : lines);
+
+  PCHAR_INFO  region = data + size.X * top;
+
+  if (keep > 0) {
+    if (lines > 0)
+      memmove(region, region + size.X * lines, size.X * keep * sizeof(CHAR_INFO));
+    else
+      memmove(region - size.X * lines, region, size.X * keep * sizeof(CHAR_INFO));
+  }
+
+  // Blank the lines that scrolled into view:
+  const int  blank = (keep > 0 ? height - keep : height);
+  PCHAR_INFO  c = region + (lines > 0 ? size.X * (height - blank) : 0);
+  for (int i = size.X * blank; i > 0; ++c, --i) {
+    c->Char.AsciiChar = ' ';
+    c->Attributes = attribs;
+  }
+} // end ConWindow::scroll
+
 //--------------------------------------------------------------------
 void ConWindow::setAttribs(Style color)
 {
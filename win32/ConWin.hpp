@@ -48,7 +48,8 @@ enum Style {
   cFileName,
   cFileWin,
   cFileDiff,
-  cFileEdit
+  cFileEdit,
+  cFileMatch
 };
 
 class ConWindow
@@ -75,9 +76,12 @@ class ConWindow
 ///void put(short x, short y, const String& s);
   void put(short x, short y, const char* s);
   void putAttribs(short x, short y, Style color, short count);
+  void putAttribs(short x, short y, const Style* colors, short count);
   void putChar(short x, short y, char c, short count);
+  int  pollKey();
   int  readKey();
   void resize(short width, short height);
+  void scroll(short top, short bottom, short lines);
   void setAttribs(Style color);
   void setCursor(short x, short y);
   void update(unsigned short margin=0);
@@ -87,6 +91,7 @@ class ConWindow
 
   static void getScreenSize(int& x, int& y);
   static void hideCursor();
+  static bool pollKey(KEY_EVENT_RECORD& event);
   static void readKey(KEY_EVENT_RECORD& event);
   static void showCursor(bool insert=true);
   static void shutdown();
@@ -33,6 +33,13 @@ const DWORD
 
 const File InvalidFile = INVALID_HANDLE_VALUE;
 
+struct DirEntry
+{
+  string  name;                 // The name within the directory
+  bool    isDir;                // True if it is a directory
+  FPos    size;                 // The size of a file (0 for a directory)
+}; // end DirEntry
+
 #ifndef INVALID_SET_FILE_POINTER
 #define INVALID_SET_FILE_POINTER ((DWORD)0xFFFFFFFF)
 #endif
@@ -48,10 +55,15 @@ LPCTSTR ErrorMsg()
 } // end ErrorMsg
 
 //--------------------------------------------------------------------
+// Open an existing file:
+//
+// Other handles may read, write, rename, or delete the file while it
+// is open, so RenameFile can replace it.
+
 inline File OpenFile(const char* path, bool writable=false)
 {
   return CreateFile(path, (writable ? GENERIC_READ|GENERIC_WRITE : GENERIC_READ),
-                    FILE_SHARE_READ|FILE_SHARE_WRITE,
+                    FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
                     NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 } // end OpenFile
 
@@ -95,6 +107,268 @@ FPos SeekFile(File file, FPos position, DWORD whence=SeekPos)
    return li.QuadPart;
 } // end SeekFile
 
+//--------------------------------------------------------------------
+inline bool SyncFile(File file)
+{
+  return (FlushFileBuffers(file) != 0);
+} // end SyncFile
+
+//--------------------------------------------------------------------
+// Copy part of one file to the current position of another:
+
+bool CopyFileRange(File from, FPos pos, File to, FPos count)
+{
+  char  buf[64 * 1024];
+
+  while (count > 0) {
+    if (SeekFile(from, pos) != pos) return false;
+
+    const Size  bytesRead = ReadFile(from, buf, (count < FPos(sizeof(buf))
+                                                 ? Size(count) : sizeof(buf)));
+    if (bytesRead <= 0) {
+      if (bytesRead == 0) SetLastError(ERROR_HANDLE_EOF); // File got shorter
+      return false;
+    }
+
+    if (!WriteFile(to, buf, bytesRead)) return false;
+
+    pos   += bytesRead;
+    count -= bytesRead;
+  } // end while more to copy
+
+  return true;
+} // end CopyFileRange
+
+//--------------------------------------------------------------------
+// Create a new file:
+//
+// Fails if the file already exists.
+//
+// Returns:
+//   The new file (open for writing), or InvalidFile
+
+inline File CreateNewFile(const char* path)
+{
+  return CreateFile(path, GENERIC_READ|GENERIC_WRITE, 0, NULL, CREATE_NEW,
+                    FILE_ATTRIBUTE_NORMAL, NULL);
+} // end CreateNewFile
+
+//--------------------------------------------------------------------
+// Create a new file to replace an existing one:
+//
+// The new file is in the same directory, so RenameFile can move it
+// over the original.
+//
+// Input:
+//   path:  The file to be replaced
+//
+// Output:
+//   tempPath:  The name of the new file
+//
+// Returns:
+//   The new file (open for writing), or InvalidFile
+
+File CreateTempFile(const char* path, string& tempPath)
+{
+  char  suffix[16];
+
+  for (DWORD n = GetTickCount(), tries = 0; tries < 100; ++n, ++tries) {
+    sprintf(suffix, ".vbd%04lX", n & 0xFFFF);
+    tempPath = path;
+    tempPath += suffix;
+
+    File  file = CreateFile(tempPath.c_str(), GENERIC_READ|GENERIC_WRITE, 0,
+                            NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file != InvalidFile || GetLastError() != ERROR_FILE_EXISTS)
+      return file;
+  } // end for each name to try
+
+  return InvalidFile;
+} // end CreateTempFile
+
+//--------------------------------------------------------------------
+// Find the file a path refers to:
+//
+// Windows XP can't resolve symbolic links, so the path is used as is.
+//
+// Output:
+//   resolved:  The path of the file itself
+//
+// Returns:
+//   true:   Success
+
+inline bool ResolvePath(const char* path, string& resolved)
+{
+  resolved = path;
+  return true;
+} // end ResolvePath
+
+//--------------------------------------------------------------------
+// Open another handle for a file:
+
+File DupFile(File file)
+{
+  HANDLE  process = GetCurrentProcess();
+  HANDLE  dup;
+
+  if (!DuplicateHandle(process, file, process, &dup, 0, FALSE,
+                       DUPLICATE_SAME_ACCESS))
+    return InvalidFile;
+
+  return dup;
+} // end DupFile
+
+//--------------------------------------------------------------------
+inline bool RemoveFile(const char* path)
+{
+  return (DeleteFile(path) != 0);
+} // end RemoveFile
+
+//--------------------------------------------------------------------
+// Change the size of a file:
+//
+// Bytes past the new size are discarded, or zero bytes are added.
+
+inline bool ResizeFile(File file, FPos size)
+{
+  return (SeekFile(file, size) == size && SetEndOfFile(file));
+} // end ResizeFile
+
+//--------------------------------------------------------------------
+// Replace a file with another one:
+//
+// Windows won't replace a file that is open, even when every handle
+// allows it to be deleted, but it will rename one.  So if the file at
+// newPath is open, it is moved aside, the new file is moved in, and
+// the old one is deleted (Windows removes it when the last handle is
+// closed).  If the new file can't be moved in, the old one is put
+// back.  oldPath must not be open.
+
+bool RenameFile(const char* oldPath, const char* newPath)
+{
+  if (MoveFileEx(oldPath, newPath,
+                 MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    return true;
+
+  if (GetLastError() != ERROR_ACCESS_DENIED &&
+      GetLastError() != ERROR_SHARING_VIOLATION)
+    return false;
+
+  string  aside;
+  char    suffix[16];
+
+  for (DWORD n = GetTickCount(), tries = 0; ; ++n, ++tries) {
+    if (tries >= 100) return false;
+
+    sprintf(suffix, ".vbd%04lX", n & 0xFFFF);
+    aside = newPath;
+    aside += suffix;
+
+    if (MoveFileEx(newPath, aside.c_str(), MOVEFILE_WRITE_THROUGH))
+      break;
+    if (GetLastError() != ERROR_ALREADY_EXISTS &&
+        GetLastError() != ERROR_FILE_EXISTS)
+      return false;
+  } // end for each name to try
+
+  if (!MoveFileEx(oldPath, newPath, MOVEFILE_WRITE_THROUGH)) {
+    const DWORD  error = GetLastError();
+    MoveFileEx(aside.c_str(), newPath, MOVEFILE_WRITE_THROUGH);
+    SetLastError(error);          // For ErrorMsg
+    return false;
+  }
+
+  DeleteFile(aside.c_str());
+  return true;
+} // end RenameFile
+
+//--------------------------------------------------------------------
+// Return true if two handles refer to the same file:
+
+bool SameFile(File a, File b)
+{
+  BY_HANDLE_FILE_INFORMATION  infoA, infoB;
+
+  return (GetFileInformationByHandle(a, &infoA) &&
+          GetFileInformationByHandle(b, &infoB) &&
+          infoA.dwVolumeSerialNumber == infoB.dwVolumeSerialNumber &&
+          infoA.nFileIndexHigh == infoB.nFileIndexHigh &&
+          infoA.nFileIndexLow  == infoB.nFileIndexLow);
+} // end SameFile
+
+//--------------------------------------------------------------------
+// Return true if a path names a directory:
+
+inline bool IsDirectory(const char* path)
+{
+  const DWORD  attributes = GetFileAttributes(path);
+
+  return (attributes != INVALID_FILE_ATTRIBUTES &&
+          (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+} // end IsDirectory
+
+//--------------------------------------------------------------------
+// Return true if standard input and output are a console:
+
+inline bool IsInteractive()
+{
+  return (GetFileType(GetStdHandle(STD_INPUT_HANDLE))  == FILE_TYPE_CHAR &&
+          GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) == FILE_TYPE_CHAR);
+} // end IsInteractive
+
+//--------------------------------------------------------------------
+// List the files and subdirectories in a directory:
+//
+// Directory junctions and links are skipped (so walking a tree can't
+// go around in circles).
+//
+// Input:
+//   path:  The directory to list
+//
+// Output:
+//   entries:  The files and directories in it, in no particular order
+//
+// Returns:
+//   true:   The directory was read
+//   false:  Unable to read it (call ErrorMsg for error message)
+
+bool ListDirectory(const char* path, vector<DirEntry>& entries)
+{
+  WIN32_FIND_DATA  found;
+
+  string  pattern(path);
+  if (pattern.empty() || !strchr("/\\:", pattern[pattern.size() - 1]))
+    pattern += '\\';
+  pattern += '*';
+
+  HANDLE  find = FindFirstFile(pattern.c_str(), &found);
+  if (find == INVALID_HANDLE_VALUE) return false;
+
+  entries.clear();
+
+  do {
+    const char*  name = found.cFileName;
+    if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+
+    DirEntry  entry;
+    entry.name  = name;
+    entry.isDir = (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+    if (entry.isDir && (found.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+      continue;
+
+    entry.size = (entry.isDir ? 0 : ((FPos(found.nFileSizeHigh) << 32) |
+                                     found.nFileSizeLow));
+    entries.push_back(entry);
+  } while (FindNextFile(find, &found));
+
+  const DWORD  error = GetLastError();
+  FindClose(find);
+  SetLastError(error);
+
+  return (error == ERROR_NO_MORE_FILES);
+} // end ListDirectory
+
 #endif // INCLUDED_FILEIO_HPP
 
 // Local Variables: